@@ -0,0 +1,60 @@
+#!/bin/bash
+# Time the assembler on the self-compilation output (and on a large
+# generated file). Usage: bench_as.sh [ x86 | x64 ] [ assembler ]
+
+ARCH=${1:-x64}
+AS=${2:-src/luxas/luxas}
+TMP_PATH=src/tests/self/bench
+NREP=5
+
+if [ "$ARCH" = "x86" ]; then
+	CFLAGS="-q -mx86"
+	ASFLAGS="-m32"
+else
+	CFLAGS="-q -mx64"
+	ASFLAGS="-m64"
+fi
+
+/bin/bash scripts/self_copy.sh
+mkdir -p $TMP_PATH
+
+# compile the sources of the compiler
+for file in $(find src/tests/self/ -name '*.c') ; do
+	name=$(echo ${file#src/tests/self/} | tr '/' '_')
+	if ! src/luxcc $CFLAGS $file -o $TMP_PATH/${name%.*}.s ; then
+		echo "Compiler failed with file $file"
+		exit 1
+	fi
+done
+
+# a single large file with many labels and branches
+awk 'BEGIN {
+	print "section .text";
+	for (i = 0; i < 100000; i++) {
+		printf "global f%d\nf%d:\n\tcmp eax, %d\n\tje .L1\n\tjmp f%d\n.L1:\n\tret\n", i, i, i, (i*7)%100000;
+	}
+	print "section .data";
+	for (i = 0; i < 100000; i++)
+		printf "d%d:\n\tdd f%d\n", i, i;
+}' > $TMP_PATH/big.asm
+
+bench() {
+	start=$(date +%s%N)
+	for i in $(seq $NREP) ; do
+		for file in "$@" ; do
+			if ! $AS $ASFLAGS $file -o $TMP_PATH/out.o ; then
+				echo "Assembler failed with file $file"
+				exit 1
+			fi
+		done
+	done
+	end=$(date +%s%N)
+	echo "$(( (end-start)/1000000/NREP )) ms"
+}
+
+echo -n "self-compilation output ($(cat $TMP_PATH/*.s | wc -c) bytes): "
+bench $TMP_PATH/*.s
+echo -n "generated file ($(wc -c < $TMP_PATH/big.asm) bytes): "
+bench $TMP_PATH/big.asm
+
+rm -rf $TMP_PATH
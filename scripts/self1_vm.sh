@@ -19,7 +19,8 @@ fail_counter=0
 pass_counter=0
 object_files=""
 
-for file in $(find src/tests/self/ | grep '\.c') ; do
+# luxas (luxcc -c) needs setjmp(), which the VM does not provide
+for file in $(find src/tests/self/ | grep '\.c' | grep -v '/luxas/') ; do
 	echo $file
 
 	# compile	
@@ -6,3 +6,5 @@ mkdir -p src/tests/self/luxvm
 cp src/luxvm/vm.h src/tests/self/luxvm/
 cp -r src/x86_cgen/ src/tests/self/
 cp -r src/x64_cgen/ src/tests/self/
+mkdir -p src/tests/self/luxas
+cp src/luxas/luxas.[ch] src/luxas/ELF_util.[ch] src/tests/self/luxas/
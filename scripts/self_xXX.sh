@@ -4,13 +4,12 @@ TEST_PATH=src/tests/self
 DVR=src/luxdvr/luxdvr
 CC1=$TEST_PATH/luxcc1.out
 CC2=$TEST_PATH/luxcc2.out
-ASM_TMP=$TEST_PATH/asm_tmp.asm
-CFLAGS="-m$1 -q -alt-asm-tmp $ASM_TMP"
+CFLAGS="-m$1 -q -DWITH_LUXAS"
 
 /bin/bash scripts/self_copy.sh
 
 # phase 1
-$DVR $CFLAGS $TEST_PATH/*.c $TEST_PATH/vm32_cgen/*.c $TEST_PATH/vm64_cgen/*.c $TEST_PATH/x86_cgen/*.c $TEST_PATH/x64_cgen/*.c -o $CC1 &>/dev/null
+$DVR $CFLAGS $TEST_PATH/*.c $TEST_PATH/vm32_cgen/*.c $TEST_PATH/vm64_cgen/*.c $TEST_PATH/x86_cgen/*.c $TEST_PATH/x64_cgen/*.c $TEST_PATH/luxas/luxas.c $TEST_PATH/luxas/ELF_util.c -o $CC1 &>/dev/null
 if [ "$?" != "0" ] ; then
 	echo "Phase 1 failed!"
 	exit 1
@@ -21,7 +20,7 @@ fi
 # phase 2
 mv src/luxcc src/luxcc_tmp
 cp $CC1 src/luxcc
-$DVR $CFLAGS $TEST_PATH/*.c $TEST_PATH/vm32_cgen/*.c $TEST_PATH/vm64_cgen/*.c $TEST_PATH/x86_cgen/*.c $TEST_PATH/x64_cgen/*.c -o $CC2 &>/dev/null
+$DVR $CFLAGS $TEST_PATH/*.c $TEST_PATH/vm32_cgen/*.c $TEST_PATH/vm64_cgen/*.c $TEST_PATH/x86_cgen/*.c $TEST_PATH/x64_cgen/*.c $TEST_PATH/luxas/luxas.c $TEST_PATH/luxas/ELF_util.c -o $CC2 &>/dev/null
 if [ "$?" != "0" ] ; then
 	echo "Phase 2 failed!"
 	mv src/luxcc_tmp src/luxcc
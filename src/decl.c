@@ -8,18 +8,20 @@
 #include "expr.h"
 #include "stmt.h"
 #include "arena.h"
+#include "intern.h"
 #include "imp_lim.h"
 #include "error.h"
 #include "luxcc.h"
 
-#define ERROR(tok, ...) emit_error(TRUE, (tok)->info->src_file, (tok)->info->src_line, (tok)->info->src_column, __VA_ARGS__)
-#define WARNING(tok, ...) emit_warning((tok)->info->src_file, (tok)->info->src_line, (tok)->info->src_column, __VA_ARGS__)
+#define ERROR(tok, ...) emit_error(TRUE, tok_src_file((tok)->info), tok_src_line((tok)->info), tok_src_column((tok)->info), __VA_ARGS__)
+#define WARNING(tok, ...) emit_warning(tok_src_file((tok)->info), tok_src_line((tok)->info), tok_src_column((tok)->info), __VA_ARGS__)
 
 #define HASH_SIZE       4093
 #define OUTERMOST_LEVEL 0
 #define FILE_SCOPE      0
 #define HASH_VAL(s)     (hash(s)%HASH_SIZE)
 #define HASH_VAL2(x)    (hash2(x)%HASH_SIZE)
+#define HASH_ID(s)      (istr_hash(s)%HASH_SIZE) /* interned identifiers */
 
 char *current_function_name; /* used to implement __func__ */
 
@@ -36,26 +38,45 @@ ExternId *get_external_declarations(void)
  * identifiers and tags name spaces.
  * The symbol table that implements label names is in stmt.c.
  * Structure and union members are handled in a special way.
+ *
+ * There is one hash table for each name space. The entries of a
+ * bucket are kept sorted by nesting level (innermost first), so
+ * the first entry found for a name is the one that is visible.
+ * Every scope also records the entries declared in it; closing
+ * the scope just unlinks those.
  */
-static Symbol *ordinary_identifiers[MAX_NEST][HASH_SIZE];
-static TypeTag *tags[MAX_NEST][HASH_SIZE];
+static Symbol *ordinary_identifiers[HASH_SIZE];
+static TypeTag *tags[HASH_SIZE];
+
+static struct Scope {
+    Symbol *syms;
+    TypeTag *tags;
+} *scopes;
+static int max_nesting_level;
 
 static int nesting_level = OUTERMOST_LEVEL;
 static int delayed_delete;
 static int scope_id;
 
-static Arena *oids_arena[MAX_NEST];
-static Arena *tags_arena[MAX_NEST];
+static Symbol *free_syms;   /* recycled symbols */
+static TypeTag *free_tags;  /* recycled tags */
 static Arena *decl_node_arena;
 
-void decl_init(void)
+static void grow_scopes(void)
 {
-    int i;
+    struct Scope *p;
 
-    for (i = 0; i < MAX_NEST; i++) {
-        oids_arena[i] = arena_new(sizeof(Symbol)*64, FALSE);
-        tags_arena[i] = arena_new(sizeof(TypeTag)*32, FALSE);
-    }
+    max_nesting_level = (max_nesting_level==0) ? 16 : max_nesting_level*2;
+    if ((p=realloc(scopes, max_nesting_level*sizeof(struct Scope))) == NULL)
+        TERMINATE("error: grow_scopes(): out of memory");
+    scopes = p;
+}
+
+void decl_init(void)
+{
+    grow_scopes();
+    scopes[OUTERMOST_LEVEL].syms = NULL;
+    scopes[OUTERMOST_LEVEL].tags = NULL;
     decl_node_arena = arena_new(2048, FALSE);
 }
 
@@ -136,13 +157,27 @@ TypeExp *get_type_qual(TypeExp *d)
 /* pop_scope() just set a flag. This function performs the actual delete. */
 static void delete_scope(void)
 {
-    assert(nesting_level >= 0);
+    Symbol *sp, *snext, **spp;
+    TypeTag *tp, *tnext, **tpp;
 
-    memset(&ordinary_identifiers[nesting_level][0], 0, sizeof(Symbol *)*HASH_SIZE);
-    arena_reset(oids_arena[nesting_level]);
+    assert(nesting_level >= 0);
 
-    memset(&tags[nesting_level][0], 0, sizeof(TypeTag *)*HASH_SIZE);
-    arena_reset(tags_arena[nesting_level]);
+    for (sp = scopes[nesting_level].syms; sp != NULL; sp = snext) {
+        snext = sp->scope_next;
+        for (spp = &ordinary_identifiers[HASH_ID(sp->declarator->str)]; *spp != sp; spp = &(*spp)->next)
+            ;
+        *spp = sp->next;
+        sp->next = free_syms;
+        free_syms = sp;
+    }
+    for (tp = scopes[nesting_level].tags; tp != NULL; tp = tnext) {
+        tnext = tp->scope_next;
+        for (tpp = &tags[HASH_VAL(tp->type->str)]; *tpp != tp; tpp = &(*tpp)->next)
+            ;
+        *tpp = tp->next;
+        tp->next = free_tags;
+        free_tags = tp;
+    }
 
     --nesting_level;
     delayed_delete = FALSE;
@@ -158,8 +193,10 @@ void push_scope(void)
     if (delayed_delete)
         delete_scope();
 
-    if (++nesting_level >= MAX_NEST) /* overflow */
-        TERMINATE("error: too many nested scopes (>= %d)", MAX_NEST);
+    if (++nesting_level >= max_nesting_level)
+        grow_scopes();
+    scopes[nesting_level].syms = NULL;
+    scopes[nesting_level].tags = NULL;
 
     ++scope_id; /* create a new ID for this scope */
 }
@@ -179,95 +216,95 @@ int get_curr_scope_id(void)
 
 TypeTag *lookup_tag(char *id, int all)
 {
-    int n;
-    unsigned h;
     TypeTag *np;
 
     if (delayed_delete)
         delete_scope();
 
-    n = nesting_level;
-    h = HASH_VAL(id);
-    if (all == TRUE) {
-        for (; n >= 0; n--)
-            for (np = tags[n][h]; np != NULL; np = np->next)
-                if (equal(id, np->type->str))
-                    return np;
-        return NULL; /* not found */
-    } else {
-        for (np = tags[n][h]; np != NULL; np = np->next)
-            if (equal(id, np->type->str))
-                return np;
-        return NULL; /* not found */
+    for (np = tags[HASH_VAL(id)]; np != NULL; np = np->next) {
+        if (np->nesting_level > nesting_level)
+            continue;
+        if (equal(id, np->type->str))
+            return (all==TRUE || np->nesting_level==nesting_level) ? np : NULL;
     }
+    return NULL; /* not found */
 }
 
 void install_tag(TypeExp *ty)
 {
-    unsigned h;
-    TypeTag *np;
+    TypeTag *np, **pos;
 
     DEBUG_PRINTF("new tag `%s', nesting level: %d\n", ty->str, nesting_level);
 
     if (delayed_delete)
         delete_scope();
 
-    np = arena_alloc(tags_arena[nesting_level], sizeof(TypeTag));
+    if ((np=free_tags) != NULL)
+        free_tags = np->next;
+    else
+        np = arena_alloc(decl_node_arena, sizeof(TypeTag));
+    /*
+     * Tags are interned, but the tag string of a type is used to identify it
+     * (tags with the same spelling can name different types in different scopes).
+     */
+    ty->str = strcpy(arena_alloc(decl_node_arena, (unsigned)strlen(ty->str)+1), ty->str);
     np->type = ty;
-    h = HASH_VAL(ty->str);
-    np->next = tags[nesting_level][h];
-    tags[nesting_level][h] = np;
+    np->nesting_level = nesting_level;
+    for (pos = &tags[HASH_VAL(ty->str)]; *pos!=NULL && (*pos)->nesting_level>nesting_level; pos = &(*pos)->next)
+        ;
+    np->next = *pos;
+    *pos = np;
+    np->scope_next = scopes[nesting_level].tags;
+    scopes[nesting_level].tags = np;
 }
 
 Symbol *lookup_ordinary_id(char *id, int all)
 {
-    int n;
     Symbol *np;
-    unsigned h;
 
     if (delayed_delete)
         delete_scope();
 
-    n = nesting_level;
-    h = HASH_VAL(id);
-    if (all == TRUE) {
-        for (; n >= 0; n--)
-            for (np = ordinary_identifiers[n][h]; np != NULL; np = np->next)
-                if (equal(id, np->declarator->str))
-                    return np;
-        return NULL; /* not found */
-    } else {
-        for (np = ordinary_identifiers[n][h]; np != NULL; np = np->next)
-            if (equal(id, np->declarator->str))
-                return np;
-        return NULL; /* not found */
+    for (np = ordinary_identifiers[HASH_ID(id)]; np != NULL; np = np->next) {
+        if (np->nesting_level > nesting_level)
+            continue; /* see analyze_function_definition() */
+        if (id == np->declarator->str)
+            return (all==TRUE || np->nesting_level==nesting_level) ? np : NULL;
     }
+    return NULL; /* not found */
 }
 
 static void install_ordinary_id(TypeExp *decl_specs, TypeExp *declarator, int is_param)
 {
-    Symbol *np;
-    unsigned h;
+    Symbol *np, **pos;
     TypeExp *scs;
     Token curr_scs, prev_scs;
 
     if (delayed_delete)
         delete_scope();
 
-    h = HASH_VAL(declarator->str);
-    for (np = ordinary_identifiers[nesting_level][h]; np != NULL; np = np->next)
-        if (equal(declarator->str, np->declarator->str))
+    /* entries of inner scopes come first */
+    pos = &ordinary_identifiers[HASH_ID(declarator->str)];
+    while (*pos!=NULL && (*pos)->nesting_level>nesting_level)
+        pos = &(*pos)->next;
+    for (np = *pos; np!=NULL && np->nesting_level==nesting_level; np = np->next)
+        if (declarator->str == np->declarator->str)
             break;
 
-    if (np == NULL) { /* not found in this scope */
-        np = arena_alloc(oids_arena[nesting_level], sizeof(Symbol));
+    if (np==NULL || np->nesting_level!=nesting_level) { /* not found in this scope */
+        if ((np=free_syms) != NULL)
+            free_syms = np->next;
+        else
+            np = arena_alloc(decl_node_arena, sizeof(Symbol));
         np->decl_specs = decl_specs;
         np->declarator = declarator;
         np->is_param = (short)is_param;
         np->nesting_level = (short)nesting_level;
         np->scope = scope_id;
-        np->next = ordinary_identifiers[nesting_level][h];
-        ordinary_identifiers[nesting_level][h] = np;
+        np->next = *pos;
+        *pos = np;
+        np->scope_next = scopes[nesting_level].syms;
+        scopes[nesting_level].syms = np;
         return;
     }
 
@@ -344,8 +381,8 @@ ExternId *lookup_external_id(char *id)
 {
     ExternId *np;
 
-    for (np = external_declarations[HASH_VAL(id)]; np != NULL; np = np->next)
-        if (equal(id, np->declarator->str))
+    for (np = external_declarations[HASH_ID(id)]; np != NULL; np = np->next)
+        if (id == np->declarator->str)
             return np;
     return NULL; /* not found */
 }
@@ -359,7 +396,7 @@ static void install_external_id(TypeExp *decl_specs, TypeExp *declarator, ExtIdS
     np->decl_specs = decl_specs;
     np->declarator = declarator;
     np->status = status;
-    h = HASH_VAL(declarator->str);
+    h = HASH_ID(declarator->str);
     np->next = external_declarations[h];
     external_declarations[h] = np;
 }
@@ -666,6 +703,9 @@ int compare_decl_specs(TypeExp *ds1, TypeExp *ds2, int qualified)
 {
     TypeExp *temp1, *temp2;
 
+    if (ds1 == ds2)
+        return TRUE;
+
     /* type specifiers */
     temp1 = get_type_spec(ds1);
     temp2 = get_type_spec(ds2);
@@ -696,6 +736,10 @@ int are_compatible(TypeExp *ds1, TypeExp *dct1,
                    TypeExp *ds2, TypeExp *dct2,
                    int qualified, int compose)
 {
+    /* types that share their nodes are trivially compatible */
+    if (ds1==ds2 && dct1==dct2)
+        return TRUE;
+
     /* identifiers are non-significant */
     if (dct1!=NULL && dct1->op==TOK_ID)
         dct1 = dct1->child;
@@ -880,7 +924,7 @@ static void analyze_declarator2(TypeExp *decl_specs, TypeExp *declarator)
     analyze_declarator2(decl_specs, declarator->child);
 }
 
-static TokenNode *typedef_name_info;
+static TokenIndex typedef_name_info;
 
 static DeclList *new_param_decl(TypeExp *decl_specs, TypeExp *declarator)
 {
@@ -1549,18 +1593,55 @@ static StructDescriptor *struct_descriptor_table[HASH_SIZE];
 static StructDescriptor *descriptor_stack[MAX_DESCR_STACK];
 static int descr_stack_top = -1;
 
+static StructMember *lookup_member(StructDescriptor *sd, char *id)
+{
+    StructMember *m;
+
+    if (sd->index_size == 0)
+        return NULL;
+    for (m = sd->index[istr_hash(id)&(sd->index_size-1)]; m != NULL; m = m->hnext)
+        if (id == m->id)
+            return m;
+    return NULL;
+}
+
+/*
+ * Enter `m' into the member index of `sd'.
+ * The index is rebuilt with twice the buckets when it gets half full.
+ */
+static void index_member(StructDescriptor *sd, StructMember *m)
+{
+    unsigned h;
+
+    if (sd->nmembers*2 >= sd->index_size) {
+        StructMember *p;
+
+        sd->index_size = (sd->index_size==0) ? 8 : sd->index_size*2;
+        sd->index = arena_alloc(decl_node_arena, sd->index_size*sizeof(StructMember *));
+        memset(sd->index, 0, sd->index_size*sizeof(StructMember *));
+        for (p = sd->members; p != NULL; p = p->next) {
+            h = istr_hash(p->id)&(sd->index_size-1);
+            p->hnext = sd->index[h];
+            sd->index[h] = p;
+        }
+    }
+    h = istr_hash(m->id)&(sd->index_size-1);
+    m->hnext = sd->index[h];
+    sd->index[h] = m;
+    ++sd->nmembers;
+}
+
 /*
  * Add a new member to the top descriptor.
  */
 void new_struct_member(TypeExp *decl_specs, TypeExp *declarator)
 {
     unsigned alignment;
-    StructMember *n, *p;
+    StructMember *n;
 
     /* before add, check for duplicate */
-    for (p = descriptor_stack[descr_stack_top]->members; p != NULL; p = p->next)
-        if (equal(declarator->str, p->id))
-            ERROR(declarator, "duplicate member `%s'", declarator->str);
+    if (lookup_member(descriptor_stack[descr_stack_top], declarator->str) != NULL)
+        ERROR(declarator, "duplicate member `%s'", declarator->str);
 
     n = arena_alloc(decl_node_arena, sizeof(StructMember));
     /* set tag and type */
@@ -1578,6 +1659,7 @@ void new_struct_member(TypeExp *decl_specs, TypeExp *declarator)
     if (alignment > descriptor_stack[descr_stack_top]->alignment)
         descriptor_stack[descr_stack_top]->alignment = alignment;
     /* append member */
+    index_member(descriptor_stack[descr_stack_top], n);
     n->next = descriptor_stack[descr_stack_top]->members;
     descriptor_stack[descr_stack_top]->members = n;
 }
@@ -1606,8 +1688,11 @@ void push_struct_descriptor(TypeExp *ty)
     /* push new descriptor */
     n = arena_alloc(decl_node_arena, sizeof(StructDescriptor));
     n->tag = tag;
+    n->op = ty->op;
     n->size = n->alignment = 0;
     n->members = NULL;
+    n->index = NULL;
+    n->nmembers = n->index_size = 0;
     descriptor_stack[++descr_stack_top] = n;
 }
 
@@ -1624,6 +1709,16 @@ void pop_struct_descriptor(void)
     --descr_stack_top;
     tag = n->tag;
 
+    /* the size of a union is the size of its largest member */
+    if (n->op == TOK_UNION) {
+        StructMember *m;
+
+        n->size = 0;
+        for (m = n->members; m != NULL; m = m->next)
+            if (m->size > n->size)
+                n->size = m->size;
+    }
+
     /* adjust the overall size to met with alignment requirements */
     n->size = round_up(n->size, n->alignment);
 
@@ -1648,17 +1743,19 @@ StructDescriptor *lookup_struct_descriptor(char *tag)
     return np;
 }
 
+/* return the member `id' of the struct/union type `ty', or NULL if there is not such member */
+StructMember *find_struct_member(TypeExp *ty, char *id)
+{
+    return lookup_member(lookup_struct_descriptor(ty->str), id);
+}
+
 StructMember *get_member_descriptor(TypeExp *ty, char *id)
 {
     StructMember *m;
 
-    m = lookup_struct_descriptor(ty->str)->members;
-    while (m != NULL) {
-        if (equal(id, m->id))
-            return m;
-        m = m->next;
-    }
-    assert(0);
+    m = find_struct_member(ty, id);
+    assert(m != NULL);
+    return m;
 }
 
 void analyze_struct_declarator(TypeExp *sql, TypeExp *declarator)
@@ -28,12 +28,16 @@ struct StructMember {
     unsigned size, offset;
     Declaration type;
     StructMember *next;
+    StructMember *hnext; /* next member in the same index bucket */
 };
 
 struct StructDescriptor {
     char *tag;
+    Token op; /* TOK_STRUCT or TOK_UNION */
     unsigned size, alignment; /* overall size and member's most restrictive alignment */
     StructMember *members;
+    StructMember **index;   /* members hashed by name */
+    unsigned nmembers, index_size;
     StructDescriptor *next;
 };
 
@@ -43,11 +47,14 @@ struct Symbol {
     short is_param, nesting_level;
     int scope;
     Symbol *next;
+    Symbol *scope_next; /* next symbol declared in the same scope */
 };
 
 struct TypeTag {
     TypeExp *type;
+    int nesting_level;
     TypeTag *next;
+    TypeTag *scope_next; /* next tag declared in the same scope */
 };
 
 void analyze_translation_unit(void);
@@ -90,6 +97,7 @@ TypeExp *dup_decl_specs(TypeExp *ds);
 void push_struct_descriptor(TypeExp *ty);
 void pop_struct_descriptor(void);
 StructDescriptor *lookup_struct_descriptor(char *tag);
+StructMember *find_struct_member(TypeExp *ty, char *id);
 StructMember *get_member_descriptor(TypeExp *ty, char *id);
 
 ExternId *get_external_declarations(void);
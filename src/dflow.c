@@ -257,12 +257,251 @@ void dflow_Dom(unsigned fn)
 #endif
 }
 
+// =======================================================================================
+// Points-to analysis.
+// =======================================================================================
+/*
+ * Flow-insensitive, inclusion-based (Andersen-style) analysis over the quads
+ * of a single function. Objects whose address is taken in the function but
+ * that never escape it (passed to a call, stored through a pointer or into an
+ * aliased variable, returned) can only be referenced through the pointers the
+ * function computes itself, so they are not affected by unknown pointers and
+ * calls. Everything else in address_taken_variables is assumed to be
+ * reachable from any pointer of unknown origin.
+ */
+BSet **pointees_tab;
+static BSet **pt_tab;       /* explicit pointees, indexed by nid */
+static char *pt_flags;      /* PT_* flags, indexed by nid */
+#define PT_UNKNOWN  0x1         /* may also point to any aliased object */
+#define PT_KEEP     0x2         /* pointee set is referenced by pointees_tab */
+static BSet *escaped_objects;
+static BSet *tmp_set;
+
+static int pt_is_root(unsigned a)
+{
+    ExecNode *e;
+
+    if (address(a).kind != IdKind)
+        return FALSE;
+    e = address(a).cont.var.e;
+    return (e->attr.var.duration==DURATION_STATIC || e->attr.var.is_param
+    || bset_member(address_taken_variables, address_nid(a)));
+}
+
+static int pt_insert(int nid, int obj)
+{
+    if (pt_tab[nid] == NULL)
+        pt_tab[nid] = bset_new(nid_counter);
+    else if (bset_member(pt_tab[nid], obj))
+        return FALSE;
+    bset_insert(pt_tab[nid], obj);
+    return TRUE;
+}
+
+/* pt(tar) = pt(tar) U pt(a) */
+static int pt_copy(unsigned tar, unsigned a)
+{
+    int t, changed;
+
+    if (const_addr(a))
+        return FALSE;
+    t = address_nid(tar);
+    changed = FALSE;
+    if (!(pt_flags[t]&PT_UNKNOWN) && ((pt_flags[address_nid(a)]&PT_UNKNOWN) || pt_is_root(a))) {
+        pt_flags[t] |= PT_UNKNOWN;
+        changed = TRUE;
+    }
+    if (pt_tab[address_nid(a)] != NULL) {
+        if (pt_tab[t] == NULL) {
+            pt_tab[t] = bset_new(nid_counter);
+            bset_cpy(pt_tab[t], pt_tab[address_nid(a)]);
+            return TRUE;
+        } else {
+            bset_cpy(tmp_set, pt_tab[t]);
+            bset_union(pt_tab[t], pt_tab[address_nid(a)]);
+            changed |= !bset_eq(tmp_set, pt_tab[t]);
+        }
+    }
+    return changed;
+}
+
+static int pt_unknown_tar(unsigned tar)
+{
+    if (pt_flags[address_nid(tar)] & PT_UNKNOWN)
+        return FALSE;
+    pt_flags[address_nid(tar)] |= PT_UNKNOWN;
+    return TRUE;
+}
+
+/* everything a points to escapes */
+static int pt_escape(unsigned a)
+{
+    BSet *pt;
+
+    if (const_addr(a) || (pt=pt_tab[address_nid(a)])==NULL)
+        return FALSE;
+    bset_cpy(tmp_set, escaped_objects);
+    bset_union(escaped_objects, pt);
+    return !bset_eq(tmp_set, escaped_objects);
+}
+
+void dflow_PointsTo(unsigned fn)
+{
+    unsigned i, first, last;
+    int changed;
+    BSet *local_objects, *aliased;
+
+    if (cg_node_is_empty(fn))
+        return;
+
+    if (pointees_tab == NULL)
+        pointees_tab = calloc(ic_instructions_counter, sizeof(BSet *));
+    pt_tab = calloc(nid_counter, sizeof(BSet *));
+    pt_flags = calloc(nid_counter, sizeof(char));
+    escaped_objects = bset_new(nid_counter);
+    local_objects = bset_new(nid_counter);
+    tmp_set = bset_new(nid_counter);
+    first = cfg_node(cg_node(fn).bb_i).leader;
+    last = cfg_node(cg_node(fn).bb_f).last;
+
+    changed = TRUE;
+    while (changed) {
+        changed = FALSE;
+        for (i = first; i <= last; i++) {
+            unsigned tar, arg1, arg2;
+
+            tar = instruction(i).tar;
+            arg1 = instruction(i).arg1;
+            arg2 = instruction(i).arg2;
+
+            switch (instruction(i).op) {
+            case OpAdd: case OpSub: case OpMul: case OpDiv:
+            case OpRem: case OpSHL: case OpSHR: case OpAnd:
+            case OpOr: case OpXor: case OpEQ: case OpNEQ:
+            case OpLT: case OpLET: case OpGT: case OpGET:
+                changed |= pt_copy(tar, arg1);
+                changed |= pt_copy(tar, arg2);
+                continue;
+
+            case OpNeg: case OpCmpl: case OpNot: case OpCh:
+            case OpUCh: case OpSh: case OpUSh: case OpLLSX:
+            case OpLLZX:
+                changed |= pt_copy(tar, arg1);
+                continue;
+
+            case OpAsn:
+                changed |= pt_copy(tar, arg1);
+                if (pt_is_root(tar))
+                    changed |= pt_escape(arg1);
+                continue;
+
+            case OpAddrOf:
+                if (address(arg1).cont.var.e->attr.var.duration == DURATION_AUTO)
+                    bset_insert(local_objects, address_nid(arg1));
+                changed |= pt_insert(address_nid(tar), address_nid(arg1));
+                continue;
+
+            case OpInd:
+                changed |= pt_unknown_tar(tar);
+                continue;
+
+            case OpIndAsn:
+                changed |= pt_escape(arg2);
+                continue;
+
+            case OpArg:
+            case OpRet:
+                changed |= pt_escape(arg1);
+                continue;
+
+            case OpCall:
+            case OpIndCall:
+                if (tar)
+                    changed |= pt_unknown_tar(tar);
+                continue;
+
+            default:
+                continue;
+            }
+        }
+    }
+
+    /* aliased = address_taken_variables - (local_objects - escaped_objects) */
+    aliased = bset_new(nid_counter);
+    bset_cpy(aliased, address_taken_variables);
+    bset_diff(local_objects, escaped_objects);
+    bset_diff(aliased, local_objects);
+    cg_node(fn).aliased_objects = aliased;
+
+    /* record the pointees of every indirection */
+    for (i = first; i <= last; i++) {
+        unsigned p;
+        BSet *pt;
+
+        if (instruction(i).op!=OpInd && instruction(i).op!=OpIndAsn)
+            continue;
+        p = instruction(i).arg1;
+        if (const_addr(p) || (pt=pt_tab[address_nid(p)])==NULL) {
+            pointees_tab[i] = aliased;
+        } else {
+            /* the merged set is computed once and shared by all the quads that use p */
+            if (!(pt_flags[address_nid(p)]&PT_KEEP)
+            && ((pt_flags[address_nid(p)]&PT_UNKNOWN) || pt_is_root(p)))
+                bset_union(pt, aliased);
+            pointees_tab[i] = pt;
+            pt_flags[address_nid(p)] |= PT_KEEP;
+        }
+    }
+
+    for (i = 0; i < nid_counter; i++)
+        if (pt_tab[i]!=NULL && !(pt_flags[i]&PT_KEEP))
+            bset_free(pt_tab[i]);
+    free(pt_tab);
+    free(pt_flags);
+    bset_free(escaped_objects);
+    bset_free(local_objects);
+    bset_free(tmp_set);
+}
+
+/*
+ * Release the pointee sets of function fn. To be called by
+ * the back-end once the code of the function has been emitted.
+ * Every set other than the aliased one is owned by exactly one
+ * pointer (the arg1 of the quads that reference it).
+ */
+void dflow_free_pointees(unsigned fn)
+{
+    unsigned i, first, last;
+    BSet *freed;
+
+    if (cg_node_is_empty(fn))
+        return;
+
+    first = cfg_node(cg_node(fn).bb_i).leader;
+    last = cfg_node(cg_node(fn).bb_f).last;
+    freed = bset_new(nid_counter);
+    for (i = first; i <= last; i++) {
+        unsigned p;
+
+        if (instruction(i).op!=OpInd && instruction(i).op!=OpIndAsn)
+            continue;
+        p = instruction(i).arg1;
+        if (pointees_tab[i]!=cg_node(fn).aliased_objects && !bset_member(freed, address_nid(p))) {
+            bset_insert(freed, address_nid(p));
+            bset_free(pointees_tab[i]);
+        }
+        pointees_tab[i] = NULL;
+    }
+    bset_free(freed);
+}
+
 // =======================================================================================
 // Live analysis.
 // =======================================================================================
 static void live_init_block(unsigned b, int exit_bb);
 static BSet *live_tmp;
 static BSet *modified_static_objects;
+static BSet *aliased_objects;
 
 /*
  * Compute UEVar(b) and VarKill(b).
@@ -353,10 +592,10 @@ void live_init_block(unsigned b, int exit_bb)
         case OpInd:
             /*
              * For safety, overestimate ambiguous indirect
-             * references (assume all address-taken variables
-             * are referenced).
+             * references (assume all the objects the pointer
+             * may point to are referenced).
              */
-            bset_cpy(live_tmp, address_taken_variables);
+            bset_cpy(live_tmp, pointees_tab[i]);
             bset_diff(live_tmp, VarKill);
             bset_union(UEVar, live_tmp);
 
@@ -379,7 +618,7 @@ void live_init_block(unsigned b, int exit_bb)
 
         case OpCall:
         case OpIndCall:
-            bset_cpy(live_tmp, address_taken_variables);
+            bset_cpy(live_tmp, aliased_objects);
             bset_union(live_tmp, modified_static_objects);
             bset_diff(live_tmp, VarKill);
             bset_union(UEVar, live_tmp);
@@ -416,6 +655,7 @@ void dflow_LiveOut(unsigned fn)
     // vdp_arena = arena_new(sizeof(VarDefPoint)*32);
     live_tmp = bset_new(nid_counter);
     modified_static_objects = bset_new(nid_counter);
+    aliased_objects = cg_node(fn).aliased_objects;
 
     /* gather initial information */
     for (i = entry_bb; i <= exit_bb; i++) {
@@ -478,6 +718,141 @@ void dflow_LiveOut(unsigned fn)
 #endif
 }
 
+// =======================================================================================
+// Side-effect summaries.
+// =======================================================================================
+
+static int is_static_object(unsigned a)
+{
+    ExecNode *e;
+
+    if (address(a).kind != IdKind)
+        return FALSE;
+    e = address(a).cont.var.e;
+    return e->attr.var.duration==DURATION_STATIC && get_type_category(&e->type)!=TOK_FUNCTION;
+}
+
+/* compute the effects of function fn that do not depend on its callees */
+static void se_init_function(unsigned fn)
+{
+    unsigned b, i;
+    unsigned se;
+
+    se = 0;
+    for (b = cg_node(fn).bb_i; b <= cg_node(fn).bb_f; b++) {
+        for (i = cfg_node(b).leader; i <= cfg_node(b).last; i++) {
+            unsigned arg1, arg2;
+
+            arg1 = instruction(i).arg1;
+            arg2 = instruction(i).arg2;
+
+            switch (instruction(i).op) {
+            case OpAdd: case OpSub: case OpMul: case OpDiv:
+            case OpRem: case OpSHL: case OpSHR: case OpAnd:
+            case OpOr: case OpXor: case OpEQ: case OpNEQ:
+            case OpLT: case OpLET: case OpGT: case OpGET:
+                if (is_static_object(arg1) || is_static_object(arg2))
+                    se |= SE_READS_STATIC;
+                continue;
+
+            case OpNeg: case OpCmpl: case OpNot: case OpCh:
+            case OpUCh: case OpSh: case OpUSh: case OpLLSX:
+            case OpLLZX: case OpAsn:
+            case OpArg: case OpRet: case OpSwitch: case OpCBr:
+                if (is_static_object(arg1))
+                    se |= SE_READS_STATIC;
+                continue;
+
+            case OpInd:
+                if (is_static_object(arg1))
+                    se |= SE_READS_STATIC;
+                se |= SE_READS_PTR;
+                continue;
+
+            case OpIndAsn:
+                if (is_static_object(arg1) || is_static_object(arg2))
+                    se |= SE_READS_STATIC;
+                se |= SE_WRITES_PTR;
+                continue;
+
+            case OpCall: {
+                int callee;
+
+                se |= SE_CALLS;
+                /*
+                 * The front-end emits calls to memcpy/memset without
+                 * adding the corresponding call-graph edge.
+                 */
+                callee = cg_node_lookup(address(arg1).cont.var.e->attr.str);
+                if (callee==-1 || cg_node_is_empty(callee))
+                    se |= SE_UNKNOWN;
+                else
+                    edge_add(&cg_node(fn).out, (unsigned)callee);
+            }
+                continue;
+
+            case OpIndCall:
+                if (is_static_object(arg1))
+                    se |= SE_READS_STATIC;
+                se |= SE_CALLS|SE_UNKNOWN;
+                continue;
+
+            default:
+                continue;
+            }
+        }
+    }
+    cg_node(fn).side_effects = se;
+    cg_node(fn).modified_static_objects_tr = bset_new(nid_counter);
+    bset_cpy(cg_node(fn).modified_static_objects_tr, cg_node(fn).modified_static_objects);
+}
+
+/*
+ * Propagate the effects of every function to its callers, bottom-up over the
+ * call graph. Iterate because of recursion. Must run after dflow_LiveOut()
+ * (that is where the modified_static_objects sets are computed).
+ */
+void dflow_SideEffects(void)
+{
+    unsigned i;
+    int changed;
+    BSet *tmp;
+
+    for (i = 0; i < cg_nodes_counter; i++) {
+        if (cg_node_is_empty(i))
+            cg_node(i).side_effects = SE_UNKNOWN;
+        else
+            se_init_function(i);
+    }
+
+    tmp = bset_new(nid_counter);
+    changed = TRUE;
+    while (changed) {
+        changed = FALSE;
+        for (i = 0; i < cg_nodes_counter; i++) {
+            unsigned fn, succ, se;
+
+            fn = cg_node(i).PO;
+            if (cg_node_is_empty(fn))
+                continue;
+            se = cg_node(fn).side_effects;
+            bset_cpy(tmp, cg_node(fn).modified_static_objects_tr);
+            for (succ = edge_iterate(&cg_node(fn).out); succ != -1; succ = edge_iterate(NULL)) {
+                se |= cg_node(succ).side_effects & ~SE_CALLS;
+                if (!cg_node_is_empty(succ))
+                    bset_union(tmp, cg_node(succ).modified_static_objects_tr);
+            }
+            if (se != cg_node(fn).side_effects
+            || !bset_eq(tmp, cg_node(fn).modified_static_objects_tr)) {
+                cg_node(fn).side_effects = se;
+                bset_cpy(cg_node(fn).modified_static_objects_tr, tmp);
+                changed = TRUE;
+            }
+        }
+    }
+    bset_free(tmp);
+}
+
 /*
  * Liveness and next-use.
  */
@@ -615,7 +990,7 @@ static void compute_function_liveness_and_next_use(unsigned fn)
             case OpInd:
                 update_tar();
                 update_arg1();
-                bset_union(operand_liveness, address_taken_variables);
+                bset_union(operand_liveness, pointees_tab[i]);
                 continue;
 
             case OpIndAsn:
@@ -631,7 +1006,7 @@ static void compute_function_liveness_and_next_use(unsigned fn)
                 if (instruction(i).op==OpIndCall && !const_addr(arg1))
                     update_arg1();
                 bset_union(operand_liveness, cg_node(fn).modified_static_objects);
-                bset_union(operand_liveness, address_taken_variables);
+                bset_union(operand_liveness, cg_node(fn).aliased_objects);
                 continue;
 
             default: /* other */
@@ -751,15 +1126,12 @@ void print_liveness_and_next_use(unsigned fn)
 }
 #endif
 
-void compute_liveness_and_next_use(void)
+void compute_liveness_and_next_use(unsigned fn)
 {
-    int i;
-
-    liveness_and_next_use = calloc(ic_instructions_counter, sizeof(unsigned char));
-    operand_liveness = bset_new(nid_counter);
-    operand_next_use = bset_new(nid_counter);
-    for (i = 0; i < cg_nodes_counter; i++)
-        compute_function_liveness_and_next_use(i);
-    bset_free(operand_liveness);
-    bset_free(operand_next_use);
+    if (liveness_and_next_use == NULL) {
+        liveness_and_next_use = calloc(ic_instructions_counter, sizeof(unsigned char));
+        operand_liveness = bset_new(nid_counter);
+        operand_next_use = bset_new(nid_counter);
+    }
+    compute_function_liveness_and_next_use(fn);
 }
@@ -1,12 +1,21 @@
 #ifndef DFLOW_H_
 #define DFLOW_H_
 
+#include "bset.h"
+
 void dflow_Dom(unsigned fn);
+void dflow_PointsTo(unsigned fn);
 void dflow_LiveOut(unsigned fn);
+void dflow_SideEffects(void);
 // void dflow_ReachIn(unsigned fn, int is_last);
 
+/* objects the pointer operand of an OpInd/OpIndAsn quad may point to */
+extern BSet **pointees_tab;
+#define ind_pointees(i)  (pointees_tab[i])
+void dflow_free_pointees(unsigned fn);
+
 extern unsigned char *liveness_and_next_use;
-void compute_liveness_and_next_use(void);
+void compute_liveness_and_next_use(unsigned fn);
 
 #define TAR_LIVE_MASK   0x01
 #define AR1_LIVE_MASK   0x02
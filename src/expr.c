@@ -17,7 +17,7 @@
  */
 #define ERROR(tok, ...)\
     do {\
-        emit_error(FALSE, (tok)->info->src_file, (tok)->info->src_line, (tok)->info->src_column, __VA_ARGS__);\
+        emit_error(FALSE, tok_src_file((tok)->info), tok_src_line((tok)->info), tok_src_column((tok)->info), __VA_ARGS__);\
         (tok)->type.decl_specs = get_type_node(TOK_ERROR);\
     } while (0)
 
@@ -27,8 +27,8 @@
         return;\
     } while (0)
 
-#define WARNING(tok, ...) emit_warning((tok)->info->src_file, (tok)->info->src_line, (tok)->info->src_column, __VA_ARGS__)
-#define FATAL_ERROR(tok, ...) emit_error(TRUE, (tok)->info->src_file, (tok)->info->src_line, (tok)->info->src_column, __VA_ARGS__)
+#define WARNING(tok, ...) emit_warning(tok_src_file((tok)->info), tok_src_line((tok)->info), tok_src_column((tok)->info), __VA_ARGS__)
+#define FATAL_ERROR(tok, ...) emit_error(TRUE, tok_src_file((tok)->info), tok_src_line((tok)->info), tok_src_column((tok)->info), __VA_ARGS__)
 
 /*
  * Macro used by functions that analyze binary operators. If any of the operands has
@@ -59,15 +59,24 @@
         return;\
     }
 
+/*
+ * The category of a type without declarator is cached on the head of its
+ * declaration specifiers. Typedef names are not cached because they are
+ * replaced in place by the type they name.
+ */
 Token get_type_category(Declaration *d)
 {
+    Token cat;
+
     if (/*d->decl_specs!=NULL && */d->decl_specs->op==TOK_ERROR)
         return TOK_ERROR;
 
     if (d->idl != NULL)
         return d->idl->op;
-    else
-        return get_type_spec(d->decl_specs)->op;
+    if ((cat=d->decl_specs->cat) == 0)
+        if ((cat=get_type_spec(d->decl_specs)->op) != TOK_TYPEDEFNAME)
+            d->decl_specs->cat = cat;
+    return cat;
 }
 
 int is_integer(Token ty)
@@ -1619,7 +1628,7 @@ subs_incomp:
                 ty1 = stringify_type_exp(&p_ty, TRUE);
                 ty2 = stringify_type_exp(&a->type, TRUE);
                 // ERROR(e, "parameter/argument type mismatch (parameter #%d; expected `%s', given `%s')", n, ty1, ty2);
-                emit_error(FALSE, a->info->src_file, a->info->src_line, a->info->src_column,
+                emit_error(FALSE, tok_src_file(a->info), tok_src_line(a->info), tok_src_column(a->info),
                 "parameter/argument type mismatch (parameter #%d; expected `%s', given `%s')",
                 n, ty1, ty2);
                 free(ty1), free(ty2);
@@ -1647,8 +1656,8 @@ non_callable:
     case TOK_DOT:
     case TOK_ARROW: {
         char *id;
-        DeclList *d;
-        TypeExp *ts, *tq_l, *tq_r, *dct;
+        StructMember *m;
+        TypeExp *ts, *tq_l, *tq_r;
 
         IS_ERROR_UNARY(e, get_type_category(&e->child[0]->type));
 
@@ -1686,14 +1695,8 @@ non_callable:
         }
 
         /* search for the member */
-        for (d = ts->attr.dl; d != NULL; d = d->next) {
-            for (dct = d->decl->idl; dct != NULL; dct = dct->sibling) {
-                if (equal(id, dct->str))
-                    goto mem_found;
-            }
-        }
-        ERROR_R(e, "`%s %s' has no member named `%s'", tok2lex(ts->op), ts->str, id);
-mem_found:
+        if ((m=find_struct_member(ts, id)) == NULL)
+            ERROR_R(e, "`%s %s' has no member named `%s'", tok2lex(ts->op), ts->str, id);
         /*
          * 6.5.2.3
          * #3 A postfix expression followed by the . operator and an identifier designates a member of
@@ -1711,40 +1714,40 @@ mem_found:
             /*
              * The first expression has qualified type.
              */
-            if (dct->child != NULL) {
+            if (m->type.idl != NULL) {
                 /* derived declarator type (struct members cannot
                    have function type, so ignore that case) */
-                if (dct->child->op == TOK_STAR) {
+                if (m->type.idl->op == TOK_STAR) {
                     TypeExp *new_ptr_node;
 
                     // new_ptr_node = calloc(1, sizeof(TypeExp));
                     new_ptr_node = new_type_exp_node();
-                    *new_ptr_node = *dct->child;
+                    *new_ptr_node = *m->type.idl;
 
-                    if (dct->child->attr.el == NULL) {
+                    if (m->type.idl->attr.el == NULL) {
                         /* non-qualified pointer */
                         new_ptr_node->attr.el = tq_l;
-                    } else if (dct->child->attr.el->op!=tq_l->op
-                    && dct->child->attr.el->op!=TOK_CONST_VOLATILE) {
+                    } else if (m->type.idl->attr.el->op!=tq_l->op
+                    && m->type.idl->attr.el->op!=TOK_CONST_VOLATILE) {
                         /* qualified pointer (by const or volatile, but not both) */
                         new_ptr_node->attr.el = new_type_exp_node();
                         new_ptr_node->attr.el->op = TOK_CONST_VOLATILE;
                     } /*else {
                         free(new_ptr_node);
-                        new_ptr_node = dct->child;
+                        new_ptr_node = m->type.idl;
                     }*/
                     e->type.idl = new_ptr_node;
-                } else if (dct->child->op == TOK_SUBSCRIPT) {
+                } else if (m->type.idl->op == TOK_SUBSCRIPT) {
                     int n;
                     TypeExp *p;
 
                     /* search the element type */
-                    for (p=dct->child, n=0; p!=NULL && p->op==TOK_SUBSCRIPT; p=p->child, n++);
+                    for (p=m->type.idl, n=0; p!=NULL && p->op==TOK_SUBSCRIPT; p=p->child, n++);
                     if (p != NULL) {
                         /* array of pointers, qualify the pointer element type */
                         TypeExp *new_dct_list;
 
-                        new_dct_list = dup_declarator(dct->child);
+                        new_dct_list = dup_declarator(m->type.idl);
 
                         if (p->attr.el == NULL) {
                             /* non-qualified pointer */
@@ -1764,16 +1767,16 @@ mem_found:
                         goto decl_specs_qualif;
                     }
                 }
-                e->type.decl_specs = d->decl->decl_specs;
+                e->type.decl_specs = m->type.decl_specs;
             } else {
 decl_specs_qualif:
-                if ((tq_r=get_type_qual(d->decl->decl_specs)) != NULL) {
+                if ((tq_r=get_type_qual(m->type.decl_specs)) != NULL) {
                     /* the member is already qualified */
                     if (tq_r->op!=tq_l->op && tq_r->op!=TOK_CONST_VOLATILE) {
                         tq_r = new_type_exp_node();
                         tq_r->op = TOK_CONST_VOLATILE;
                         tq_r->child = new_type_exp_node();
-                        *tq_r->child = *get_type_spec(d->decl->decl_specs);
+                        *tq_r->child = *get_type_spec(m->type.decl_specs);
                         tq_r->child->child = NULL;
                     }
                 } else {
@@ -1781,17 +1784,17 @@ decl_specs_qualif:
                        the member's declaration specifiers */
                     tq_r = new_type_exp_node();
                     tq_r->op = tq_l->op;
-                    tq_r->child = d->decl->decl_specs;
+                    tq_r->child = m->type.decl_specs;
                 }
                 e->type.decl_specs = tq_r;
-                e->type.idl = dct->child;
+                e->type.idl = m->type.idl;
             }
         } else {
             /*
              * The first expression has unqualified type.
              */
-            e->type.decl_specs = d->decl->decl_specs;
-            e->type.idl = dct->child;
+            e->type.decl_specs = m->type.decl_specs;
+            e->type.idl = m->type.idl;
         }
         break;
     }
@@ -1923,11 +1926,15 @@ unsigned get_alignment(Declaration *ty)
     unsigned alignment;
     Declaration new_ty;
 
+    if (ty->idl==NULL && ty->decl_specs->align!=0)
+        return ty->decl_specs->align;
+
     cat = get_type_category(ty);
     switch (cat) {
     case TOK_STRUCT:
     case TOK_UNION:
         alignment = lookup_struct_descriptor(get_type_spec(ty->decl_specs)->str)->alignment;
+        ty->decl_specs->align = alignment; /* the type is complete */
         break;
     case TOK_SUBSCRIPT:
         new_ty.decl_specs = ty->decl_specs;
@@ -1966,17 +1973,7 @@ unsigned get_sizeof(Declaration *ty)
 
     cat = get_type_category(ty);
     switch (cat) {
-    case TOK_UNION: {
-        StructMember *sm;
-        StructDescriptor *sd;
-
-        sd = lookup_struct_descriptor(get_type_spec(ty->decl_specs)->str);
-        for (sm = sd->members; sm != NULL; sm = sm->next)
-            if (sm->size > size)
-                size = sm->size;
-        size = round_up(size, sd->alignment);
-        break;
-    }
+    case TOK_UNION:
     case TOK_STRUCT:
         size = lookup_struct_descriptor(get_type_spec(ty->decl_specs)->str)->size;
         break;
@@ -2466,7 +2463,7 @@ long long eval_const_expr(ExecNode *e, int is_addr, int is_iconst)
         }
         return TRUE;
     }
-    emit_error(TRUE, e->info->src_file, e->info->src_line, e->info->src_column,
+    emit_error(TRUE, tok_src_file(e->info), tok_src_line(e->info), tok_src_column(e->info),
     "invalid constant expression");
     // longjmp(env, 1);
 }
@@ -17,6 +17,7 @@
 #include "dflow.h"
 #include "bset.h"
 #include "luxcc.h"
+#include "intern.h"
 
 #define ID_TABLE_SIZE 1009
 typedef struct IDNode IDNode;
@@ -46,6 +47,8 @@ CFGNode *cfg_nodes;
 unsigned cg_nodes_max;
 unsigned cg_nodes_counter;
 CGNode *cg_nodes;
+#define CG_TABLE_SIZE 509
+static int cg_node_tab[CG_TABLE_SIZE]; /* func_id -> CG node (chained through CGNode.next) */
 
 static int label_counter, label_max;
 static unsigned *lab2instr;
@@ -134,9 +137,9 @@ int get_var_nid(char *sid, int scope)
     IDNode *np;
     unsigned h;
 
-    h = hash(sid)%ID_TABLE_SIZE;
+    h = istr_hash(sid)%ID_TABLE_SIZE; /* identifiers are interned */
     for (np = id_table[h]; np != NULL; np = np->next)
-        if (equal(np->sid, sid) && np->scope==scope)
+        if (np->sid==sid && np->scope==scope)
             return np->nid;
     np = arena_alloc(id_table_arena, sizeof(IDNode));
     np->sid = sid;
@@ -194,13 +197,25 @@ unsigned edge_iterate(GraphEdge *p)
     return (unsigned)-1;
 }
 
-unsigned new_cg_node(char *func_id)
+/* return the call-graph node of function func_id, or -1 if there is none */
+int cg_node_lookup(char *func_id)
 {
-    unsigned i;
+    int i;
 
-    for (i = 0; i < cg_nodes_counter; i++)
-        if (equal(cg_nodes[i].func_id, func_id))
+    /* function identifiers are interned */
+    for (i = cg_node_tab[istr_hash(func_id)%CG_TABLE_SIZE]; i != -1; i = cg_nodes[i].next)
+        if (cg_nodes[i].func_id == func_id)
             return i;
+    return -1;
+}
+
+unsigned new_cg_node(char *func_id)
+{
+    int i;
+    unsigned h;
+
+    if ((i=cg_node_lookup(func_id)) != -1)
+        return (unsigned)i;
     if (cg_nodes_counter >= cg_nodes_max) {
         CGNode *p;
 
@@ -213,6 +228,9 @@ unsigned new_cg_node(char *func_id)
     memset(&cg_nodes[cg_nodes_counter], 0, sizeof(CGNode));
     cg_nodes[cg_nodes_counter].func_id = func_id;
     edge_init(&cg_nodes[cg_nodes_counter].out, 1);
+    h = istr_hash(func_id)%CG_TABLE_SIZE;
+    cg_nodes[cg_nodes_counter].next = cg_node_tab[h];
+    cg_node_tab[h] = (int)cg_nodes_counter;
     return cg_nodes_counter++;
 }
 
@@ -322,6 +340,8 @@ static void new_atv(int vnid)
 
 static void ic_init(void)
 {
+    int i;
+
     location_init();
 
     /* init instruction buffer */
@@ -347,6 +367,8 @@ static void ic_init(void)
         goto out_mem;
     cg_nodes_max = CINIT;
     cg_nodes_counter = 0;
+    for (i = 0; i < CG_TABLE_SIZE; i++)
+        cg_node_tab[i] = -1;
 
     /* init nid -> sid table */
     if ((nid2sid_tab=malloc(128*sizeof(char *))) == NULL)
@@ -362,14 +384,14 @@ static void ic_init(void)
     false_addr = new_address(IConstKind);
     address(false_addr).cont.uval = 0;
 
-    memset_node.attr.str = "memset";
+    memset_node.attr.str = str_intern("memset");
     memset_addr = new_address(IdKind);
-    address(memset_addr).cont.nid = get_var_nid("memset", 0);
+    address(memset_addr).cont.nid = get_var_nid(memset_node.attr.str, 0);
     address(memset_addr).cont.var.e = &memset_node;
 
-    memcpy_node.attr.str = "memcpy";
+    memcpy_node.attr.str = str_intern("memcpy");
     memcpy_addr = new_address(IdKind);
-    address(memcpy_addr).cont.nid = get_var_nid("memcpy", 0);
+    address(memcpy_addr).cont.nid = get_var_nid(memcpy_node.attr.str, 0);
     address(memcpy_addr).cont.var.e = &memcpy_node;
 
     label_max = 64;
@@ -395,6 +417,29 @@ static void ic_reset(void)
     base_node = NULL;
 }
 
+/*
+ * Once the liveness and next-use information of a function has been
+ * computed, its per-block dataflow sets are not needed anymore.
+ * Release them right away so that the size of the sets alive at any
+ * given time is bounded by the largest function, not the whole file.
+ */
+static void free_block_sets(unsigned fn)
+{
+    unsigned b;
+
+    if (cg_node_is_empty(fn))
+        return;
+
+    for (b = cg_node(fn).bb_i; b <= cg_node(fn).bb_f; b++) {
+        bset_free(cfg_node(b).UEVar);
+        bset_free(cfg_node(b).VarKill);
+        bset_free(cfg_node(b).LiveOut);
+        bset_free(cfg_node(b).Dom);
+        cfg_node(b).UEVar = cfg_node(b).VarKill = NULL;
+        cfg_node(b).LiveOut = cfg_node(b).Dom = NULL;
+    }
+}
+
 #if 0
 static void ic_free_all(void)
 {
@@ -405,16 +450,15 @@ static void ic_free_all(void)
     for (i = 1; i < cfg_nodes_counter; i++) {
         edge_free(&cfg_node(i).out);
         edge_free(&cfg_node(i).in);
-        bset_free(cfg_node(i).UEVar);
-        bset_free(cfg_node(i).VarKill);
-        bset_free(cfg_node(i).LiveOut);
-        bset_free(cfg_node(i).Dom);
     }
     free(cfg_nodes);
     for (i = 0; i < cg_nodes_counter; i++) {
         edge_free(&cg_node(i).out);
-        if (!cg_node_is_empty(i))
+        if (!cg_node_is_empty(i)) {
             bset_free(cg_node(i).modified_static_objects);
+            bset_free(cg_node(i).modified_static_objects_tr);
+            bset_free(cg_node(i).aliased_objects);
+        }
     }
     free(cg_nodes);
     arena_destroy(id_table_arena);
@@ -729,14 +773,16 @@ static void ic_simplify(void)
             }
             break;
         case OpEQ:
-            if (is_iconst(arg1))
-                if (is_iconst(arg2))
-                    fold(i, ==);
+            if (is_iconst(arg1) && is_iconst(arg2)) {
+                fold(i, ==);
+                instruction(i).type = &int_ty;
+            }
             break;
         case OpNEQ:
-            if (is_iconst(arg1))
-                if (is_iconst(arg2))
-                    fold(i, !=);
+            if (is_iconst(arg1) && is_iconst(arg2)) {
+                fold(i, !=);
+                instruction(i).type = &int_ty;
+            }
             break;
         case OpLT:
             if (is_iconst(arg1) && is_iconst(arg2)) {
@@ -764,7 +810,7 @@ static void ic_simplify(void)
             if (is_iconst(arg1) && is_iconst(arg2)) {
                 instruction(i).op = OpAsn;
                 address(arg1).kind = IConstKind;
-                if ((long)instruction(i).op & IC_SIGNED)
+                if ((long)instruction(i).type & IC_SIGNED)
                     address(arg1).cont.val = address(arg1).cont.val>address(arg2).cont.val;
                 else
                     address(arg1).cont.val = address(arg1).cont.uval>address(arg2).cont.uval;
@@ -775,7 +821,7 @@ static void ic_simplify(void)
             if (is_iconst(arg1) && is_iconst(arg2)) {
                 instruction(i).op = OpAsn;
                 address(arg1).kind = IConstKind;
-                if ((long)instruction(i).op & IC_SIGNED)
+                if ((long)instruction(i).type & IC_SIGNED)
                     address(arg1).cont.val = address(arg1).cont.val>=address(arg2).cont.val;
                 else
                     address(arg1).cont.val = address(arg1).cont.uval>=address(arg2).cont.uval;
@@ -1054,7 +1100,11 @@ static void print_CG(void)
         unsigned j;
 
         fprintf(cg_dotfile, "V%u[label=\"F%u %s\\n", i, i, cg_node(i).func_id);
-        fprintf(cg_dotfile, "[%u, %u]\"];\n", cg_node(i).bb_i, cg_node(i).bb_f);
+        fprintf(cg_dotfile, "[%u, %u]", cg_node(i).bb_i, cg_node(i).bb_f);
+        if (!cg_node_is_empty(i))
+            fprintf(cg_dotfile, "\\n%s%s", cg_node_is_leaf(i)?"leaf ":"",
+            cg_node_is_pure(i)?"pure":cg_node_is_read_only(i)?"read-only":"");
+        fprintf(cg_dotfile, "\"];\n");
         for (j = edge_iterate(&cg_node(i).out); j != -1; j = edge_iterate(NULL))
             fprintf(cg_dotfile, "V%u -> V%u;\n", i, j);
     }
@@ -1490,10 +1540,10 @@ void ic_builtin_va_start_statement(ExecNode *s)
     }
 
     if (base_node == NULL) {
-        char *base_name;
+        char *base_name, buf[16];
 
-        base_name = malloc(16);
-        sprintf(base_name, "base@%d", base_counter++);
+        sprintf(buf, "base@%d", base_counter++);
+        base_name = str_intern(buf);
 
         base_node = new_exec_node();
         base_node->node_kind = ExpNode;
@@ -3247,9 +3297,13 @@ void ic_main(ExternId ***func_def_list, ExternId ***ext_sym_list)
             fclose(cfg_dotfile);
         }
         dflow_Dom(i);
+        dflow_PointsTo(i);
         dflow_LiveOut(i);
+        compute_liveness_and_next_use(i);
+        free_block_sets(i);
         // dflow_ReachIn(i, i == cg_nodes_counter-1);
     }
+    dflow_SideEffects();
     if (cg_outpath != NULL) {
         cg_dotfile = fopen(cg_outpath, "wb");
         print_CG();
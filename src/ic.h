@@ -168,18 +168,41 @@ struct CGNode { /* CG node == function */
     char *func_id;
     unsigned bb_i, bb_f;
     GraphEdge out;
-    BSet *modified_static_objects;
+    BSet *modified_static_objects;      /* static objects assigned by the function itself */
+    BSet *modified_static_objects_tr;   /* the above plus those assigned by its callees */
+    unsigned side_effects;              /* SE_* flags (transitive) */
+    BSet *aliased_objects;              /* objects that may be referenced through unknown pointers */
     unsigned size_of_local_area;
     unsigned PO, RPO;
+    int next;                           /* next node in the same hash chain */
     /*ParamNid *pn;*/
 };
 extern CGNode *cg_nodes;
 extern unsigned cg_nodes_counter;
 unsigned new_cg_node(char *func_id);
+int cg_node_lookup(char *func_id);
 #define cg_node(n)          (cg_nodes[n])
 #define cg_node_is_empty(n) (cg_node(n).bb_i == 0)
 #define cg_node_nbb(n)      (cg_node(n).bb_f-cg_node(n).bb_i+1)
 
+/*
+ * Side-effect summaries.
+ * Functions without a body (and indirect calls) are SE_UNKNOWN,
+ * that is, they may read and write any static or aliased object.
+ */
+enum {
+    SE_CALLS        = 0x01, /* calls other functions */
+    SE_READS_STATIC = 0x02, /* reads static objects by name */
+    SE_READS_PTR    = 0x04, /* reads through pointers */
+    SE_WRITES_PTR   = 0x08, /* writes through pointers */
+    SE_UNKNOWN      = 0x10, /* calls unknown code */
+};
+#define cg_node_is_leaf(n)      (!(cg_node(n).side_effects & SE_CALLS))
+#define cg_node_is_read_only(n) (!(cg_node(n).side_effects & (SE_WRITES_PTR|SE_UNKNOWN))\
+                                && bset_card(cg_node(n).modified_static_objects_tr)==0)
+#define cg_node_is_pure(n)      (cg_node_is_read_only(n)\
+                                && !(cg_node(n).side_effects & (SE_READS_STATIC|SE_READS_PTR)))
+
 /*
  * Misc
  */
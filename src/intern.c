@@ -0,0 +1,68 @@
+#include "intern.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "arena.h"
+
+#define INIT_TABLE_SIZE 1024 /* must be a power of 2 */
+
+static IStr **intern_table;
+static unsigned table_size, nstrings;
+static Arena *intern_arena;
+
+static void intern_out_of_memory(char *func)
+{
+    TERMINATE("error: %s(): out of memory", func);
+}
+
+static void grow_table(void)
+{
+    unsigned i, new_size;
+    IStr **new_table, *np, *next;
+
+    new_size = (table_size==0) ? INIT_TABLE_SIZE : table_size*2;
+    if ((new_table=calloc(new_size, sizeof(IStr *))) == NULL)
+        intern_out_of_memory("grow_table");
+    for (i = 0; i < table_size; i++) {
+        for (np = intern_table[i]; np != NULL; np = next) {
+            next = np->next;
+            np->next = new_table[np->hash&(new_size-1)];
+            new_table[np->hash&(new_size-1)] = np;
+        }
+    }
+    free(intern_table);
+    intern_table = new_table;
+    table_size = new_size;
+}
+
+/*
+ * Return the unique copy of `s'.
+ * The string is entered into the table if it's not already there.
+ */
+char *str_intern(char *s)
+{
+    IStr *np;
+    unsigned h, len;
+
+    h = hash(s);
+    if (table_size != 0)
+        for (np = intern_table[h&(table_size-1)]; np != NULL; np = np->next)
+            if (np->hash==h && equal((char *)(np+1), s))
+                return (char *)(np+1);
+
+    if (nstrings >= table_size)
+        grow_table();
+    if (intern_arena == NULL)
+        intern_arena = arena_new(8192, FALSE);
+    len = (unsigned)strlen(s);
+    /* keep the headers aligned */
+    np = arena_alloc(intern_arena, (unsigned)round_up((int)(sizeof(IStr)+len+1), 8));
+    np->hash = h;
+    np->tag = 0;
+    memcpy(np+1, s, len+1);
+    np->next = intern_table[h&(table_size-1)];
+    intern_table[h&(table_size-1)] = np;
+    ++nstrings;
+    return (char *)(np+1);
+}
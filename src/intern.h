@@ -0,0 +1,23 @@
+#ifndef INTERN_H_
+#define INTERN_H_
+
+/*
+ * Identifier interning table.
+ * Each distinct spelling is stored only once, so two interned
+ * strings are equal if and only if their addresses are equal.
+ * Every string carries its hash value and an integer tag (the
+ * lexer uses the tag to mark keywords).
+ */
+typedef struct IStr IStr;
+struct IStr {
+    IStr *next;
+    unsigned hash;
+    int tag;
+};
+
+char *str_intern(char *s);
+#define istr_hdr(s)     ((IStr *)(s)-1)
+#define istr_hash(s)    (istr_hdr(s)->hash)
+#define istr_tag(s)     (istr_hdr(s)->tag)
+
+#endif
@@ -0,0 +1,63 @@
+#include "kwtab.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+
+#define MAX_TRIES 4096 /* multipliers tried for each table size */
+
+#define kw_str(t, i) (*(char **)((t)->base+(i)*(t)->elem_size))
+
+static void kwtab_out_of_memory(char *func)
+{
+    TERMINATE("error: %s(): out of memory", func);
+}
+
+static unsigned kw_hash(char *s, unsigned mul)
+{
+    unsigned h;
+
+    for (h = 0; *s != '\0'; s++)
+        h = (h^(unsigned char)*s)*mul;
+    return h^(h>>16);
+}
+
+void kwtab_init(KwTab *t, void *base, unsigned nelem, unsigned elem_size)
+{
+    unsigned i, size, tries;
+
+    t->base = base;
+    t->elem_size = elem_size;
+    for (size = 16; size < nelem*2; size *= 2)
+        ;
+    for (;;) {
+        if ((t->slots=calloc(size, sizeof(short))) == NULL)
+            kwtab_out_of_memory("kwtab_init");
+        t->mask = size-1;
+        for (tries = 0, t->mul = 0x01000193; tries < MAX_TRIES; tries++, t->mul += 2) {
+            for (i = 0; i < nelem; i++) {
+                unsigned h;
+
+                h = kw_hash(kw_str(t, i), t->mul)&t->mask;
+                if (t->slots[h] != 0)
+                    break;
+                t->slots[h] = (short)(i+1);
+            }
+            if (i == nelem)
+                return;
+            memset(t->slots, 0, size*sizeof(short));
+        }
+        /* no collision-free multiplier for this size; retry with a bigger table */
+        free(t->slots);
+        size *= 2;
+    }
+}
+
+int kwtab_lookup(KwTab *t, char *s)
+{
+    int i;
+
+    if ((i=t->slots[kw_hash(s, t->mul)&t->mask]-1)!=-1 && equal(kw_str(t, i), s))
+        return i;
+    return -1;
+}
@@ -0,0 +1,23 @@
+#ifndef KWTAB_H_
+#define KWTAB_H_
+
+/*
+ * Perfect hash tables for fixed sets of reserved words.
+ * The table is built once from an array of structures whose first
+ * member is the (char *) spelling of the word. A multiplier that
+ * maps every word to a different slot is searched for at build
+ * time, so a lookup costs one hash and at most one string compare.
+ */
+typedef struct KwTab KwTab;
+struct KwTab {
+    char *base;             /* the array of words */
+    unsigned elem_size;     /* size of each element of the array */
+    unsigned mask;          /* number of slots - 1 */
+    unsigned mul;           /* hash multiplier */
+    short *slots;           /* index of the word + 1 (0 for empty slots) */
+};
+
+void kwtab_init(KwTab *t, void *base, unsigned nelem, unsigned elem_size);
+int kwtab_lookup(KwTab *t, char *s); /* index of `s' in the array or -1 */
+
+#endif
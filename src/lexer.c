@@ -8,13 +8,31 @@
 #include "error.h"
 #include "arena.h"
 #include "luxcc.h"
+#include "intern.h"
+#include "kwtab.h"
 
 extern Arena *pre_node_arena;
 
 static PreTokenNode *pre_tok; /* declared global so ERROR can access it */
-Arena *lexer_node_arena;
 static Arena *lexer_str_arena;
 
+/* token buffer */
+unsigned char *tok_kinds;
+char **tok_lexemes;
+unsigned short *tok_files;
+unsigned *tok_locs;
+static unsigned ntokens, max_tokens;
+
+/* source file names referenced by the token buffer */
+#define FILE_HASH_SIZE 101
+static struct TokFile {
+    char *name;
+    unsigned short num;
+    struct TokFile *next;
+} *file_hash[FILE_HASH_SIZE];
+char **tok_file_names;
+static unsigned nfile_names, max_file_names;
+
 #define ERROR(...)   emit_error(TRUE, pre_tok->src_file, pre_tok->src_line, pre_tok->src_column, __VA_ARGS__)
 #define WARNING(...) emit_warning(pre_tok->src_file, pre_tok->src_line, pre_tok->src_column, __VA_ARGS__)
 
@@ -153,7 +171,7 @@ const char *token_table[] = {
 static const struct Keyword {
     char *str;
     Token tok;
-} keywords_table[] = { /* sorted for bsearch() */
+} keywords_table[] = {
     {"__asm", TOK_ASM},
     {"__builtin_va_start", TOK_BUILTIN_VA_START},
     {"__func__", TOK_FUNC_NAME},
@@ -194,30 +212,25 @@ static const struct Keyword {
     {"while", TOK_WHILE}
 };
 
-static int cmp_kw(const void *p1, const void *p2)
+/*
+ * Keywords are entered into the interning table with their
+ * token as tag. Identifiers are interned by the preprocessor,
+ * so telling them apart from keywords needs no search.
+ */
+static void seed_keywords(void)
 {
-   struct Keyword *x1 = (struct Keyword *)p1;
-   struct Keyword *x2 = (struct Keyword *)p2;
+    int i;
 
-   return strcmp(x1->str, x2->str);
+    for (i = 0; i < NELEMS(keywords_table); i++)
+        istr_tag(str_intern(keywords_table[i].str)) = keywords_table[i].tok;
 }
 
-static Token lookup_id(char *s)
-{
-    struct Keyword key, *res;
-
-    key.str = s;
-    res = bsearch(&key, keywords_table, NELEMS(keywords_table), sizeof(keywords_table[0]), cmp_kw);
-    if (res == NULL)
-        return TOK_ID;
-    else
-        return res->tok;
-}
+#define lookup_id(s) ((istr_tag(s) != 0) ? (Token)istr_tag(s) : TOK_ID)
 
 static const struct Punctuator {
     char *str;
     Token tok;
-} punctuators_table[] = { /* sorted for bsearch() */
+} punctuators_table[] = {
     {"!", TOK_NEGATION},
     {"!=", TOK_NEQ},
     {"%", TOK_REM},
@@ -266,13 +279,7 @@ static const struct Punctuator {
     {"~", TOK_COMPLEMENT},
 };
 
-static int cmp_punct(const void *p1, const void *p2)
-{
-   struct Punctuator *x1 = (struct Punctuator *)p1;
-   struct Punctuator *x2 = (struct Punctuator *)p2;
-
-   return strcmp(x1->str, x2->str);
-}
+static KwTab punctuators;
 
 static int isodigit(int c)
 {
@@ -509,60 +516,125 @@ static Token get_iconst_kind(char *ic)
     } /* while (TRUE) */
 }
 
-static TokenNode *new_token(Token token, PreTokenNode *ptok)
+static void lexer_out_of_memory(char *func)
 {
-    TokenNode *temp;
-
-    temp = arena_alloc(lexer_node_arena, sizeof(TokenNode));
-    temp->token = token;
-    temp->lexeme = ptok->lexeme;
-    temp->src_line = ptok->src_line;
-    temp->src_column = ptok->src_column;
-    temp->src_file = ptok->src_file;
-    temp->next = NULL;
-    ++stat_number_of_c_tokens;
-    return temp;
+    TERMINATE("error: %s(): out of memory", func);
 }
 
 /*
- * Take a sequence of preprocessing tokens and convert it in a sequence
- * of C tokens (roughly translation phases 5, 6, and part of 7 of the
- * standard).
+ * Map a source file name to a small number. Tokens coming from
+ * the same file share the name pointer, so comparing pointers
+ * is enough.
  */
-TokenNode *tokenize(PreTokenNode *pre_token_list)
+static unsigned short file_name_num(char *name)
 {
-    TokenNode *first, *tok;
+    static struct TokFile *last;
+    struct TokFile *np;
+    unsigned h;
+
+    if (last!=NULL && last->name==name)
+        return last->num;
+    h = (unsigned)(hash2((unsigned long)name)%FILE_HASH_SIZE);
+    for (np = file_hash[h]; np != NULL; np = np->next)
+        if (np->name == name)
+            return (last=np)->num;
+
+    if (nfile_names >= max_file_names) {
+        char **p;
+
+        if (max_file_names == 0xFFFF)
+            TERMINATE("error: too many source files");
+        max_file_names = (max_file_names==0) ? 16 : max_file_names*2;
+        if (max_file_names > 0xFFFF)
+            max_file_names = 0xFFFF;
+        if ((p=realloc(tok_file_names, max_file_names*sizeof(char *))) == NULL)
+            lexer_out_of_memory("file_name_num");
+        tok_file_names = p;
+    }
+    if ((np=malloc(sizeof(struct TokFile))) == NULL)
+        lexer_out_of_memory("file_name_num");
+    np->name = name;
+    np->num = (unsigned short)nfile_names;
+    np->next = file_hash[h];
+    file_hash[h] = np;
+    tok_file_names[nfile_names++] = name;
+    return (last=np)->num;
+}
 
-    lexer_node_arena = arena_new(stat_number_of_pre_tokens*sizeof(TokenNode), FALSE);
-    lexer_str_arena = arena_new(1024, FALSE);
+static void grow_token_buffer(void)
+{
+    void *p;
+
+    max_tokens = (max_tokens==0) ? 1024 : max_tokens*2;
+    if ((p=realloc(tok_kinds, max_tokens*sizeof(unsigned char))) == NULL)
+        lexer_out_of_memory("grow_token_buffer");
+    tok_kinds = p;
+    if ((p=realloc(tok_lexemes, max_tokens*sizeof(char *))) == NULL)
+        lexer_out_of_memory("grow_token_buffer");
+    tok_lexemes = p;
+    if ((p=realloc(tok_files, max_tokens*sizeof(unsigned short))) == NULL)
+        lexer_out_of_memory("grow_token_buffer");
+    tok_files = p;
+    if ((p=realloc(tok_locs, max_tokens*sizeof(unsigned))) == NULL)
+        lexer_out_of_memory("grow_token_buffer");
+    tok_locs = p;
+}
+
+static TokenIndex new_token(Token token, PreTokenNode *ptok)
+{
+    unsigned line, col;
+
+    if (ntokens >= max_tokens)
+        grow_token_buffer();
+    tok_kinds[ntokens] = (unsigned char)token;
+    tok_lexemes[ntokens] = ptok->lexeme;
+    tok_files[ntokens] = file_name_num(ptok->src_file);
+    /* out of range positions are clamped */
+    line = (ptok->src_line < 0) ? 0 : (unsigned)ptok->src_line;
+    col = (ptok->src_column < 0) ? 0 : (unsigned)ptok->src_column;
+    if (line > LOC_LINE_MAX)
+        line = LOC_LINE_MAX;
+    if (col > LOC_COL_MAX)
+        col = LOC_COL_MAX;
+    tok_locs[ntokens] = line<<LOC_COL_BITS | col;
+    ++stat_number_of_c_tokens;
+    return ntokens++;
+}
+
+/*
+ * Convert the next preprocessing token(s) into a C token (roughly
+ * translation phases 5, 6, and part of 7 of the standard). The
+ * preprocessor is only asked to preprocess more tokens when needed.
+ */
+static TokenIndex lex_token(void)
+{
+    TokenIndex tok;
+    PreTokenNode *p;
 
-    pre_tok = pre_token_list;
-    first = tok = malloc(sizeof(TokenNode)); /* dummy node, it's removed before return */
-    while (pre_tok != NULL) {
+    for (;;) {
         if (pre_tok->deleted) {
-            pre_tok = pre_tok->next;
+            pre_tok = pre_get(pre_tok->next);
             continue;
         }
 
         switch (pre_tok->token) {
         case PRE_TOK_EOF:
-            tok->next = new_token(TOK_EOF, pre_tok);
+            tok = new_token(TOK_EOF, pre_tok);
             break;
         case PRE_TOK_PUNCTUATOR: {
-            struct Punctuator key, *res;
+            int i;
 
-            key.str = pre_tok->lexeme;
-            res = bsearch(&key, punctuators_table, NELEMS(punctuators_table), sizeof(punctuators_table[0]), cmp_punct);
-            assert(res != NULL);
-            tok->next = new_token(res->tok, pre_tok);
+            i = kwtab_lookup(&punctuators, pre_tok->lexeme);
+            assert(i != -1);
+            tok = new_token(punctuators_table[i].tok, pre_tok);
             break;
         }
         case PRE_TOK_NUM:
-            tok->next = new_token(get_iconst_kind(pre_tok->lexeme), pre_tok);
+            tok = new_token(get_iconst_kind(pre_tok->lexeme), pre_tok);
             break;
         case PRE_TOK_ID:
-            tok->next = new_token(TOK_ID, pre_tok);
-            tok->next->token = lookup_id(pre_tok->lexeme);
+            tok = new_token(TOK_ID, pre_tok);
+            tok_kinds[tok] = (unsigned char)lookup_id(pre_tok->lexeme);
             break;
         case PRE_TOK_CHACON: {
             char buf[16], *p;
@@ -582,22 +654,20 @@ TokenNode *tokenize(PreTokenNode *pre_token_list)
                     ++p;
                 }
             }
-            tok->next = new_token(TOK_ICONST_D, pre_tok);
-            tok->next->lexeme = arena_alloc(lexer_str_arena, strlen(buf)+1); /* replace prev lexeme */
-            strcpy(tok->next->lexeme, buf);
+            tok = new_token(TOK_ICONST_D, pre_tok);
+            tok_lexemes[tok] = arena_alloc(lexer_str_arena, strlen(buf)+1); /* replace prev lexeme */
+            strcpy(tok_lexemes[tok], buf);
         }
             break;
         case PRE_TOK_STRLIT: {
-            PreTokenNode *p;
-
-            tok->next = new_token(TOK_STRLIT, pre_tok);
+            tok = new_token(TOK_STRLIT, pre_tok);
 
             /*
              * Concatenate any adjacent strings.
              */
-            p = pre_tok->next;
+            p = pre_get(pre_tok->next);
             while (p!=NULL && p->deleted)
-                p = p->next;
+                p = pre_get(p->next);
             if (p!=NULL && p->token==PRE_TOK_STRLIT) {
                 int new_len;
 
@@ -608,25 +678,27 @@ TokenNode *tokenize(PreTokenNode *pre_token_list)
                         convert_string(p->lexeme);
                         new_len += strlen(p->lexeme);
                     }
-                    p = p->next;
+                    p = pre_get(p->next);
                 }
                 ++new_len; /* make room for '\0' */
 
                 /* allocate all at one time */
-                tok->next->lexeme = arena_alloc(lexer_str_arena, new_len);
-                tok->next->lexeme[0] = '\0';
+                tok_lexemes[tok] = arena_alloc(lexer_str_arena, new_len);
+                tok_lexemes[tok][0] = '\0';
 
                 /* copy the strings to the buffer (pre_tok is
                    left pointing to the last string concatenated) */
                 new_len = 0, p = pre_tok;
                 while (p!=NULL && (p->deleted || p->token==PRE_TOK_STRLIT)) {
                     if (p->token == PRE_TOK_STRLIT)
-                        strcat(tok->next->lexeme, p->lexeme);
+                        strcat(tok_lexemes[tok], p->lexeme);
+                    if (p!=pre_tok && !pre_tok->deleted)
+                        pre_release(pre_tok);
                     pre_tok = p;
-                    p = p->next;
+                    p = pre_get(p->next);
                 }
             } else { /* no adjacent string */
-                convert_string(tok->next->lexeme);
+                convert_string(tok_lexemes[tok]);
             }
             break;
         }
@@ -642,15 +714,52 @@ TokenNode *tokenize(PreTokenNode *pre_token_list)
                 WARNING("stray `%c' found; ignoring...", *pre_tok->lexeme);
             else
                 WARNING("stray `0x%02x' found; ignoring...", *pre_tok->lexeme);
-            pre_tok = pre_tok->next;
+            p = pre_tok;
+            pre_tok = pre_get(pre_tok->next);
+            pre_release(p);
             continue;
         }
-        pre_tok = pre_tok->next;
-        tok = tok->next;
+        break;
+    }
+    if (tok_kind(tok) == TOK_EOF) {
+        arena_destroy(pre_node_arena); /* the preprocessing tokens are not needed anymore */
+    } else {
+        /*
+         * Nodes that were not deleted by the preprocessor are not part
+         * of any macro definition and are no longer referenced.
+         */
+        p = pre_tok;
+        pre_tok = pre_get(pre_tok->next);
+        pre_release(p);
     }
-    tok = first->next;
-    free(first); /* delete dummy node */
-    arena_destroy(pre_node_arena);
-
     return tok;
 }
+
+/*
+ * Start the conversion of the sequence of preprocessing tokens
+ * into C tokens and return the first one. The rest is produced
+ * on demand through next_token().
+ */
+TokenIndex tokenize(PreTokenNode *pre_token_list)
+{
+    lexer_str_arena = arena_new(1024, FALSE);
+    seed_keywords();
+    kwtab_init(&punctuators, (void *)punctuators_table, NELEMS(punctuators_table), sizeof(punctuators_table[0]));
+
+    pre_tok = pre_get(pre_token_list);
+    return lex_token();
+}
+
+/*
+ * Return the token that follows `tok'.
+ * The token after EOF is EOF itself.
+ */
+TokenIndex next_token(TokenIndex tok)
+{
+    if (tok+1 == ntokens) {
+        if (tok_kind(tok) == TOK_EOF)
+            return tok;
+        lex_token();
+    }
+    return tok+1;
+}
@@ -159,17 +159,33 @@ typedef enum {
     TOK_BUILTIN_VA_START,
 } Token;
 
-typedef struct TokenNode TokenNode;
-struct TokenNode {
-    Token token;
-    char *lexeme, *src_file;
-    int src_line, src_column;
-    TokenNode *next;
-};
+/*
+ * C tokens live in a token buffer made of parallel arrays
+ * indexed by token number. The source location of a token
+ * is kept as a file number plus a packed line/column word.
+ */
+typedef unsigned TokenIndex;
+
+#define LOC_COL_BITS    12
+#define LOC_COL_MAX     ((1U<<LOC_COL_BITS)-1)
+#define LOC_LINE_MAX    ((1U<<(32-LOC_COL_BITS))-1)
+
+extern unsigned char *tok_kinds;
+extern char **tok_lexemes;
+extern unsigned short *tok_files;
+extern unsigned *tok_locs;
+extern char **tok_file_names;
+
+#define tok_kind(t)         ((Token)tok_kinds[t])
+#define tok_lexeme(t)       (tok_lexemes[t])
+#define tok_src_file(t)     (tok_file_names[tok_files[t]])
+#define tok_src_line(t)     ((int)(tok_locs[t]>>LOC_COL_BITS))
+#define tok_src_column(t)   ((int)(tok_locs[t]&LOC_COL_MAX))
 
 extern const char *token_table[];
 #define tok2lex(tok) (token_table[tok*2+1])
 
-TokenNode *tokenize(PreTokenNode *pre_token_list);
+TokenIndex tokenize(PreTokenNode *pre_token_list);
+TokenIndex next_token(TokenIndex tok);
 
 #endif
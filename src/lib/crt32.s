@@ -143,3 +143,19 @@ strtoull:
     addsp 4;
     pushsp;
     ret;
+rename:
+.global rename
+    libcall 23;
+    ret;
+remove:
+.global remove
+    libcall 24;
+    ret;
+mkstemp:
+.global mkstemp
+    libcall 25;
+    ret;
+close:
+.global close
+    libcall 26;
+    ret;
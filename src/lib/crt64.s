@@ -141,3 +141,19 @@ strtoull:
 .global strtoull
     libcall 22;
     ret;
+rename:
+.global rename
+    libcall 23;
+    ret;
+remove:
+.global remove
+    libcall 24;
+    ret;
+mkstemp:
+.global mkstemp
+    libcall 25;
+    ret;
+close:
+.global close
+    libcall 26;
+    ret;
@@ -0,0 +1,276 @@
+#ifndef _ELF_H
+#define _ELF_H
+
+/*
+ * From GNU libc headers.
+ * Only the part needed to write relocatable object files.
+ */
+
+#include <stdint.h>
+
+/* Type for a 16-bit quantity.  */
+typedef uint16_t Elf32_Half;
+typedef uint16_t Elf64_Half;
+
+/* Types for signed and unsigned 32-bit quantities.  */
+typedef uint32_t Elf32_Word;
+typedef int32_t  Elf32_Sword;
+typedef uint32_t Elf64_Word;
+typedef int32_t  Elf64_Sword;
+
+/* Types for signed and unsigned 64-bit quantities.  */
+typedef uint64_t Elf32_Xword;
+typedef int64_t  Elf32_Sxword;
+typedef uint64_t Elf64_Xword;
+typedef int64_t  Elf64_Sxword;
+
+/* Type of addresses.  */
+typedef uint32_t Elf32_Addr;
+typedef uint64_t Elf64_Addr;
+
+/* Type of file offsets.  */
+typedef uint32_t Elf32_Off;
+typedef uint64_t Elf64_Off;
+
+/* Type for section indices, which are 16-bit quantities.  */
+typedef uint16_t Elf32_Section;
+typedef uint16_t Elf64_Section;
+
+/* The ELF file header.  This appears at the start of every ELF file.  */
+
+#define EI_NIDENT (16)
+
+typedef struct {
+    unsigned char e_ident[EI_NIDENT];   /* Magic number and other info */
+    Elf32_Half    e_type;               /* Object file type */
+    Elf32_Half    e_machine;            /* Architecture */
+    Elf32_Word    e_version;            /* Object file version */
+    Elf32_Addr    e_entry;              /* Entry point virtual address */
+    Elf32_Off     e_phoff;              /* Program header table file offset */
+    Elf32_Off     e_shoff;              /* Section header table file offset */
+    Elf32_Word    e_flags;              /* Processor-specific flags */
+    Elf32_Half    e_ehsize;             /* ELF header size in bytes */
+    Elf32_Half    e_phentsize;          /* Program header table entry size */
+    Elf32_Half    e_phnum;              /* Program header table entry count */
+    Elf32_Half    e_shentsize;          /* Section header table entry size */
+    Elf32_Half    e_shnum;              /* Section header table entry count */
+    Elf32_Half    e_shstrndx;           /* Section header string table index */
+} Elf32_Ehdr;
+
+typedef struct {
+    unsigned char e_ident[EI_NIDENT];   /* Magic number and other info */
+    Elf64_Half    e_type;               /* Object file type */
+    Elf64_Half    e_machine;            /* Architecture */
+    Elf64_Word    e_version;            /* Object file version */
+    Elf64_Addr    e_entry;              /* Entry point virtual address */
+    Elf64_Off     e_phoff;              /* Program header table file offset */
+    Elf64_Off     e_shoff;              /* Section header table file offset */
+    Elf64_Word    e_flags;              /* Processor-specific flags */
+    Elf64_Half    e_ehsize;             /* ELF header size in bytes */
+    Elf64_Half    e_phentsize;          /* Program header table entry size */
+    Elf64_Half    e_phnum;              /* Program header table entry count */
+    Elf64_Half    e_shentsize;          /* Section header table entry size */
+    Elf64_Half    e_shnum;              /* Section header table entry count */
+    Elf64_Half    e_shstrndx;           /* Section header string table index */
+} Elf64_Ehdr;
+
+/* Fields in the e_ident array.  */
+
+#define EI_MAG0         0               /* File identification byte 0 index */
+#define ELFMAG0         0x7f            /* Magic number byte 0 */
+#define EI_MAG1         1               /* File identification byte 1 index */
+#define ELFMAG1         'E'             /* Magic number byte 1 */
+#define EI_MAG2         2               /* File identification byte 2 index */
+#define ELFMAG2         'L'             /* Magic number byte 2 */
+#define EI_MAG3         3               /* File identification byte 3 index */
+#define ELFMAG3         'F'             /* Magic number byte 3 */
+
+#define EI_CLASS        4               /* File class byte index */
+#define ELFCLASSNONE    0               /* Invalid class */
+#define ELFCLASS32      1               /* 32-bit objects */
+#define ELFCLASS64      2               /* 64-bit objects */
+
+#define EI_DATA         5               /* Data encoding byte index */
+#define ELFDATANONE     0               /* Invalid data encoding */
+#define ELFDATA2LSB     1               /* 2's complement, little endian */
+#define ELFDATA2MSB     2               /* 2's complement, big endian */
+
+#define EI_VERSION      6               /* File version byte index */
+                                        /* Value must be EV_CURRENT */
+
+/* Legal values for e_type (object file type).  */
+
+#define ET_NONE         0               /* No file type */
+#define ET_REL          1               /* Relocatable file */
+#define ET_EXEC         2               /* Executable file */
+
+/* Legal values for e_machine (architecture).  */
+
+#define EM_386          3               /* Intel 80386 */
+#define EM_X86_64       62              /* AMD x86-64 architecture */
+
+/* Legal values for e_version (version).  */
+
+#define EV_NONE         0               /* Invalid ELF version */
+#define EV_CURRENT      1               /* Current version */
+
+/* Section header.  */
+
+typedef struct {
+    Elf32_Word    sh_name;              /* Section name (string tbl index) */
+    Elf32_Word    sh_type;              /* Section type */
+    Elf32_Word    sh_flags;             /* Section flags */
+    Elf32_Addr    sh_addr;              /* Section virtual addr at execution */
+    Elf32_Off     sh_offset;            /* Section file offset */
+    Elf32_Word    sh_size;              /* Section size in bytes */
+    Elf32_Word    sh_link;              /* Link to another section */
+    Elf32_Word    sh_info;              /* Additional section information */
+    Elf32_Word    sh_addralign;         /* Section alignment */
+    Elf32_Word    sh_entsize;           /* Entry size if section holds table */
+} Elf32_Shdr;
+
+typedef struct {
+    Elf64_Word    sh_name;              /* Section name (string tbl index) */
+    Elf64_Word    sh_type;              /* Section type */
+    Elf64_Xword   sh_flags;             /* Section flags */
+    Elf64_Addr    sh_addr;              /* Section virtual addr at execution */
+    Elf64_Off     sh_offset;            /* Section file offset */
+    Elf64_Xword   sh_size;              /* Section size in bytes */
+    Elf64_Word    sh_link;              /* Link to another section */
+    Elf64_Word    sh_info;              /* Additional section information */
+    Elf64_Xword   sh_addralign;         /* Section alignment */
+    Elf64_Xword   sh_entsize;           /* Entry size if section holds table */
+} Elf64_Shdr;
+
+/* Special section indices.  */
+
+#define SHN_UNDEF       0               /* Undefined section */
+#define SHN_ABS         0xfff1          /* Associated symbol is absolute */
+#define SHN_COMMON      0xfff2          /* Associated symbol is common */
+
+/* Legal values for sh_type (section type).  */
+
+#define SHT_NULL        0               /* Section header table entry unused */
+#define SHT_PROGBITS    1               /* Program data */
+#define SHT_SYMTAB      2               /* Symbol table */
+#define SHT_STRTAB      3               /* String table */
+#define SHT_RELA        4               /* Relocation entries with addends */
+#define SHT_NOBITS      8               /* Program space with no data (bss) */
+#define SHT_REL         9               /* Relocation entries, no addends */
+
+/* Legal values for sh_flags (section flags).  */
+
+#define SHF_WRITE       (1 << 0)        /* Writable */
+#define SHF_ALLOC       (1 << 1)        /* Occupies memory during execution */
+#define SHF_EXECINSTR   (1 << 2)        /* Executable */
+
+/* Symbol table entry.  */
+
+typedef struct {
+    Elf32_Word    st_name;              /* Symbol name (string tbl index) */
+    Elf32_Addr    st_value;             /* Symbol value */
+    Elf32_Word    st_size;              /* Symbol size */
+    unsigned char st_info;              /* Symbol type and binding */
+    unsigned char st_other;             /* Symbol visibility */
+    Elf32_Section st_shndx;             /* Section index */
+} Elf32_Sym;
+
+typedef struct {
+    Elf64_Word    st_name;              /* Symbol name (string tbl index) */
+    unsigned char st_info;              /* Symbol type and binding */
+    unsigned char st_other;             /* Symbol visibility */
+    Elf64_Section st_shndx;             /* Section index */
+    Elf64_Addr    st_value;             /* Symbol value */
+    Elf64_Xword   st_size;              /* Symbol size */
+} Elf64_Sym;
+
+/* How to extract and insert information held in the st_info field.  */
+
+#define ELF32_ST_BIND(val)          (((unsigned char) (val)) >> 4)
+#define ELF32_ST_TYPE(val)          ((val) & 0xf)
+#define ELF32_ST_INFO(bind, type)   (((bind) << 4) + ((type) & 0xf))
+
+#define ELF64_ST_BIND(val)          ELF32_ST_BIND (val)
+#define ELF64_ST_TYPE(val)          ELF32_ST_TYPE (val)
+#define ELF64_ST_INFO(bind, type)   ELF32_ST_INFO ((bind), (type))
+
+/* Legal values for ST_BIND subfield of st_info (symbol binding).  */
+
+#define STB_LOCAL       0               /* Local symbol */
+#define STB_GLOBAL      1               /* Global symbol */
+#define STB_WEAK        2               /* Weak symbol */
+
+/* Legal values for ST_TYPE subfield of st_info (symbol type).  */
+
+#define STT_NOTYPE      0               /* Symbol type is unspecified */
+#define STT_OBJECT      1               /* Symbol is a data object */
+#define STT_FUNC        2               /* Symbol is a code object */
+#define STT_SECTION     3               /* Symbol associated with a section */
+#define STT_FILE        4               /* Symbol's name is file name */
+
+/* Symbol table indices are found in the hash buckets and chain table
+   of a symbol hash table section.  This special index value indicates
+   the end of a chain, meaning no further symbols are found in that bucket.  */
+
+#define STN_UNDEF       0               /* End of a chain.  */
+
+/* Relocation table entry without addend (in section of type SHT_REL).  */
+
+typedef struct {
+    Elf32_Addr    r_offset;             /* Address */
+    Elf32_Word    r_info;               /* Relocation type and symbol index */
+} Elf32_Rel;
+
+typedef struct {
+    Elf64_Addr    r_offset;             /* Address */
+    Elf64_Xword   r_info;               /* Relocation type and symbol index */
+} Elf64_Rel;
+
+/* Relocation table entry with addend (in section of type SHT_RELA).  */
+
+typedef struct {
+    Elf32_Addr    r_offset;             /* Address */
+    Elf32_Word    r_info;               /* Relocation type and symbol index */
+    Elf32_Sword   r_addend;             /* Addend */
+} Elf32_Rela;
+
+typedef struct {
+    Elf64_Addr    r_offset;             /* Address */
+    Elf64_Xword   r_info;               /* Relocation type and symbol index */
+    Elf64_Sxword  r_addend;             /* Addend */
+} Elf64_Rela;
+
+/* How to extract and insert information held in the r_info field.  */
+
+#define ELF32_R_SYM(val)            ((val) >> 8)
+#define ELF32_R_TYPE(val)           ((val) & 0xff)
+#define ELF32_R_INFO(sym, type)     (((sym) << 8) + ((type) & 0xff))
+
+#define ELF64_R_SYM(i)              ((i) >> 32)
+#define ELF64_R_TYPE(i)             ((i) & 0xffffffff)
+#define ELF64_R_INFO(sym,type)      ((((Elf64_Xword) (sym)) << 32) + (type))
+
+/* i386 relocs.  */
+
+#define R_386_NONE      0               /* No reloc */
+#define R_386_32        1               /* Direct 32 bit  */
+#define R_386_PC32      2               /* PC relative 32 bit */
+#define R_386_16        20
+#define R_386_PC16      21
+#define R_386_8         22
+#define R_386_PC8       23
+
+/* AMD x86-64 relocations.  */
+
+#define R_X86_64_NONE   0               /* No reloc */
+#define R_X86_64_64     1               /* Direct 64 bit  */
+#define R_X86_64_PC32   2               /* PC relative 32 bit signed */
+#define R_X86_64_32     10              /* Direct 32 bit zero extended */
+#define R_X86_64_32S    11              /* Direct 32 bit sign extended */
+#define R_X86_64_16     12              /* Direct 16 bit zero extended */
+#define R_X86_64_PC16   13              /* 16 bit sign extended pc relative */
+#define R_X86_64_8      14              /* Direct 8 bit sign extended  */
+#define R_X86_64_PC8    15              /* 8 bit sign extended pc relative */
+#define R_X86_64_PC64   24              /* PC relative 64 bit */
+
+#endif
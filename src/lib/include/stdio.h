@@ -31,6 +31,10 @@ extern FILE *stdin, *stdout, *stderr;
 #define stderr stderr
 
 #ifdef __LuxVM__
+/* Operations on files */
+int remove(const char *filename);
+int rename(const char *old, const char *new);
+
 /* File access functions */
 int fclose(FILE *stream);
 FILE *fopen(const char *filename, const char *mode);
@@ -129,5 +133,8 @@ void perror(const char *s);
 
 /* POSIX */
 int fileno(FILE *stream);
+#if defined __i386__ || defined __x86_64__
+FILE *open_memstream(char **ptr, size_t *sizeloc);
+#endif
 
 #endif
@@ -72,6 +72,7 @@ void qsort(void *base, size_t nmemb, size_t size, int (*compar)(const void *, co
 // size_t wcstombs(char *s, const wchar_t *pwcs, size_t n);
 
 /* POSIX */
+int mkstemp(char *template);
 long int random(void);
 void srandom(unsigned int seed);
 
@@ -1,6 +1,7 @@
 #ifndef _UNISTD_H
 #define _UNISTD_H
 
+int close(int fd);
 int isatty(int fd);
 
 #endif
@@ -4,35 +4,46 @@
 #include <stdlib.h>
 #include <assert.h>
 #include "util.h"
-#include "imp_lim.h"
 #include "arena.h"
+#include "intern.h"
 
 #define HASH_SIZE   1009
-#define HASH_VAL(s) (hash(s)%HASH_SIZE)
 
+/*
+ * A single table holds the locations of all the scopes that are
+ * open. Inner scopes are pushed in front of outer ones, and every
+ * scope records its own locations so they can be unlinked when it
+ * is popped.
+ */
 struct Location {
     char *id;
     int offset;
     Location *next;
+    Location *scope_next;
 };
 
 static int curr_scope = 0;
-static Location *location_table[MAX_NEST][HASH_SIZE]; /* location_table[0] unused */
-static Arena *location_arena[MAX_NEST];
+static Location *location_table[HASH_SIZE];
+static Location **scope_locations; /* scope_locations[0] unused */
+static int max_scope;
+static Location *free_locations;
+static Arena *location_arena;
 
 void location_init(void)
 {
-    int i;
-
-    for (i = 0; i < MAX_NEST; i++)
-        location_arena[i] = arena_new(128, FALSE);
+    if (location_arena == NULL)
+        location_arena = arena_new(128, FALSE);
 }
 
 static Location *alloc_location(void)
 {
     void *p;
 
-    if ((p=arena_alloc(location_arena[curr_scope], sizeof(Location))) == NULL)
+    if ((p=free_locations) != NULL) {
+        free_locations = free_locations->next;
+        return p;
+    }
+    if ((p=arena_alloc(location_arena, sizeof(Location))) == NULL)
         TERMINATE("Out of memory");
 
     return p;
@@ -40,27 +51,37 @@ static Location *alloc_location(void)
 
 void location_pop_scope(void)
 {
-    memset(&location_table[curr_scope][0], 0, sizeof(Location *)*HASH_SIZE);
-    arena_reset(location_arena[curr_scope]);
+    Location *np, *next;
+
+    for (np = scope_locations[curr_scope]; np != NULL; np = next) {
+        next = np->scope_next;
+        location_table[istr_hash(np->id)%HASH_SIZE] = np->next;
+        np->next = free_locations;
+        free_locations = np;
+    }
     --curr_scope;
 }
 
 void location_push_scope(void)
 {
-    ++curr_scope;
+    if (++curr_scope >= max_scope) {
+        Location **p;
+
+        max_scope = (max_scope==0) ? 16 : max_scope*2;
+        if ((p=realloc(scope_locations, max_scope*sizeof(Location *))) == NULL)
+            TERMINATE("Out of memory");
+        scope_locations = p;
+    }
+    scope_locations[curr_scope] = NULL;
 }
 
 int location_get_offset(char *id)
 {
-    int n;
-    unsigned h;
     Location *np;
 
-    h = HASH_VAL(id);
-    for (n = curr_scope; n >= 0; n--)
-        for (np = location_table[n][h]; np != NULL; np = np->next)
-            if (equal(id, np->id))
-                return np->offset;
+    for (np = location_table[istr_hash(id)%HASH_SIZE]; np != NULL; np = np->next)
+        if (id == np->id)
+            return np->offset;
     assert(0);
 }
 
@@ -69,10 +90,12 @@ void location_new(char *id, int offset)
     unsigned h;
     Location *np;
 
-    h = HASH_VAL(id);
+    h = istr_hash(id)%HASH_SIZE;
     np = alloc_location();
     np->id = id;
     np->offset = offset;
-    np->next = location_table[curr_scope][h];
-    location_table[curr_scope][h] = np;
+    np->next = location_table[h];
+    location_table[h] = np;
+    np->scope_next = scope_locations[curr_scope];
+    scope_locations[curr_scope] = np;
 }
@@ -65,6 +65,7 @@
 #include "ELF_util.h"
 #include "../util.h"
 #include "../arena.h"
+#include "../kwtab.h"
 
 #define bool int
 
@@ -253,13 +254,13 @@ int regrextab[] = {
 #define REGREX(r)   regrextab[(r)-TOK_AL]
 #define REGSIZ(r)   regsiztab[(r)-TOK_AL]
 
-typedef struct SBlock SBlock;
 typedef struct Section Section;
 typedef struct Reloc Reloc;
 typedef struct Symbol Symbol;
 typedef struct Operand Operand;
 typedef struct UnrExpr UnrExpr;
 typedef struct UnrLab UnrLab;
+typedef struct RelaxPoint RelaxPoint;
 
 char *prog_name, *inpath;
 int line_number = 1;
@@ -274,6 +275,7 @@ bool reading_from_stdin;
 char *non_local_label;
 Arena *opnd_arena;
 jmp_buf env;
+jmp_buf err_env; /* err1() and err2() return to assemble() through here */
 FILE *output_file;
 bool targeting_x64;
 void err1(char *fmt, ...);
@@ -288,8 +290,7 @@ typedef enum {
     GlobalBind,
     ExternBind,
 } SymBind;
-#define HASH_SIZE   1009
-#define HASH(s)     (hash(s)%HASH_SIZE)
+#define HASH(s)     (hash(s)&(symtab_size-1))
 struct Symbol {
     SymKind kind;
     SymBind bind;
@@ -297,16 +298,50 @@ struct Symbol {
     uint64_t val;
     Section *sec;   /* symbol's associated section (NULL for 'extern' symbols) */
     uint16_t ndx;   /* index into ELF file's symbol table */
+    unsigned h;     /* hash value of name */
     Symbol *next;
-} *symbols[HASH_SIZE];
+    Symbol *link;   /* next symbol in order of definition */
+};
+/*
+ * Symbols are kept in a hash table that doubles its size when the number
+ * of symbols exceeds the number of buckets. They are also linked in order
+ * of definition, so the layout of the output doesn't depend on the size
+ * of the table.
+ */
+Symbol **symbols;
+unsigned symtab_size, nsymbols;
+Symbol *first_symbol, **last_symbol = &first_symbol;
+
+void grow_symtab(void)
+{
+    unsigned i, new_size;
+    Symbol **new_tab;
+
+    new_size = symtab_size ? symtab_size*2 : 1024;
+    new_tab = calloc(new_size, sizeof(Symbol *));
+    for (i = 0; i < symtab_size; i++) {
+        Symbol *np, *next;
+
+        for (np = symbols[i]; np != NULL; np = next) {
+            next = np->next;
+            np->next = new_tab[np->h&(new_size-1)];
+            new_tab[np->h&(new_size-1)] = np;
+        }
+    }
+    free(symbols);
+    symbols = new_tab;
+    symtab_size = new_size;
+}
 
 Symbol *define_symbol(SymKind kind, SymBind bind, char *name, uint64_t val, Section *sec)
 {
     unsigned h;
     Symbol *np;
 
-    h = HASH(name);
-    for (np = symbols[h]; np != NULL; np = np->next)
+    if (symbols == NULL)
+        grow_symtab();
+    h = hash(name);
+    for (np = symbols[h&(symtab_size-1)]; np != NULL; np = np->next)
         if (np->kind==kind && equal(np->name, name))
             break;
     if (np == NULL) {
@@ -316,8 +351,14 @@ Symbol *define_symbol(SymKind kind, SymBind bind, char *name, uint64_t val, Sect
         np->name = strdup(name);
         np->val = val;
         np->sec = sec;
-        np->next = symbols[h];
-        symbols[h] = np;
+        np->h = h;
+        np->next = symbols[h&(symtab_size-1)];
+        symbols[h&(symtab_size-1)] = np;
+        np->link = NULL;
+        *last_symbol = np;
+        last_symbol = &np->link;
+        if (++nsymbols > symtab_size)
+            grow_symtab();
     } else if (np->bind == ExternBind) {
         if (bind == LocalBind)
             goto redef;
@@ -344,23 +385,23 @@ Symbol *lookup_symbol(char *name)
 {
     Symbol *np;
 
+    if (symbols == NULL)
+        return NULL;
     for (np = symbols[HASH(name)]; np != NULL; np = np->next)
         if (equal(np->name, name))
             break;
     return np;
 }
 
-struct SBlock {
-    char *avail, *limit;
-    SBlock *next;
-};
-
 struct Section {
     int LC;
     char *name;
-    SBlock *first, *last;
+    char *buf;              /* contents */
+    int cap;                /* allocated size of buf */
     Reloc *relocs;          /* relocations applied to this section */
     Symbol *sym;            /* symbol table entry for this section */
+    RelaxPoint *rpoints;    /* short branches & alignment paddings (see relax_branches()) */
+    int nrpoints, max_rpoints;
     union {
         Elf32_Shdr hdr32;
         Elf64_Shdr hdr64;
@@ -371,108 +412,117 @@ struct Section {
     } rh;                   /* section header for the associated relocation section (if any) */
     uint16_t shndx;         /* index into section header table */
     Section *next;
-} *sections, *curr_section;
+} *sections, *last_section, *curr_section;
 
-#define NOM_BLK_SIZ   512
-#define SBLOCK_SIZ(b) ((b->avail)-((char *)(b))-sizeof(SBlock))
+#define INIT_SEC_SIZ  1024
+#define MAX_INSTR_LEN 16
 #define LC()          (curr_section->LC)
-#define GET_POS()     (curr_section->last->avail)
+#define GET_POS()     (curr_section->buf+curr_section->LC)
 #define DEF_SEC       ".text" /* start to assemble in this section if none is specified */
 
+/* is `name' the system section `sys' or one of its subsections (e.g. ".text.foo")? */
+bool is_sys_section(char *name, char *sys)
+{
+    int n;
+
+    n = strlen(sys);
+    return (strncmp(name, sys, n)==0 && (name[n]=='\0' || name[n]=='.'));
+}
+
 void set_curr_section(char *name)
 {
     Section *s;
+    Symbol *sym;
     static Elf32_Half shndx = 4; /* [0]=UND, [1]=.shstrtab, [2]=.symtab, [3]=.strtab */
 
-    for (s = sections; s != NULL; s = s->next)
-        if (equal(s->name, lexeme))
-            break;
+    /* sections are found through their symbol table entries */
+    s = NULL;
+    if (symbols != NULL) {
+        for (sym = symbols[HASH(name)]; sym != NULL; sym = sym->next) {
+            if (sym->kind==SectionKind && equal(sym->name, name)) {
+                s = sym->sec;
+                break;
+            }
+        }
+    }
     if (s == NULL) {
-        unsigned n;
-
         s = malloc(sizeof(Section));
         s->name = strdup(name);
         s->LC = 0;
-        n = sizeof(SBlock)+NOM_BLK_SIZ;
-        s->first = malloc(n);
-        s->first->limit = (char *)s->first+n;
-        s->first->avail = (char *)s->first+sizeof(SBlock);
-        s->first->next = NULL;
-        s->last = s->first;
+        s->cap = INIT_SEC_SIZ;
+        s->buf = malloc(s->cap);
         s->relocs = NULL;
-        s->sym = define_symbol(SectionKind, LocalBind, lexeme, 0, s);
+        s->rpoints = NULL;
+        s->nrpoints = s->max_rpoints = 0;
+        s->sym = define_symbol(SectionKind, LocalBind, name, 0, s);
         memset(&s->h.hdr64, 0, sizeof(Elf64_Shdr));
         memset(&s->rh.rhdr64, 0, sizeof(Elf64_Shdr));
         s->shndx = shndx++;
         s->next = NULL;
-        if (sections == NULL) {
+        if (sections == NULL)
             sections = s;
-        } else {
-            Section *tmp;
-
-            for (tmp = sections; tmp->next != NULL; tmp = tmp->next);
-            tmp->next = s;
-        }
+        else
+            last_section->next = s;
+        last_section = s;
     }
     curr_section = s;
 }
 
-void expand_curr_section(void)
+/*
+ * Make room for `n' more bytes in the current section. The buffer grows
+ * geometrically, so pointers into it are only valid until the next call.
+ */
+void expand_curr_section(int n)
 {
-    SBlock *s;
-    unsigned n;
-
-    n = sizeof(SBlock)+NOM_BLK_SIZ;
-    s = malloc(n);
-    s->limit = (char *)s+n;
-    s->avail = (char *)s+sizeof(SBlock);
-    s->next = NULL;
-    curr_section->last->next = s;
-    curr_section->last = s;
+    if (curr_section == NULL)
+        set_curr_section(DEF_SEC);
+    if (LC()+n > curr_section->cap) {
+        do
+            curr_section->cap *= 2;
+        while (LC()+n > curr_section->cap);
+        if ((curr_section->buf=realloc(curr_section->buf, curr_section->cap)) == NULL)
+            TERMINATE("%s: out of memory", prog_name);
+    }
 }
 
 void write_byte(int b)
 {
-    if (curr_section == NULL)
-        set_curr_section(DEF_SEC);
-    else if (curr_section->last->avail+1 > curr_section->last->limit)
-        expand_curr_section();
-    *curr_section->last->avail = (char)b;
-    curr_section->last->avail += 1;
+    expand_curr_section(1);
+    *GET_POS() = (char)b;
     curr_section->LC += 1;
 }
 
 void write_word(int w)
 {
-    if (curr_section == NULL)
-        set_curr_section(DEF_SEC);
-    else if (curr_section->last->avail+2 > curr_section->last->limit)
-        expand_curr_section();
-    *(short *)curr_section->last->avail = (short)w;
-    curr_section->last->avail += 2;
+    expand_curr_section(2);
+    *(short *)GET_POS() = (short)w;
     curr_section->LC += 2;
 }
 
 void write_dword(int d)
 {
-    if (curr_section == NULL)
-        set_curr_section(DEF_SEC);
-    else if (curr_section->last->avail+4 > curr_section->last->limit)
-        expand_curr_section();
-    *(int *)curr_section->last->avail = d;
-    curr_section->last->avail += 4;
+    expand_curr_section(4);
+    *(int *)GET_POS() = d;
     curr_section->LC += 4;
 }
 
 void write_qword(long long q)
+{
+    expand_curr_section(8);
+    *(long long *)GET_POS() = q;
+    curr_section->LC += 8;
+}
+
+/* reserve `n' (zeroed) bytes; .bss sections are NOBITS and need no storage for them */
+void skip_bytes(int n)
 {
     if (curr_section == NULL)
         set_curr_section(DEF_SEC);
-    else if (curr_section->last->avail+8 > curr_section->last->limit)
-        expand_curr_section();
-    *(long long *)curr_section->last->avail = q;
-    curr_section->last->avail += 8;
-    curr_section->LC += 8;
+    if (!is_sys_section(curr_section->name, ".bss")) {
+        expand_curr_section(n);
+        memset(GET_POS(), 0, n);
+    }
+    curr_section->LC += n;
 }
 
 #define Reg_mode            0x000001 /* reg */
@@ -533,8 +583,8 @@ typedef enum {
     op_sar,     op_sbb,     op_seta,    op_setae,
     op_setb,    op_setbe,   op_sete,    op_setg,
     op_setge,   op_setl,    op_setle,   op_setne,
-    op_shl,     op_shr,     op_sub,     op_test,
-    op_xchg,    op_xor,
+    op_shl,     op_shr,     op_stosb,   op_sub,
+    op_test,    op_xchg,    op_xor,
 } InstrClass;
 
 /*
@@ -765,6 +815,8 @@ struct {
     { op_shr,   0,  0xD1,   0x05,   rm|Word|Dword|Qword,        Imm_1_mode|Byte,            I_MX },
     { op_shr,   0,  0xD3,   0x05,   rm|Word|Dword|Qword,        Reg_CL_mode|Byte,           I_MX },
     { op_shr,   0,  0xC1,   0x05,   rm|Word|Dword|Qword,        Imm_mode|Byte,              I_MI },
+    /* STOSB */
+    { op_stosb, 0,  0xAA,   -1,     None_mode,                  None_mode,                  -1 },
     /* SUB */
     { op_sub,   0,  0x83,   0x05,   rm|Word|Dword|Qword,        Imm_mode|Byte,              I_MI },
     { op_sub,   0,  0x2C,   -1,     Acc_mode|Byte,              Imm_mode|Byte,              I_AI },
@@ -813,7 +865,7 @@ struct {
 struct {
     char *mne;
     int ote;
-} mne2ote[] = { /* sorted for bsearch() */
+} mne2ote[] = {
     { "adc" },
     { "add" },
     { "and" },
@@ -867,12 +919,15 @@ struct {
     { "setne" },
     { "shl" },
     { "shr" },
+    { "stosb" },
     { "sub" },
     { "test" },
     { "xchg" },
     { "xor" },
 };
 
+static KwTab mnemonics;
+
 void init_tables(void)
 {
     int i, j, lim;
@@ -886,6 +941,7 @@ void init_tables(void)
         for (cl = opcode_table[j].iclass; cl == opcode_table[j].iclass; j++)
             ;
     }
+    kwtab_init(&mnemonics, mne2ote, NELEMS(mne2ote), sizeof(mne2ote[0]));
 }
 
 int regsiztab[] = {
@@ -1152,7 +1208,6 @@ long long eval_expr(Operand *e, bool pass2)
 
 struct UnrExpr {
     Operand *expr;
-    void *dest;
     int size;
     struct {
         int offs;
@@ -1163,13 +1218,12 @@ struct UnrExpr {
     UnrExpr *next;
 } *unresolved_expressions_list;
 
-void new_unr_expr(Operand *expr, void *dest, int size, int offs, Section *sec, bool reldisp, bool signext)
+void new_unr_expr(Operand *expr, int size, int offs, Section *sec, bool reldisp, bool signext)
 {
     UnrExpr *n;
 
     n = malloc(sizeof(UnrExpr));
     n->expr = expr;
-    n->dest = dest;
     n->size = size;
     n->loc.offs = offs;
     n->loc.sec = sec;
@@ -1179,6 +1233,192 @@ void new_unr_expr(Operand *expr, void *dest, int size, int offs, Section *sec, b
     unresolved_expressions_list = n;
 }
 
+/*
+ * Branch relaxation.
+ *
+ * Jcc/Jmp instructions that target a label of their own section are first
+ * assembled in their short form (rel8), even when the label is not yet
+ * defined. Once the whole program has been read, relax_branches() turns into
+ * the long form (rel32) the branches whose displacement doesn't fit in 8 bits,
+ * and moves everything that follows them (code, labels, pending expressions).
+ * This is repeated until no more branches grow. Branches never go back to
+ * their short form, so the process terminates. Alignment paddings are also
+ * recorded because their size depends on the final layout.
+ */
+struct RelaxPoint {
+    int offs;           /* offset of the branch/padding before relaxation */
+    int size;           /* size of the branch/padding before relaxation */
+    int align;          /* 0 for a branch; otherwise the alignment of the padding */
+    int shift;          /* how much the code that follows moves */
+    unsigned char opcode, fill;
+    bool is_long;
+    Operand *target;
+    UnrExpr *disp;      /* the displacement of the branch */
+};
+Operand **dollar_opnds; /* `$' operands (their value depends on the layout) */
+int ndollar_opnds, max_dollar_opnds;
+
+RelaxPoint *new_relax_point(int offs, int size)
+{
+    RelaxPoint *p;
+
+    if (curr_section->nrpoints >= curr_section->max_rpoints) {
+        curr_section->max_rpoints = curr_section->max_rpoints ? curr_section->max_rpoints*2 : 32;
+        curr_section->rpoints = realloc(curr_section->rpoints, curr_section->max_rpoints*sizeof(RelaxPoint));
+    }
+    p = &curr_section->rpoints[curr_section->nrpoints++];
+    memset(p, 0, sizeof(RelaxPoint));
+    p->offs = offs;
+    p->size = size;
+    return p;
+}
+
+/* bytes a branch grows when it goes from rel8 to rel32 */
+#define BRANCH_GROWTH(p) (((p)->opcode == 0xEB) ? 3 : 4)
+
+/* return the offset `offs' will have after relaxation */
+int relaxed_offs(Section *s, int offs)
+{
+    int lo, hi;
+
+    /* find the last point that starts at or before `offs' */
+    lo = 0, hi = s->nrpoints-1;
+    while (lo <= hi) {
+        int mid;
+
+        mid = (lo+hi)/2;
+        if (s->rpoints[mid].offs <= offs)
+            lo = mid+1;
+        else
+            hi = mid-1;
+    }
+    if (hi < 0)
+        return offs;
+    if (offs < s->rpoints[hi].offs+s->rpoints[hi].size) /* inside the point */
+        return offs+((hi > 0) ? s->rpoints[hi-1].shift : 0);
+    return offs+s->rpoints[hi].shift;
+}
+
+/* lay out the section with the current branch sizes; return TRUE if some branch had to grow */
+bool relax_section_pass(Section *s)
+{
+    int i, shift;
+    bool changed;
+
+    shift = 0;
+    for (i = 0; i < s->nrpoints; i++) {
+        RelaxPoint *p;
+
+        p = &s->rpoints[i];
+        if (p->align) {
+            int start;
+
+            start = p->offs+shift;
+            shift += round_up(start, p->align)-start-p->size;
+        } else if (p->is_long) {
+            shift += BRANCH_GROWTH(p);
+        }
+        p->shift = shift;
+    }
+
+    changed = FALSE;
+    for (i = 0; i < s->nrpoints; i++) {
+        Symbol *sym;
+        RelaxPoint *p;
+        long long disp;
+
+        p = &s->rpoints[i];
+        if (p->align || p->is_long)
+            continue;
+        if ((sym=p->target->attr.lab.sym) == NULL)
+            sym = p->target->attr.lab.sym = lookup_symbol(p->target->attr.lab.name);
+        if (sym==NULL || sym->bind==ExternBind || sym->sec!=s) {
+            p->is_long = changed = TRUE; /* needs a relocation (or is an error) */
+            continue;
+        }
+        disp = relaxed_offs(s, sym->val)-(relaxed_offs(s, p->offs)+2);
+        if (disp<-128 || disp>127)
+            p->is_long = changed = TRUE;
+    }
+    return changed;
+}
+
+/* move the contents of the section to their final offsets */
+void relax_section_apply(Section *s)
+{
+    int i, size, pos;
+    char *old, *new;
+    Symbol *sym;
+    UnrExpr *n;
+
+    old = s->buf;
+    size = s->LC+s->rpoints[s->nrpoints-1].shift;
+    s->cap = size+1;
+    new = s->buf = malloc(s->cap);
+
+    /* copy the code between the points and re-encode the points */
+    for (n = unresolved_expressions_list; n != NULL; n = n->next)
+        if (n->loc.sec == s)
+            n->loc.offs = relaxed_offs(s, n->loc.offs);
+    for (pos = i = 0; i < s->nrpoints; i++) {
+        int dst;
+        RelaxPoint *p;
+
+        p = &s->rpoints[i];
+        dst = p->offs+((i > 0) ? s->rpoints[i-1].shift : 0);
+        memcpy(new+dst-(p->offs-pos), old+pos, p->offs-pos);
+        if (p->align) {
+            memset(new+dst, p->fill, p->offs+p->size+p->shift-dst);
+        } else if (p->is_long) {
+            if (p->opcode == 0xEB) {
+                new[dst] = (char)0xE9;
+                p->disp->loc.offs = dst+1;
+            } else {
+                new[dst] = 0x0F;
+                new[dst+1] = (char)(p->opcode+0x10);
+                p->disp->loc.offs = dst+2;
+            }
+            p->disp->size = Dword;
+        } else {
+            new[dst] = (char)p->opcode;
+        }
+        pos = p->offs+p->size;
+    }
+    memcpy(new+pos+s->rpoints[s->nrpoints-1].shift, old+pos, s->LC-pos);
+    free(old);
+
+    /* move everything else that refers to a location of the section */
+    for (sym = first_symbol; sym != NULL; sym = sym->link)
+        if (sym->kind==OtherKind && sym->sec==s && sym->bind!=ExternBind)
+            sym->val = relaxed_offs(s, sym->val);
+    for (i = 0; i < ndollar_opnds; i++)
+        if (dollar_opnds[i]->attr.LC.sec == s->sym)
+            dollar_opnds[i]->attr.LC.val = relaxed_offs(s, dollar_opnds[i]->attr.LC.val);
+    s->LC = size;
+}
+
+void relax_branches(void)
+{
+    Section *s;
+
+    for (s = sections; s != NULL; s = s->next) {
+        int i;
+
+        if (s->nrpoints == 0)
+            continue;
+        while (relax_section_pass(s))
+            ;
+        for (i = 0; i < s->nrpoints; i++)
+            if (s->rpoints[i].shift != 0)
+                break;
+        if (i < s->nrpoints)
+            relax_section_apply(s);
+        free(s->rpoints);
+        s->rpoints = NULL;
+        s->nrpoints = 0;
+    }
+}
+
 void resolve_expressions(void)
 {
     UnrExpr *n, *tmp;
@@ -1187,9 +1427,11 @@ void resolve_expressions(void)
     while (n != NULL) {
         Reloc *r;
         Symbol *s;
+        char *dest;
         long long res;
 
         r = NULL;
+        dest = n->loc.sec->buf+n->loc.offs;
         res = eval_expr(n->expr, TRUE);
         if (n->reldisp) {
             if (EXPRKIND(n->expr) == REL_EXPR
@@ -1203,21 +1445,21 @@ void resolve_expressions(void)
                     if (targeting_x64)
                         r->add = res-1;
                     else
-                        *(char *)n->dest = (char)(res-1);
+                        *(char *)dest = (char)(res-1);
                     break;
                 /*case Word:
                     r = new_reloc(RELOC_REL|RELOC_SIZ16, n->loc.offs, s);
                     if (targeting_x64)
                         r->add = res-2;
                     else
-                        *(short *)n->dest = (short)(res-2);
+                        *(short *)dest = (short)(res-2);
                     break;*/
                 case Dword:
                     r = new_reloc(RELOC_REL|RELOC_SIZ32, n->loc.offs, s);
                     if (targeting_x64)
                         r->add = res-4;
                     else
-                        *(int *)n->dest = (int)(res-4);
+                        *(int *)dest = (int)(res-4);
                     break;
                 default:
                     assert(0);
@@ -1225,13 +1467,13 @@ void resolve_expressions(void)
             } else { /* target is absolute or relocatable with respect to this same section */
                 switch (n->size) {
                 case Byte:
-                    *(char *)n->dest = (char)(res-(n->loc.offs+1));
+                    *(char *)dest = (char)(res-(n->loc.offs+1));
                     break;
                 /*case Word:
-                    *(short *)n->dest = (short)(res-(n->loc.offs+2));
+                    *(short *)dest = (short)(res-(n->loc.offs+2));
                     break;*/
                 case Dword:
-                    *(int *)n->dest = (int)(res-(n->loc.offs+4));
+                    *(int *)dest = (int)(res-(n->loc.offs+4));
                     break;
                 default:
                     assert(0);
@@ -1241,16 +1483,16 @@ void resolve_expressions(void)
             if (!targeting_x64 || EXPRKIND(n->expr)==ABS_EXPR) {
                 switch (n->size) {
                 case Byte:
-                    *(char *)n->dest = (char)res;
+                    *(char *)dest = (char)res;
                     break;
                 case Word:
-                    *(short *)n->dest = (short)res;
+                    *(short *)dest = (short)res;
                     break;
                 case Dword:
-                    *(int *)n->dest = (int)res;
+                    *(int *)dest = (int)res;
                     break;
                 case Qword:
-                    *(long long *)n->dest = res;
+                    *(long long *)dest = res;
                     break;
                 }
             }
@@ -1289,20 +1531,13 @@ void resolve_expressions(void)
 
 void dump_section(Section *s)
 {
+    int i;
     Reloc *r;
-    SBlock *b;
 
     printf("Section `%s'\n", s->name);
     printf("=> Contents\n");
-    for (b = s->first; b != NULL; b = b->next) {
-        int n;
-        char *c;
-
-        n = SBLOCK_SIZ(b);
-        c = (char *)b+sizeof(SBlock);
-        while (n--)
-            printf("0x%02hhx ", *c++);
-    }
+    for (i = 0; i < s->LC; i++)
+        printf("0x%02hhx ", s->buf[i]);
     printf("\n=> Relocations\n");
     for (r = s->relocs; r != NULL; r = r->next)
         printf("attr=0x%x, off=%d, sym=%s\n", r->attr, r->offs, r->sym->name);
@@ -1310,105 +1545,54 @@ void dump_section(Section *s)
 
 int read_line(void);
 long long str2int(char *s);
-void init(char *file_path);
 Token curr_tok;
 Token get_token(void);
 void program(void);
 void write_ELF32_file(void);
 void write_ELF64_file(void);
 
-void err_no_input(void)
-{
-    fprintf(stderr, "%s: no input file\n", prog_name);
-    exit(1);
-}
-
-int main(int argc, char *argv[])
+/*
+ * Assemble the program set up by init()/init_buffer()
+ * and write the resulting ELF object file to `outpath'.
+ */
+/*
+ * Assemble the program and write the object file to `outpath'.
+ * Return non-zero if an error was reported (no file is written then).
+ */
+int assemble(char *outpath)
 {
-    int i;
-    char *outpath;
-
-    prog_name = argv[0];
-    if (argc == 1)
-        err_no_input();
-    outpath = inpath = NULL;
-    for (i = 1; i < argc; i++) {
-        if (argv[i][0]!='-' || argv[i][1]=='\0') {
-            inpath = argv[i];
-            continue;
-        }
-        switch (argv[i][1]) {
-        case 'o':
-            if (argv[i][2] != '\0') {
-                outpath = argv[i]+2;
-            } else if (argv[i+1] == NULL) {
-                fprintf(stderr, "%s: option `o' requires an argument\n", prog_name);
-                exit(1);
-            } else {
-                outpath = argv[++i];
-            }
-            break;
-        case 'm':
-            if (equal(argv[i], "-m32"))
-                ;
-            else if (equal(argv[i], "-m64"))
-                targeting_x64 = TRUE;
-            else
-                goto unk_opt;
-            break;
-        case 'h':
-            printf("usage: %s [ options ] <input-file>\n"
-                   "  The available options are:\n"
-                   "    -o<file>    write output to <file>\n"
-                   "    -m32        target x86-32 (default)\n"
-                   "    -m64        target x86-64\n"
-                   "    -h          print this help\n"
-                   "\nnote: if the input file is - the program is read from the standard input\n", prog_name);
-            exit(0);
-            break;
-        default:
-        unk_opt:
-            fprintf(stderr, "%s: unknown option `%s'\n", prog_name, argv[i]);
-            exit(1);
-        }
-    }
-    if (inpath == NULL)
-        err_no_input();
-    if (equal(inpath, "-")) {
-        init(NULL);
-        inpath = "stdin";
-    } else {
-        init(inpath);
-    }
+    int failed;
 
     opnd_arena = arena_new(sizeof(Operand)*256, FALSE);
     arena_set_nom_siz(opnd_arena, sizeof(Operand)*256);
     init_tables();
 
+    failed = TRUE;
+    if (setjmp(err_env))
+        goto done;
+
     lexeme = lexeme_buf1;
     curr_tok = get_token();
     program();
+    relax_branches();
     resolve_expressions();
     // dump_section(curr_section);
 
-    if (outpath == NULL) {
-        outpath = replace_extension(inpath, ".o");
-        output_file = fopen(outpath, "wb");
-        free(outpath);
-    } else {
-        output_file = fopen(outpath, "wb");
+    if ((output_file=fopen(outpath, "wb")) == NULL) {
+        fprintf(stderr, "%s: cannot write file `%s'\n", prog_name, outpath);
+        goto done;
     }
     if (targeting_x64)
         write_ELF64_file();
     else
         write_ELF32_file();
     fclose(output_file);
-
+    failed = FALSE;
+done:
     arena_destroy(opnd_arena);
     if (buf != NULL)
         free(buf);
-
-    return 0;
+    return failed;
 }
 
 void line(void);
@@ -1435,10 +1619,9 @@ int get_opcode_table_entry(char *s)
 {
     int i;
 
-    for (i = 0; i < NELEMS(mne2ote); i++)
-        if (equal(mne2ote[i].mne, s))
-            return mne2ote[i].ote;
-    err1("unknown instruction `%s'", s);
+    if ((i=kwtab_lookup(&mnemonics, s)) == -1)
+        err1("unknown instruction `%s'", s);
+    return mne2ote[i].ote;
 }
 
 /* encode immediate operand */
@@ -1447,19 +1630,19 @@ void encode_imm_opnd(Operand *e, unsigned size, unsigned op1_siz)
     switch (size) {
     case Byte:
         write_byte(0);
-        new_unr_expr(e, GET_POS()-1, Byte, LC()-1, curr_section, FALSE, -1);
+        new_unr_expr(e, Byte, LC()-1, curr_section, FALSE, -1);
         break;
     case Word:
         write_word(0);
-        new_unr_expr(e, GET_POS()-2, Word, LC()-2, curr_section, FALSE, -1);
+        new_unr_expr(e, Word, LC()-2, curr_section, FALSE, -1);
         break;
     case Dword:
         write_dword(0);
-        new_unr_expr(e, GET_POS()-4, Dword, LC()-4, curr_section, FALSE, op1_siz==Qword);
+        new_unr_expr(e, Dword, LC()-4, curr_section, FALSE, op1_siz==Qword);
         break;
     case Qword:
         write_qword(0);
-        new_unr_expr(e, GET_POS()-8, Qword, LC()-8, curr_section, FALSE, -1);
+        new_unr_expr(e, Qword, LC()-8, curr_section, FALSE, -1);
         break;
     }
 }
@@ -1525,7 +1708,7 @@ void encode_rm_opnd(char *mod_rm, char *rex, Operand *op, unsigned addr_mode)
             *mod_rm |= 0x05;  /* mod=00, r/m=101 */
         }
         write_dword(0);
-        new_unr_expr(LCHILD(op), GET_POS()-4, Dword, LC()-4, curr_section, FALSE, TRUE);
+        new_unr_expr(LCHILD(op), Dword, LC()-4, curr_section, FALSE, TRUE);
         break;
 
     /*
@@ -1570,11 +1753,11 @@ void encode_rm_opnd(char *mod_rm, char *rex, Operand *op, unsigned addr_mode)
         if (RCHILD(LCHILD(op))->addr_mode & Byte) {
             *mod_rm |= 0x40; /* disp8 */
             write_byte(0);
-            new_unr_expr(RCHILD(LCHILD(op)), GET_POS()-1, Byte, LC()-1, curr_section, FALSE, FALSE);
+            new_unr_expr(RCHILD(LCHILD(op)), Byte, LC()-1, curr_section, FALSE, FALSE);
         } else {
             *mod_rm |= 0x80; /* disp32 */
             write_dword(0);
-            new_unr_expr(RCHILD(LCHILD(op)), GET_POS()-4, Dword, LC()-4, curr_section, FALSE, TRUE);
+            new_unr_expr(RCHILD(LCHILD(op)), Dword, LC()-4, curr_section, FALSE, TRUE);
         }
         break;
 
@@ -1599,7 +1782,7 @@ void encode_rm_opnd(char *mod_rm, char *rex, Operand *op, unsigned addr_mode)
             scale = EXPRVAL(RCHILD(LCHILD(LCHILD(op))));
             encode_sib(scale, index, TOK_EBP, rex);
             write_dword(0); /* disp32 */
-            new_unr_expr(RCHILD(LCHILD(op)), GET_POS()-4, Dword, LC()-4, curr_section, FALSE, TRUE);
+            new_unr_expr(RCHILD(LCHILD(op)), Dword, LC()-4, curr_section, FALSE, TRUE);
         }
         break;
 
@@ -1654,11 +1837,11 @@ void encode_rm_opnd(char *mod_rm, char *rex, Operand *op, unsigned addr_mode)
         if (RCHILD(LCHILD(op))->addr_mode & Byte) {
             *mod_rm |= 0x44;
             write_byte(0); /* disp8 */
-            new_unr_expr(RCHILD(LCHILD(op)), GET_POS()-1, Byte, LC()-1, curr_section, FALSE, FALSE);
+            new_unr_expr(RCHILD(LCHILD(op)), Byte, LC()-1, curr_section, FALSE, FALSE);
         } else {
             *mod_rm |= 0x84;
             write_dword(0); /* disp32 */
-            new_unr_expr(RCHILD(LCHILD(op)), GET_POS()-4, Dword, LC()-4, curr_section, FALSE, TRUE);
+            new_unr_expr(RCHILD(LCHILD(op)), Dword, LC()-4, curr_section, FALSE, TRUE);
         }
         break;
     }
@@ -1680,6 +1863,8 @@ void emit_i(int ote, Operand *op1, Operand *op2)
     unsigned char mod_rm = 0;
 
     --line_number; /* the lexer has already read the '\n' that follows the instruction */
+    /* the REX prefix, opcode, and ModRM bytes are patched through pointers, the buffer must not move */
+    expand_curr_section(MAX_INSTR_LEN);
 
     if (op1!=NULL && op2!=NULL) {
         bool size_mismatch = FALSE;
@@ -1914,14 +2099,21 @@ void emit_i(int ote, Operand *op1, Operand *op2)
             encode_imm_opnd(op1, op1_siz&_op1, Qword); /* Qword because when doing 'push imm32' */
             break;                                     /* imm32 is sign extended to imm64 */
 
-        case I_REL8: /* 8-bit displacement relative to next instruction */
+        case I_REL8: { /* 8-bit displacement relative to next instruction */
+            RelaxPoint *p;
+
             write_byte(0);
-            new_unr_expr(op1, GET_POS()-1, Byte, LC()-1, curr_section, TRUE, FALSE);
+            new_unr_expr(op1, Byte, LC()-1, curr_section, TRUE, FALSE);
+            p = new_relax_point(LC()-2, 2);
+            p->opcode = *opcode;
+            p->target = op1;
+            p->disp = unresolved_expressions_list;
+        }
             break;
 
         case I_REL32: /* 32-bit displacement relative to next instruction */
             write_dword(0);
-            new_unr_expr(op1, GET_POS()-4, Dword, LC()-4, curr_section, TRUE, FALSE);
+            new_unr_expr(op1, Dword, LC()-4, curr_section, TRUE, FALSE);
             break;
         }
     } else {
@@ -2018,13 +2210,18 @@ void directive(void)
         match(TOK_ALIGN);
         if (curr_tok == TOK_NUM) {
             int nb, arg;
+            RelaxPoint *p;
 
             if (curr_section == NULL)
                 set_curr_section(DEF_SEC);
             arg = str2int(lexeme);
             if (!is_po2(arg))
                 err1("section alignment `%d' is not power of two", arg);
-            for (nb = round_up(LC(), arg)-LC(); nb; nb--)
+            nb = round_up(LC(), arg)-LC();
+            p = new_relax_point(LC(), nb);
+            p->align = arg;
+            p->fill = 0x90;
+            for (; nb; nb--)
                 write_byte(0x90);
         }
         match(TOK_NUM);
@@ -2033,6 +2230,7 @@ void directive(void)
         match(TOK_ALIGNB);
         if (curr_tok == TOK_NUM) {
             int nb, arg;
+            RelaxPoint *p;
 
             if (curr_section == NULL)
                 set_curr_section(DEF_SEC);
@@ -2040,8 +2238,9 @@ void directive(void)
             if (!is_po2(arg))
                 err1("section alignment `%d' is not power of two", arg);
             nb = round_up(LC(), arg)-LC();
-            curr_section->last->avail += nb;
-            LC() += nb;
+            p = new_relax_point(LC(), nb);
+            p->align = arg;
+            skip_bytes(nb);
         }
         match(TOK_NUM);
         break;
@@ -2155,8 +2354,7 @@ start:
                     longjmp(env, 1);
                 if (curr_section == NULL)
                     set_curr_section(DEF_SEC);
-                curr_section->last->avail += val*siz;
-                LC() += val*siz;
+                skip_bytes(val*siz);
             } else {
                 err1("invalid argument to resX directive");
             }
@@ -2166,11 +2364,11 @@ start:
             if (curr_section == NULL)
                 set_curr_section(DEF_SEC);
             write_byte(0);
-            new_unr_expr(OR_expr(), GET_POS()-1, Byte, LC()-1, curr_section, FALSE, FALSE);
+            new_unr_expr(OR_expr(), Byte, LC()-1, curr_section, FALSE, FALSE);
             while (curr_tok == TOK_COMMA) {
                 match(TOK_COMMA);
                 write_byte(0);
-                new_unr_expr(OR_expr(), GET_POS()-1, Byte, LC()-1, curr_section, FALSE, FALSE);
+                new_unr_expr(OR_expr(), Byte, LC()-1, curr_section, FALSE, FALSE);
             }
             break;
         case TOK_DW:
@@ -2178,11 +2376,11 @@ start:
             if (curr_section == NULL)
                 set_curr_section(DEF_SEC);
             write_word(0);
-            new_unr_expr(OR_expr(), GET_POS()-2, Word, LC()-2, curr_section, FALSE, FALSE);
+            new_unr_expr(OR_expr(), Word, LC()-2, curr_section, FALSE, FALSE);
             while (curr_tok == TOK_COMMA) {
                 match(TOK_COMMA);
                 write_word(0);
-                new_unr_expr(OR_expr(), GET_POS()-2, Word, LC()-2, curr_section, FALSE, FALSE);
+                new_unr_expr(OR_expr(), Word, LC()-2, curr_section, FALSE, FALSE);
             }
             break;
         case TOK_DD:
@@ -2190,11 +2388,11 @@ start:
             if (curr_section == NULL)
                 set_curr_section(DEF_SEC);
             write_dword(0);
-            new_unr_expr(OR_expr(), GET_POS()-4, Dword, LC()-4, curr_section, FALSE, FALSE);
+            new_unr_expr(OR_expr(), Dword, LC()-4, curr_section, FALSE, FALSE);
             while (curr_tok == TOK_COMMA) {
                 match(TOK_COMMA);
                 write_dword(0);
-                new_unr_expr(OR_expr(), GET_POS()-4, Dword, LC()-4, curr_section, FALSE, FALSE);
+                new_unr_expr(OR_expr(), Dword, LC()-4, curr_section, FALSE, FALSE);
             }
             break;
         case TOK_DQ:
@@ -2202,11 +2400,11 @@ start:
             if (curr_section == NULL)
                 set_curr_section(DEF_SEC);
             write_qword(0);
-            new_unr_expr(OR_expr(), GET_POS()-8, Qword, LC()-8, curr_section, FALSE, FALSE);
+            new_unr_expr(OR_expr(), Qword, LC()-8, curr_section, FALSE, FALSE);
             while (curr_tok == TOK_COMMA) {
                 match(TOK_COMMA);
                 write_qword(0);
-                new_unr_expr(OR_expr(), GET_POS()-8, Qword, LC()-8, curr_section, FALSE, FALSE);
+                new_unr_expr(OR_expr(), Qword, LC()-8, curr_section, FALSE, FALSE);
             }
             break;
         }
@@ -2262,6 +2460,33 @@ void label(void)
     match(TOK_COLON);
 }
 
+/*
+ * Return TRUE if the value of `e' may still change when branches are relaxed,
+ * that is, if it refers to a location of a section that contains relax points.
+ */
+bool depends_on_layout(Operand *e)
+{
+    Symbol *s;
+
+    switch (e->op) {
+    case TOK_NUM:
+        return FALSE;
+    case TOK_ID:
+        s = e->attr.lab.sym;
+        break;
+    case TOK_DOLLAR:
+        s = e->attr.LC.sec;
+        break;
+    case TOK_UNARY_MINUS:
+    case TOK_CMPL:
+    case TOK_LNEG:
+        return depends_on_layout(LCHILD(e));
+    default:
+        return depends_on_layout(LCHILD(e)) || depends_on_layout(RCHILD(e));
+    }
+    return s!=NULL && s->sec!=NULL && s->sec->nrpoints>0;
+}
+
 /* reldisp can be 0 (the expression is not a relative displacement), 8, or 32 */
 Operand *asm_expr(int reldisp)
 {
@@ -2274,7 +2499,11 @@ Operand *asm_expr(int reldisp)
 
         val = eval_expr(e, FALSE);
         if (!reldisp) {
-            if (EXPRKIND(e) == ABS_EXPR) {
+            /*
+             * The size of a label difference is chosen now, but its
+             * value is only final after relaxation; assume worst case.
+             */
+            if (EXPRKIND(e)==ABS_EXPR && !depends_on_layout(e)) {
                 if (val>=-128 && val<=127) {
                     e->addr_mode = Imm_mode|Byte|Word|Dword|Qword;
                     if (val == 1)
@@ -2316,9 +2545,14 @@ Operand *asm_expr(int reldisp)
     } else {
         /*
          * The expression references a not-yet-defined label.
-         * Assume worst case, that is, the biggest size.
+         * Assume worst case, that is, the biggest size. Except
+         * for branches to a label, which start short and are
+         * made long later if necessary (see relax_branches()).
          */
-        e->addr_mode = Imm_mode|Dword|Qword;
+        if (reldisp==8 && e->op==TOK_ID)
+            e->addr_mode = Imm_mode|Byte;
+        else
+            e->addr_mode = Imm_mode|Dword|Qword;
     }
     return e;
 }
@@ -2695,6 +2929,11 @@ Operand *PRIMARY_expr(void)
         e = new_opnd(TOK_DOLLAR);
         e->attr.LC.val = LC();
         e->attr.LC.sec = lookup_symbol(curr_section->name);
+        if (ndollar_opnds >= max_dollar_opnds) {
+            max_dollar_opnds = max_dollar_opnds ? max_dollar_opnds*2 : 16;
+            dollar_opnds = realloc(dollar_opnds, max_dollar_opnds*sizeof(Operand *));
+        }
+        dollar_opnds[ndollar_opnds++] = e;
         match(TOK_DOLLAR);
         break;
     default:
@@ -2721,7 +2960,7 @@ void match(Token expected)
 struct RWord {
     char *str;
     Token tok;
-} reserved_table[] = { /* sorted for bsearch() */
+} reserved_table[] = {
     { "ah",     TOK_AH      },
     { "al",     TOK_AL      },
     { "align",  TOK_ALIGN   },
@@ -2816,24 +3055,18 @@ struct RWord {
     { "word",   TOK_WORD    }
 };
 
-int cmp_rword(const void *p1, const void *p2)
-{
-    struct RWord *x1 = (struct RWord *)p1;
-    struct RWord *x2 = (struct RWord *)p2;
-
-    return strcmp(x1->str, x2->str);
-}
+static KwTab reserved_words;
 
 Token reserved_lookup(char *s)
 {
-    struct RWord key, *res;
+    int i;
 
-    key.str = s;
-    res = bsearch(&key, reserved_table, NELEMS(reserved_table), sizeof(reserved_table[0]), cmp_rword);
-    if (res == NULL)
+    if (reserved_words.slots == NULL)
+        kwtab_init(&reserved_words, reserved_table, NELEMS(reserved_table), sizeof(reserved_table[0]));
+    if ((i=kwtab_lookup(&reserved_words, s)) == -1)
         return TOK_ID;
     else
-        return res->tok;
+        return reserved_table[i].tok;
 }
 
 Token get_token(void)
@@ -3052,6 +3285,13 @@ void init(char *file_path)
     }
 }
 
+/* the program is already in memory (the buffer is not freed) */
+void init_buffer(char *src)
+{
+    curr = src;
+    buf = NULL;
+}
+
 long long str2int(char *s)
 {
     char *ep;
@@ -3069,7 +3309,7 @@ void err1(char *fmt, ...)
     vfprintf(stderr, fmt, args);
     va_end(args);
     fprintf(stderr, "\n");
-    exit(EXIT_FAILURE);
+    longjmp(err_env, 1);
 }
 
 /* report pass 2 errors */
@@ -3082,13 +3322,14 @@ void err2(Operand *op, char *fmt, ...)
     vfprintf(stderr, fmt, args);
     va_end(args);
     fprintf(stderr, "\n");
-    exit(EXIT_FAILURE);
+    longjmp(err_env, 1);
 }
 
 void write_ELF64_file(void)
 {
     int i;
     unsigned nsym;
+    Symbol *np;
     Section *sec;
     Elf64_Ehdr elf_header;
     Elf64_Off curr = 0;
@@ -3163,56 +3404,44 @@ void write_ELF64_file(void)
     /* remaining .symtab entries */
     nsym = 2;
     /* symbols with STB_LOCAL binding */
-    for (i = 0; i < HASH_SIZE; i++) {
-        if (symbols[i] != NULL) {
-            Symbol *np;
-
-            for (np = symbols[i]; np != NULL; np = np->next) {
-                if (np->kind == SectionKind) {
-                    memset(&sym, 0, sizeof(Elf64_Sym));
-                    sym.st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
-                    sym.st_shndx = np->sec->shndx;
-                } else if (np->bind == LocalBind) {
-                    memset(&sym, 0, sizeof(Elf64_Sym));
-                    sym.st_name = strtab_append(strtab, np->name);
-                    sym.st_value = np->val;
-                    sym.st_info = ELF64_ST_INFO(STB_LOCAL, STT_NOTYPE);
-                    sym.st_shndx = np->sec->shndx;
-                } else {
-                    continue;
-                }
-                np->ndx = nsym++;
-                ++symtab_header.sh_info;
-                fwrite(&sym, sizeof(Elf64_Sym), 1, output_file);
-                curr += sizeof(Elf64_Sym);
-                symtab_header.sh_size += sizeof(Elf64_Sym);
-            }
+    for (np = first_symbol; np != NULL; np = np->link) {
+        if (np->kind == SectionKind) {
+            memset(&sym, 0, sizeof(Elf64_Sym));
+            sym.st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+            sym.st_shndx = np->sec->shndx;
+        } else if (np->bind == LocalBind) {
+            memset(&sym, 0, sizeof(Elf64_Sym));
+            sym.st_name = strtab_append(strtab, np->name);
+            sym.st_value = np->val;
+            sym.st_info = ELF64_ST_INFO(STB_LOCAL, STT_NOTYPE);
+            sym.st_shndx = np->sec->shndx;
+        } else {
+            continue;
         }
+        np->ndx = nsym++;
+        ++symtab_header.sh_info;
+        fwrite(&sym, sizeof(Elf64_Sym), 1, output_file);
+        curr += sizeof(Elf64_Sym);
+        symtab_header.sh_size += sizeof(Elf64_Sym);
     }
     /* symbols with STB_GLOBAL binding */
-    for (i = 0; i < HASH_SIZE; i++) {
-        if (symbols[i] != NULL) {
-            Symbol *np;
-
-            for (np = symbols[i]; np != NULL; np = np->next) {
-                if (np->bind == LocalBind)
-                    continue;
-                memset(&sym, 0, sizeof(Elf64_Sym));
-                sym.st_name = strtab_append(strtab, np->name);
-                sym.st_value = np->val;
-                sym.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE);
-                if (np->bind == ExternBind) {
-                    sym.st_shndx = SHN_UNDEF;
-                } else {
-                    assert(np->sec != NULL); /* TBD: undefined 'global' */
-                    sym.st_shndx = np->sec->shndx;
-                }
-                np->ndx = nsym++;
-                fwrite(&sym, sizeof(Elf64_Sym), 1, output_file);
-                curr += sizeof(Elf64_Sym);
-                symtab_header.sh_size += sizeof(Elf64_Sym);
-            }
+    for (np = first_symbol; np != NULL; np = np->link) {
+        if (np->bind == LocalBind)
+            continue;
+        memset(&sym, 0, sizeof(Elf64_Sym));
+        sym.st_name = strtab_append(strtab, np->name);
+        sym.st_value = np->val;
+        sym.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+        if (np->bind == ExternBind) {
+            sym.st_shndx = SHN_UNDEF;
+        } else {
+            assert(np->sec != NULL); /* TBD: undefined 'global' */
+            sym.st_shndx = np->sec->shndx;
         }
+        np->ndx = nsym++;
+        fwrite(&sym, sizeof(Elf64_Sym), 1, output_file);
+        curr += sizeof(Elf64_Sym);
+        symtab_header.sh_size += sizeof(Elf64_Sym);
     }
     ++elf_header.e_shnum;
 
@@ -3228,28 +3457,26 @@ void write_ELF64_file(void)
      * Remaining sections.
      */
     for (sec = sections; sec != NULL; sec = sec->next) {
-        SBlock *sb;
-
         if (sec->name[0] == '.') {
-            if (equal(sec->name, ".text")) {
+            if (is_sys_section(sec->name, ".text")) {
                 sec->h.hdr64.sh_type = SHT_PROGBITS;
                 sec->h.hdr64.sh_flags = SHF_ALLOC|SHF_EXECINSTR;
                 sec->h.hdr64.sh_addralign = 16;
-            } else if (equal(sec->name, ".data")) {
+            } else if (is_sys_section(sec->name, ".data")) {
                 sec->h.hdr64.sh_type = SHT_PROGBITS;
                 sec->h.hdr64.sh_flags = SHF_ALLOC|SHF_WRITE;
                 sec->h.hdr64.sh_addralign = 4;
-            } else if (equal(sec->name, ".rodata")) {
+            } else if (is_sys_section(sec->name, ".rodata")) {
                 sec->h.hdr64.sh_type = SHT_PROGBITS;
                 sec->h.hdr64.sh_flags = SHF_ALLOC;
                 sec->h.hdr64.sh_addralign = 4;
-            } else if (equal(sec->name, ".bss")) {
+            } else if (is_sys_section(sec->name, ".bss")) {
                 sec->h.hdr64.sh_type = SHT_NOBITS;
                 sec->h.hdr64.sh_flags = SHF_ALLOC|SHF_WRITE;
                 sec->h.hdr64.sh_addralign = 4;
                 ALIGN(4);
                 sec->h.hdr64.sh_offset = curr;
-                sec->h.hdr64.sh_size = SBLOCK_SIZ(sec->first);
+                sec->h.hdr64.sh_size = sec->LC;
                 ++elf_header.e_shnum;
                 continue;
             } else {
@@ -3264,14 +3491,9 @@ unk_sec:    sec->h.hdr64.sh_type = SHT_PROGBITS;
         }
         ALIGN(4);
         sec->h.hdr64.sh_offset = curr;
-        for (sb = sec->first; sb != NULL; sb = sb->next) {
-            unsigned n;
-
-            n = SBLOCK_SIZ(sb);
-            fwrite((char *)sb+sizeof(SBlock), n, 1, output_file);
-            sec->h.hdr64.sh_size += n;
-            curr += n;
-        }
+        fwrite(sec->buf, sec->LC, 1, output_file);
+        sec->h.hdr64.sh_size = sec->LC;
+        curr += sec->LC;
         ++elf_header.e_shnum;
         if (sec->relocs != NULL) {
             Reloc *r;
@@ -3378,6 +3600,7 @@ void write_ELF32_file(void)
 {
     int i;
     unsigned nsym;
+    Symbol *np;
     Section *sec;
     Elf32_Ehdr elf_header;
     Elf32_Off curr = 0;
@@ -3452,56 +3675,44 @@ void write_ELF32_file(void)
     /* remaining .symtab entries */
     nsym = 2;
     /* symbols with STB_LOCAL binding */
-    for (i = 0; i < HASH_SIZE; i++) {
-        if (symbols[i] != NULL) {
-            Symbol *np;
-
-            for (np = symbols[i]; np != NULL; np = np->next) {
-                if (np->kind == SectionKind) {
-                    memset(&sym, 0, sizeof(Elf32_Sym));
-                    sym.st_info = ELF32_ST_INFO(STB_LOCAL, STT_SECTION);
-                    sym.st_shndx = np->sec->shndx;
-                } else if (np->bind == LocalBind) {
-                    memset(&sym, 0, sizeof(Elf32_Sym));
-                    sym.st_name = strtab_append(strtab, np->name);
-                    sym.st_value = np->val;
-                    sym.st_info = ELF32_ST_INFO(STB_LOCAL, STT_NOTYPE);
-                    sym.st_shndx = np->sec->shndx;
-                } else {
-                    continue;
-                }
-                np->ndx = nsym++;
-                ++symtab_header.sh_info;
-                fwrite(&sym, sizeof(Elf32_Sym), 1, output_file);
-                curr += sizeof(Elf32_Sym);
-                symtab_header.sh_size += sizeof(Elf32_Sym);
-            }
+    for (np = first_symbol; np != NULL; np = np->link) {
+        if (np->kind == SectionKind) {
+            memset(&sym, 0, sizeof(Elf32_Sym));
+            sym.st_info = ELF32_ST_INFO(STB_LOCAL, STT_SECTION);
+            sym.st_shndx = np->sec->shndx;
+        } else if (np->bind == LocalBind) {
+            memset(&sym, 0, sizeof(Elf32_Sym));
+            sym.st_name = strtab_append(strtab, np->name);
+            sym.st_value = np->val;
+            sym.st_info = ELF32_ST_INFO(STB_LOCAL, STT_NOTYPE);
+            sym.st_shndx = np->sec->shndx;
+        } else {
+            continue;
         }
+        np->ndx = nsym++;
+        ++symtab_header.sh_info;
+        fwrite(&sym, sizeof(Elf32_Sym), 1, output_file);
+        curr += sizeof(Elf32_Sym);
+        symtab_header.sh_size += sizeof(Elf32_Sym);
     }
     /* symbols with STB_GLOBAL binding */
-    for (i = 0; i < HASH_SIZE; i++) {
-        if (symbols[i] != NULL) {
-            Symbol *np;
-
-            for (np = symbols[i]; np != NULL; np = np->next) {
-                if (np->bind == LocalBind)
-                    continue;
-                memset(&sym, 0, sizeof(Elf32_Sym));
-                sym.st_name = strtab_append(strtab, np->name);
-                sym.st_value = np->val;
-                sym.st_info = ELF32_ST_INFO(STB_GLOBAL, STT_NOTYPE);
-                if (np->bind == ExternBind) {
-                    sym.st_shndx = SHN_UNDEF;
-                } else {
-                    assert(np->sec != NULL); /* TBD: undefined 'global' */
-                    sym.st_shndx = np->sec->shndx;
-                }
-                np->ndx = nsym++;
-                fwrite(&sym, sizeof(Elf32_Sym), 1, output_file);
-                curr += sizeof(Elf32_Sym);
-                symtab_header.sh_size += sizeof(Elf32_Sym);
-            }
+    for (np = first_symbol; np != NULL; np = np->link) {
+        if (np->bind == LocalBind)
+            continue;
+        memset(&sym, 0, sizeof(Elf32_Sym));
+        sym.st_name = strtab_append(strtab, np->name);
+        sym.st_value = np->val;
+        sym.st_info = ELF32_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+        if (np->bind == ExternBind) {
+            sym.st_shndx = SHN_UNDEF;
+        } else {
+            assert(np->sec != NULL); /* TBD: undefined 'global' */
+            sym.st_shndx = np->sec->shndx;
         }
+        np->ndx = nsym++;
+        fwrite(&sym, sizeof(Elf32_Sym), 1, output_file);
+        curr += sizeof(Elf32_Sym);
+        symtab_header.sh_size += sizeof(Elf32_Sym);
     }
     ++elf_header.e_shnum;
 
@@ -3517,28 +3728,26 @@ void write_ELF32_file(void)
      * Remaining sections.
      */
     for (sec = sections; sec != NULL; sec = sec->next) {
-        SBlock *sb;
-
         if (sec->name[0] == '.') {
-            if (equal(sec->name, ".text")) {
+            if (is_sys_section(sec->name, ".text")) {
                 sec->h.hdr32.sh_type = SHT_PROGBITS;
                 sec->h.hdr32.sh_flags = SHF_ALLOC|SHF_EXECINSTR;
                 sec->h.hdr32.sh_addralign = 16;
-            } else if (equal(sec->name, ".data")) {
+            } else if (is_sys_section(sec->name, ".data")) {
                 sec->h.hdr32.sh_type = SHT_PROGBITS;
                 sec->h.hdr32.sh_flags = SHF_ALLOC|SHF_WRITE;
                 sec->h.hdr32.sh_addralign = 4;
-            } else if (equal(sec->name, ".rodata")) {
+            } else if (is_sys_section(sec->name, ".rodata")) {
                 sec->h.hdr32.sh_type = SHT_PROGBITS;
                 sec->h.hdr32.sh_flags = SHF_ALLOC;
                 sec->h.hdr32.sh_addralign = 4;
-            } else if (equal(sec->name, ".bss")) {
+            } else if (is_sys_section(sec->name, ".bss")) {
                 sec->h.hdr32.sh_type = SHT_NOBITS;
                 sec->h.hdr32.sh_flags = SHF_ALLOC|SHF_WRITE;
                 sec->h.hdr32.sh_addralign = 4;
                 ALIGN(4);
                 sec->h.hdr32.sh_offset = curr;
-                sec->h.hdr32.sh_size = SBLOCK_SIZ(sec->first);
+                sec->h.hdr32.sh_size = sec->LC;
                 ++elf_header.e_shnum;
                 continue;
             } else {
@@ -3553,14 +3762,9 @@ unk_sec:    sec->h.hdr32.sh_type = SHT_PROGBITS;
         }
         ALIGN(4);
         sec->h.hdr32.sh_offset = curr;
-        for (sb = sec->first; sb != NULL; sb = sb->next) {
-            unsigned n;
-
-            n = SBLOCK_SIZ(sb);
-            fwrite((char *)sb+sizeof(SBlock), n, 1, output_file);
-            sec->h.hdr32.sh_size += n;
-            curr += n;
-        }
+        fwrite(sec->buf, sec->LC, 1, output_file);
+        sec->h.hdr32.sh_size = sec->LC;
+        curr += sec->LC;
         ++elf_header.e_shnum;
         if (sec->relocs != NULL) {
             Reloc *r;
@@ -1,4 +1,16 @@
 #ifndef LUXAS_H_
 #define LUXAS_H_
 
+/*
+ * Assembler interface.
+ * Used by the luxas program (main.c) and by luxcc -c, which hands
+ * over the assembly text it generated without going through a file.
+ */
+extern char *prog_name, *inpath;    /* for diagnostics */
+extern int targeting_x64;
+
+void init(char *file_path);         /* read the program from `file_path' (stdin if NULL) */
+void init_buffer(char *src);        /* assemble the NUL-terminated program `src' */
+int assemble(char *outpath);         /* non-zero if an error was reported */
+
 #endif
@@ -0,0 +1,80 @@
+#include "luxas.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../util.h"
+
+static void err_no_input(void)
+{
+    fprintf(stderr, "%s: no input file\n", prog_name);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int i, failed;
+    char *outpath;
+
+    prog_name = argv[0];
+    if (argc == 1)
+        err_no_input();
+    outpath = inpath = NULL;
+    for (i = 1; i < argc; i++) {
+        if (argv[i][0]!='-' || argv[i][1]=='\0') {
+            inpath = argv[i];
+            continue;
+        }
+        switch (argv[i][1]) {
+        case 'o':
+            if (argv[i][2] != '\0') {
+                outpath = argv[i]+2;
+            } else if (argv[i+1] == NULL) {
+                fprintf(stderr, "%s: option `o' requires an argument\n", prog_name);
+                exit(1);
+            } else {
+                outpath = argv[++i];
+            }
+            break;
+        case 'm':
+            if (equal(argv[i], "-m32"))
+                ;
+            else if (equal(argv[i], "-m64"))
+                targeting_x64 = TRUE;
+            else
+                goto unk_opt;
+            break;
+        case 'h':
+            printf("usage: %s [ options ] <input-file>\n"
+                   "  The available options are:\n"
+                   "    -o<file>    write output to <file>\n"
+                   "    -m32        target x86-32 (default)\n"
+                   "    -m64        target x86-64\n"
+                   "    -h          print this help\n"
+                   "\nnote: if the input file is - the program is read from the standard input\n", prog_name);
+            exit(0);
+            break;
+        default:
+        unk_opt:
+            fprintf(stderr, "%s: unknown option `%s'\n", prog_name, argv[i]);
+            exit(1);
+        }
+    }
+    if (inpath == NULL)
+        err_no_input();
+    if (equal(inpath, "-")) {
+        init(NULL);
+        inpath = "stdin";
+    } else {
+        init(inpath);
+    }
+
+    if (outpath == NULL) {
+        outpath = replace_extension(inpath, ".o");
+        failed = assemble(outpath);
+        free(outpath);
+    } else {
+        failed = assemble(outpath);
+    }
+
+    return failed ? EXIT_FAILURE : 0;
+}
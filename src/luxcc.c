@@ -9,7 +9,12 @@
 #include "vm64_cgen/vm64_cgen.h"
 #include "x86_cgen/x86_cgen.h"
 #include "x64_cgen/x64_cgen.h"
+#include "peep.h"
+#include "intern.h"
 #include "util.h"
+#ifdef WITH_LUXAS
+#include "luxas/luxas.h"
+#endif
 
 unsigned warning_count, error_count;
 int disable_warnings;
@@ -19,8 +24,11 @@ char *cg_outpath;
 char *cfg_outpath, *cfg_function_to_print;
 char *ic_outpath, *ic_function_to_print;
 int include_liblux = TRUE;
+int function_sections, data_sections;
 
 unsigned stat_number_of_pre_tokens;
+unsigned stat_number_of_skipped_includes;
+unsigned stat_number_of_pch_hits;
 unsigned stat_number_of_c_tokens;
 unsigned stat_number_of_ast_nodes;
 static char *program_name;
@@ -47,20 +55,49 @@ enum {
     OPT_X64_TARGET      = 0x080,
     OPT_VM32_TARGET     = 0x100,
     OPT_VM64_TARGET     = 0x200,
+    OPT_ASSEMBLE        = 0x400,
+    OPT_WRITE_DEPS      = 0x800,
 };
 #define TARGET_MASK (OPT_X86_TARGET|OPT_X64_TARGET|OPT_VM32_TARGET|OPT_VM64_TARGET)
 
+#ifdef WITH_LUXAS
+/*
+ * Run luxas in-process on the assembly generated for `src_path' (the
+ * NUL-terminated string `asm_buf') and write the ELF object file to
+ * `obj_path'. Return non-zero if luxas reported an error.
+ */
+static int run_luxas(char *asm_buf, char *src_path, char *obj_path, int x64)
+{
+    prog_name = program_name;
+    inpath = src_path;
+    targeting_x64 = x64;
+    init_buffer(asm_buf);
+    return assemble(obj_path);
+}
+#endif
+
 int main(int argc, char *argv[])
 {
     int i;
     FILE *fp = NULL;
     unsigned flags = 0;
     char *outpath = NULL, *inpath = NULL;
+    char *dep_path = NULL, *dep_target = NULL;
     PreTokenNode *pre;
-    TokenNode *tok;
+    TokenIndex tok;
     PreTokenNode newline_node, one_node;
+#ifdef WITH_LUXAS
+    char *asm_buf;
+    size_t asm_size;
+#endif
     newline_node.token = PRE_TOK_NL;
     newline_node.lexeme = "\n";
+    newline_node.src_file = "<command line>";
+    newline_node.src_line = newline_node.src_column = 0;
+    newline_node.next_char = '\0';
+    newline_node.deleted = FALSE;
+    newline_node.next = NULL;
+    one_node = newline_node;
     one_node.token = PRE_TOK_NUM;
     one_node.lexeme = "1";
     one_node.next = &newline_node;
@@ -79,18 +116,39 @@ int main(int argc, char *argv[])
         case 'a':
             flags |= OPT_ANALYZE;
             break;
+        case 'c':
+            flags |= OPT_ASSEMBLE;
+            break;
         case 'D':
             if (argv[i][2] != '\0')
-                install_macro(SIMPLE_MACRO, argv[i]+2, &one_node, NULL);
+                install_macro(SIMPLE_MACRO, str_intern(argv[i]+2), &one_node, NULL);
             else if (argv[i+1] == NULL)
                 missing_arg(argv[i]);
             else
-                install_macro(SIMPLE_MACRO, argv[++i], &one_node, NULL);
+                install_macro(SIMPLE_MACRO, str_intern(argv[++i]), &one_node, NULL);
+            break;
+        case 'f': /* -ffunction-sections, -fdata-sections */
+            if (equal(argv[i]+2, "function-sections"))
+                function_sections = TRUE;
+            else if (equal(argv[i]+2, "data-sections"))
+                data_sections = TRUE;
+            else {
+                fprintf(stderr, "%s: unknown option `%s'\n", program_name, argv[i]);
+                exit(EXIT_FAILURE);
+            }
             break;
         case 'h':
             usage(stdout);
             printf("Run the driver with the `-h' option for more info\n");
             exit(EXIT_SUCCESS);
+        case 'H':
+            if (argv[i][2] != '\0')
+                set_pch_dir(argv[i]+2);
+            else if (argv[i+1] == NULL)
+                missing_arg(argv[i]);
+            else
+                set_pch_dir(argv[++i]);
+            break;
         case 'I':
             if (argv[i][2] != '\0')
                 add_angle_dir(argv[i]+2);
@@ -107,6 +165,24 @@ int main(int argc, char *argv[])
             else
                 add_quote_dir(argv[++i]);
             break;
+        case 'M': /* -MD, -MF<file>, -MT<target> */
+            if (argv[i][2] == 'D') {
+                flags |= OPT_WRITE_DEPS;
+            } else if (argv[i][2]=='F' || argv[i][2]=='T') {
+                char **arg;
+
+                arg = (argv[i][2] == 'F') ? &dep_path : &dep_target;
+                if (argv[i][3] != '\0')
+                    *arg = argv[i]+3;
+                else if (argv[i+1] == NULL)
+                    missing_arg(argv[i]);
+                else
+                    *arg = argv[++i];
+            } else {
+                fprintf(stderr, "%s: unknown option `%s'\n", program_name, argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'm': {
             char *targ;
 
@@ -189,30 +265,51 @@ int main(int argc, char *argv[])
 
     switch (flags & TARGET_MASK) {
     case OPT_VM32_TARGET:
-        install_macro(SIMPLE_MACRO, "__LuxVM__", &one_node, NULL);
+        install_macro(SIMPLE_MACRO, str_intern("__LuxVM__"), &one_node, NULL);
         break;
     case OPT_VM64_TARGET:
-        install_macro(SIMPLE_MACRO, "__LuxVM__", &one_node, NULL);
-        install_macro(SIMPLE_MACRO, "__LP64__", &one_node, NULL);
+        install_macro(SIMPLE_MACRO, str_intern("__LuxVM__"), &one_node, NULL);
+        install_macro(SIMPLE_MACRO, str_intern("__LP64__"), &one_node, NULL);
         targeting_arch64 = TRUE;
         break;
     case OPT_X64_TARGET:
-        install_macro(SIMPLE_MACRO, "__x86_64__", &one_node, NULL);
-        install_macro(SIMPLE_MACRO, "__LP64__", &one_node, NULL);
+        install_macro(SIMPLE_MACRO, str_intern("__x86_64__"), &one_node, NULL);
+        install_macro(SIMPLE_MACRO, str_intern("__LP64__"), &one_node, NULL);
         targeting_arch64 = TRUE;
         break;
     default:
         flags |= OPT_X86_TARGET;
-        install_macro(SIMPLE_MACRO, "__i386__", &one_node, NULL);
+        install_macro(SIMPLE_MACRO, str_intern("__i386__"), &one_node, NULL);
         break;
     }
 
+    /* `-o -' names the standard output (the default) */
+    if (outpath!=NULL && equal(outpath, "-")) {
+        if (flags & OPT_ASSEMBLE) {
+            fprintf(stderr, "%s: cannot write an object file to the standard output\n", program_name);
+            exit(EXIT_FAILURE);
+        }
+        outpath = NULL;
+    }
+
+    if (flags & OPT_ASSEMBLE) {
+#ifdef WITH_LUXAS
+        if (!(flags & (OPT_X86_TARGET|OPT_X64_TARGET))) {
+            fprintf(stderr, "%s: option `-c' requires an x86 or x64 target\n", program_name);
+            exit(EXIT_FAILURE);
+        }
+#else
+        fprintf(stderr, "%s: option `-c' is not supported (built without luxas)\n", program_name);
+        exit(EXIT_FAILURE);
+#endif
+    }
+
     pre = preprocess(inpath);
     if (flags & OPT_PREPROCESS_ONLY) {
         PreTokenNode *p;
 
         fp = (outpath == NULL) ? stdout : fopen(outpath, "wb");
-        for (p = pre; p != NULL; p = p->next)
+        for (p = pre_get(pre); p != NULL; p = pre_get(p->next))
             if (!p->deleted || p->token==PRE_TOK_NL)
                 fprintf(fp, "%s ", p->lexeme);
         fprintf(fp, "\n");
@@ -221,14 +318,17 @@ int main(int argc, char *argv[])
 
     tok = tokenize(pre);
     if (flags & OPT_DUMP_TOKENS) {
-        TokenNode *p;
+        TokenIndex p;
         char *tok_outpath;
 
         tok_outpath = replace_extension(inpath, ".tok");
         fp = fopen(tok_outpath, "wb");
-        for (p = tok; p != NULL; p = p->next)
-            fprintf(fp, "%s:%d:%-3d =>   token: %-15s lexeme: `%s'\n", p->src_file, p->src_line,
-            p->src_column, token_table[p->token*2], p->lexeme);
+        for (p = tok; ; p = next_token(p)) {
+            fprintf(fp, "%s:%d:%-3d =>   token: %-15s lexeme: `%s'\n", tok_src_file(p), tok_src_line(p),
+            tok_src_column(p), token_table[tok_kind(p)*2], tok_lexeme(p));
+            if (tok_kind(p) == TOK_EOF)
+                break;
+        }
         free(tok_outpath);
         fclose(fp);
     }
@@ -247,6 +347,11 @@ int main(int argc, char *argv[])
         goto done;
 
     if (error_count == 0) {
+#ifdef WITH_LUXAS
+        if (flags & OPT_ASSEMBLE)
+            fp = open_memstream(&asm_buf, &asm_size);
+        else
+#endif
         fp = (outpath == NULL) ? stdout : fopen(outpath, "wb");
         switch (flags & TARGET_MASK) {
         case OPT_X86_TARGET:
@@ -259,6 +364,20 @@ int main(int argc, char *argv[])
                 x86_cgen(fp);
             else
                 x64_cgen(fp);
+#ifdef WITH_LUXAS
+            if (flags & OPT_ASSEMBLE) {
+                char *obj_path;
+
+                fclose(fp);
+                fp = NULL;
+                obj_path = (outpath == NULL) ? replace_extension(inpath, ".o") : outpath;
+                if (run_luxas(asm_buf, inpath, obj_path, (flags&TARGET_MASK)==OPT_X64_TARGET))
+                    ++error_count;
+                if (outpath == NULL)
+                    free(obj_path);
+                free(asm_buf);
+            }
+#endif
 
             if (ic_function_to_print != NULL) free(ic_outpath);
             if (cfg_outpath != NULL)          free(cfg_outpath);
@@ -277,10 +396,32 @@ int main(int argc, char *argv[])
 done:
     if (fp!=NULL && fp!=stdout)
         fclose(fp);
+    if ((flags & OPT_WRITE_DEPS) && error_count==0) {
+        char *target;
+
+        target = (dep_target != NULL) ? dep_target
+               : (outpath != NULL) ? outpath : replace_extension(inpath, ".o");
+        if (dep_path == NULL)
+            dep_path = replace_extension(target, ".d");
+        if ((fp=fopen(dep_path, "wb")) == NULL) {
+            fprintf(stderr, "%s: cannot write dependency file `%s'\n", program_name, dep_path);
+            return 1;
+        }
+        pre_write_deps(fp, target, inpath);
+        fclose(fp);
+    }
     if (flags & OPT_SHOW_STATS) {
-        printf("\n=> '%u' preprocessing tokens were created (aprox)\n", stat_number_of_pre_tokens);
-        printf("=> '%u' C tokens were created (aprox)\n", stat_number_of_c_tokens);
-        printf("=> '%u' AST nodes were created (aprox)\n", stat_number_of_ast_nodes);
+        FILE *sfp;
+
+        /* keep the statistics out of the output when it goes to stdout (e.g. a pipe to the assembler) */
+        sfp = (outpath == NULL) ? stderr : stdout;
+        fprintf(sfp, "\n=> '%u' preprocessing tokens were created (aprox)\n", stat_number_of_pre_tokens);
+        fprintf(sfp, "=> '%u' #includes were skipped (include guard or #pragma once)\n", stat_number_of_skipped_includes);
+        fprintf(sfp, "=> '%u' precompiled headers were used\n", stat_number_of_pch_hits);
+        fprintf(sfp, "=> '%u' C tokens were created (aprox)\n", stat_number_of_c_tokens);
+        fprintf(sfp, "=> '%u' AST nodes were created (aprox)\n", stat_number_of_ast_nodes);
+        if (flags & (OPT_X86_TARGET|OPT_X64_TARGET))
+            peep_print_stats(sfp);
     }
     return !!error_count;
 }
@@ -7,12 +7,16 @@ extern int disable_warnings;
 extern int colored_diagnostics;
 extern int targeting_arch64;
 extern int include_liblux;
+extern int function_sections;
+extern int data_sections;
 extern char *cg_outpath;
 extern char *cfg_outpath;
 extern char *cfg_function_to_print;
 extern char *ic_outpath;
 extern char *ic_function_to_print;
 extern unsigned stat_number_of_pre_tokens;
+extern unsigned stat_number_of_skipped_includes;
+extern unsigned stat_number_of_pch_hits;
 extern unsigned stat_number_of_c_tokens;
 extern unsigned stat_number_of_ast_nodes;
 
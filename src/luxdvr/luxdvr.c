@@ -10,6 +10,11 @@
 #include <assert.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
 #include "../util.h"
 #include "../str.h"
 
@@ -22,7 +27,12 @@ char helpstr[] =
     "  -E               Preprocess only\n"
     "  -S               Compile but do not assemble\n"
     "  -c               Compile and assemble but do not link\n"
+    "  -j<n>            Run up to <n> compile/assemble jobs at once\n"
     "  -v               Show invoked commands\n"
+    "  -gc-sections     Drop unused functions and objects when linking (x86/x64)\n"
+    "  -cache-dir<dir>  Keep a cache of object files in <dir>\n"
+    "  -cache-size<n>   Limit the object cache to <n> MB (default: 64)\n"
+    "  -cache-stats     Show object cache hits and misses\n"
     "  -h               Print this help\n"
     "\nCompiler options:\n"
     "  -q               Disable all warnings\n"
@@ -31,7 +41,11 @@ char helpstr[] =
     "  -analyze         Perform static analysis only\n"
     "  -show-stats      Show compilation stats\n"
     "  -D<name>         Predefine <name> as a macro, with definition 1\n"
+    "  -pch-dir<dir>    Keep precompiled headers in <dir>\n"
     "  -uncolored       Print uncolored diagnostics\n"
+    "  -MD              Write the dependencies of each C file into a .d file\n"
+    "  -MF<file>        Write the dependencies into <file>\n"
+    "  -MT<target>      Use <target> as the target of the dependency rule\n"
     "  -dump-tokens     Dump program tokens\n"
     "  -dump-ast        Dump program AST\n"
     "  -dump-ic<func>   Dump intermediate code for function <func>\n"
@@ -54,6 +68,8 @@ enum {
     DVR_VM64_TARGET     = 0x040,
     DVR_X86_TARGET      = 0x080,
     DVR_X64_TARGET      = 0x100,
+    DVR_WRITE_DEPS      = 0x200,
+    DVR_DEP_TARGET      = 0x400,
 };
 #define DVR_TARGETS (DVR_VM32_TARGET+DVR_VM64_TARGET+DVR_X86_TARGET+DVR_X64_TARGET)
 
@@ -81,6 +97,16 @@ PathList *add_file(PathList *flist, PathList *newf)
     return flist;
 }
 
+PathList *add_path(PathList *flist, char *path)
+{
+    PathList *newf;
+
+    newf = malloc(sizeof(PathList));
+    newf->path = path;
+    newf->next = NULL;
+    return add_file(flist, newf);
+}
+
 char *strbuf(String *s)
 {
     char *buf;
@@ -93,6 +119,307 @@ char *strbuf(String *s)
     return buf;
 }
 
+/*
+ * Object cache (-cache-dir).
+ *
+ * The object file produced for a C file is stored in the cache directory
+ * under a key computed by hashing the identity of the compiler and the
+ * assembler (path, size and modification time), the options passed to
+ * them (that includes the target), and the preprocessed source. When the
+ * key of a C file is found, the cached object is copied to the output and
+ * neither the compiler nor the assembler are run. Objects are copied rather
+ * than hard-linked, because the assembler rewrites its output in place.
+ * If the compiler or the assembler cannot be located (e.g. they are run
+ * through PATH and are not found there), the cache is not used.
+ *
+ * The modification time of an entry is updated on every hit, and after each
+ * run the least recently used entries are removed until the cache fits in
+ * cache_max_size bytes. The file `stats' holds the accumulated number of
+ * hits and misses.
+ */
+char *cache_dir;
+unsigned long cache_max_size = 64*1024*1024;
+int cache_show_stats;
+unsigned cache_hits, cache_misses;
+
+/* 64-bit FNV-1a */
+unsigned long long hash_bytes(unsigned long long h, void *p, size_t n)
+{
+    unsigned char *cp;
+
+    if (h == 0)
+        h = 14695981039346656037ULL;
+    for (cp = p; n != 0; n--, cp++) {
+        h ^= *cp;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+unsigned long long hash_stream(unsigned long long h, FILE *fp)
+{
+    size_t n;
+    char buf[BUFSIZ];
+
+    rewind(fp);
+    while ((n=fread(buf, 1, sizeof(buf), fp)) > 0)
+        h = hash_bytes(h, buf, n);
+    return h;
+}
+
+/*
+ * Return the file that is executed when `prog' is invoked (looking
+ * for it in PATH if it has no slashes), or NULL if there is none.
+ */
+char *path_lookup(char *prog)
+{
+    char *path, *dir, *file;
+
+    if (strchr(prog, '/') != NULL)
+        return strdup(prog);
+    if ((path=getenv("PATH")) == NULL)
+        return NULL;
+    path = strdup(path);
+    file = NULL;
+    for (dir = strtok(path, ":"); dir != NULL; dir = strtok(NULL, ":")) {
+        file = malloc(strlen(dir)+strlen(prog)+2);
+        sprintf(file, "%s/%s", dir, prog);
+        if (access(file, X_OK) == 0)
+            break;
+        free(file);
+        file = NULL;
+    }
+    free(path);
+    return file;
+}
+
+/*
+ * Hash into `*h' the command line `cmd' and the identity of the program it
+ * invokes. Return FALSE if the identity of the program cannot be determined.
+ */
+int hash_cmd(unsigned long long *h, String *cmd)
+{
+    int ok;
+    char *buf, *prog, *file;
+    struct stat st;
+
+    buf = strbuf(cmd);
+    *h = hash_bytes(*h, buf, strlen(buf)+1);
+    prog = strdup(buf);
+    strtok(prog, " \t");
+    ok = FALSE;
+    if ((file=path_lookup(prog)) != NULL) {
+        if (stat(file, &st) == 0) {
+            *h = hash_bytes(*h, &st.st_size, sizeof(st.st_size));
+            *h = hash_bytes(*h, &st.st_mtime, sizeof(st.st_mtime));
+            ok = TRUE;
+        }
+        free(file);
+    }
+    free(prog);
+    return ok;
+}
+
+int copy_file(char *from, char *to)
+{
+    int ok;
+    size_t n;
+    FILE *in, *out;
+    char buf[BUFSIZ];
+
+    if ((in=fopen(from, "rb")) == NULL)
+        return FALSE;
+    if ((out=fopen(to, "wb")) == NULL) {
+        fclose(in);
+        return FALSE;
+    }
+    while ((n=fread(buf, 1, sizeof(buf), in)) > 0)
+        fwrite(buf, 1, n, out);
+    ok = !ferror(in);
+    fclose(in);
+    return (fclose(out)==0 && ok);
+}
+
+char *cache_entry(unsigned long long key)
+{
+    char *path;
+
+    path = malloc(strlen(cache_dir)+20);
+    sprintf(path, "%s/%016llx.o", cache_dir, key);
+    return path;
+}
+
+/* copy the cached object `entry' (if any) to `obj' */
+int cache_lookup(char *entry, char *obj)
+{
+    if (!file_exists(entry) || !copy_file(entry, obj))
+        return FALSE;
+    utime(entry, NULL);
+    return TRUE;
+}
+
+void cache_store(char *obj, char *entry)
+{
+    int fd;
+    char *tmp;
+
+    /* write into a temporary file first, so a concurrent lookup never sees a partial entry */
+    tmp = malloc(strlen(cache_dir)+16);
+    sprintf(tmp, "%s/tmpXXXXXX", cache_dir);
+    if ((fd=mkstemp(tmp)) != -1) {
+        close(fd);
+        if (copy_file(obj, tmp))
+            rename(tmp, entry);
+        else
+            unlink(tmp);
+    }
+    free(tmp);
+}
+
+/* create an empty temporary object file; return its name or NULL */
+static char *new_obj_tmp(void)
+{
+    int fd;
+    char *tmp;
+
+    tmp = strdup("/tmp/luxXXXXXX.o");
+    if ((fd=mkstemps(tmp, 2)) == -1) {
+        free(tmp);
+        return NULL;
+    }
+    close(fd);
+    return tmp;
+}
+
+typedef struct CacheEntry CacheEntry;
+struct CacheEntry {
+    char *path;
+    off_t size;
+    time_t mtime;
+};
+
+int cmp_cache_entry(const void *p1, const void *p2)
+{
+    time_t t1, t2;
+
+    t1 = ((CacheEntry *)p1)->mtime;
+    t2 = ((CacheEntry *)p2)->mtime;
+    return (t1 < t2) ? -1 : (t1 > t2);
+}
+
+/* remove the least recently used entries until the cache fits in cache_max_size */
+void cache_evict(void)
+{
+    DIR *dp;
+    struct dirent *de;
+    CacheEntry *entries;
+    unsigned i, n, max;
+    unsigned long long total;
+
+    if ((dp=opendir(cache_dir)) == NULL)
+        return;
+    n = 0, max = 64;
+    entries = malloc(max*sizeof(CacheEntry));
+    total = 0;
+    while ((de=readdir(dp)) != NULL) {
+        char *p;
+        struct stat st;
+
+        if ((p=strrchr(de->d_name, '.'))==NULL || !equal(p, ".o"))
+            continue;
+        if (n == max) {
+            max *= 2;
+            entries = realloc(entries, max*sizeof(CacheEntry));
+        }
+        entries[n].path = malloc(strlen(cache_dir)+strlen(de->d_name)+2);
+        sprintf(entries[n].path, "%s/%s", cache_dir, de->d_name);
+        if (stat(entries[n].path, &st) == -1) {
+            free(entries[n].path);
+            continue;
+        }
+        entries[n].size = st.st_size;
+        entries[n].mtime = st.st_mtime;
+        total += st.st_size;
+        ++n;
+    }
+    closedir(dp);
+    qsort(entries, n, sizeof(CacheEntry), cmp_cache_entry);
+    for (i = 0; i < n; i++) {
+        if (total > cache_max_size) {
+            unlink(entries[i].path);
+            total -= entries[i].size;
+        }
+        free(entries[i].path);
+    }
+    free(entries);
+}
+
+/* add the hits and misses of this run to the stats file */
+void cache_update_stats(void)
+{
+    FILE *fp;
+    char *path;
+    unsigned long hits, misses;
+
+    path = malloc(strlen(cache_dir)+8);
+    sprintf(path, "%s/stats", cache_dir);
+    hits = misses = 0;
+    if ((fp=fopen(path, "rb")) != NULL) {
+        if (fscanf(fp, "%lu %lu", &hits, &misses) != 2)
+            hits = misses = 0;
+        fclose(fp);
+    }
+    hits += cache_hits;
+    misses += cache_misses;
+    if ((fp=fopen(path, "wb")) != NULL) {
+        fprintf(fp, "%lu %lu\n", hits, misses);
+        fclose(fp);
+    }
+    free(path);
+    if (cache_show_stats) {
+        printf("cache: %u hits, %u misses (total: %lu hits, %lu misses)\n",
+        cache_hits, cache_misses, hits, misses);
+    }
+}
+
+/*
+ * Split the command line `cmd' at blanks and execute it directly (without
+ * /bin/sh) in a child process. The standard input/output/error of the child
+ * are redirected to the file descriptors `in'/`out'/`err' (-1 to inherit
+ * those of the driver).
+ */
+pid_t spawn_cmd(char *cmd, int in, int out, int err)
+{
+    pid_t pid;
+
+    if ((pid=fork()) == -1)
+        TERMINATE("%s: error: cannot fork", prog_name);
+    if (pid == 0) {
+        int argc;
+        char **argv, *buf, *cp;
+
+        buf = strdup(cmd);
+        for (argc = 2, cp = buf; *cp != '\0'; cp++)
+            if (isblank(*cp))
+                ++argc;
+        argv = malloc(argc*sizeof(char *));
+        argc = 0;
+        for (cp = strtok(buf, " \t"); cp != NULL; cp = strtok(NULL, " \t"))
+            argv[argc++] = cp;
+        argv[argc] = NULL;
+        if (in != -1)
+            dup2(in, STDIN_FILENO);
+        if (out != -1)
+            dup2(out, STDOUT_FILENO);
+        if (err != -1)
+            dup2(err, STDERR_FILENO);
+        execvp(argv[0], argv);
+        fprintf(stderr, "%s: error: cannot execute `%s'\n", prog_name, cmd);
+        _exit(127);
+    }
+    return pid;
+}
+
 int exec_cmd(String *cmd)
 {
     int status;
@@ -102,13 +429,187 @@ int exec_cmd(String *cmd)
     if (verbose)
         printf("%s\n", buf);
 
-    if ((status=system(buf)) == -1)
+    fflush(stdout);
+    if (waitpid(spawn_cmd(buf, -1, -1, -1), &status, 0) == -1)
         TERMINATE("%s: error: cannot execute `%s'", prog_name, buf);
     if (!WIFEXITED(status))
         exit(1);
     return WEXITSTATUS(status);
 }
 
+/*
+ * A job is the pipeline of commands that produces the output of one input
+ * file (e.g. luxcc writing the assembly to its standard output and luxas
+ * reading it from its standard input). All the commands of a job run at
+ * the same time, and the job fails if any of them fails; the output file
+ * of a failed job is removed. The diagnostics of a command that reads from
+ * a failed command are discarded (they would be about its truncated input).
+ * Up to max_jobs jobs run at the same time.
+ * When more than one job can run at a time, the output of each job is
+ * captured and then replayed in the order of the input files, so the
+ * diagnostics are the same as in a serial run.
+ */
+#define MAX_JOB_CMDS 2
+typedef struct Job Job;
+struct Job {
+    char *cmds[MAX_JOB_CMDS];
+    pid_t pids[MAX_JOB_CMDS];
+    int ncmds, nrunning;
+    int failed, upstream_failed;
+    char *output;       /* file produced by the job */
+    char *cache_entry;  /* where to store `output' in the object cache */
+    FILE *result;       /* if not NULL, receives the stdout of the last command */
+    FILE *out, *err;    /* captured output */
+    FILE *down_err;     /* captured stderr of the commands reading from a pipe */
+};
+int max_jobs = 1;
+
+void job_add_cmd(Job *job, String *cmd)
+{
+    assert(job->ncmds < MAX_JOB_CMDS);
+    job->cmds[job->ncmds++] = strdup(strbuf(cmd));
+}
+
+void job_start(Job *job)
+{
+    int i, in, out, err, fd[2];
+    FILE *vout;
+
+    vout = (job->out != NULL) ? job->out : stdout;
+    err = (job->err != NULL) ? fileno(job->err) : -1;
+    if (job->ncmds > 1) {
+        if ((job->down_err=tmpfile()) == NULL)
+            TERMINATE("%s: error: cannot create temporary file", prog_name);
+    }
+    in = -1;
+    for (i = 0; i < job->ncmds; i++) {
+        if (i == 1)
+            err = fileno(job->down_err);
+        if (verbose)
+            fprintf(vout, (i < job->ncmds-1) ? "%s | " : "%s\n", job->cmds[i]);
+        if (i < job->ncmds-1) {
+            /* close-on-exec, so only the dup2()'ed copies reach the children */
+            if (pipe(fd) == -1)
+                TERMINATE("%s: error: cannot create pipe", prog_name);
+            fcntl(fd[0], F_SETFD, FD_CLOEXEC);
+            fcntl(fd[1], F_SETFD, FD_CLOEXEC);
+            out = fd[1];
+        } else {
+            if (job->result != NULL)
+                out = fileno(job->result);
+            else
+                out = (job->out != NULL) ? fileno(job->out) : -1;
+        }
+        fflush(vout);
+        job->pids[i] = spawn_cmd(job->cmds[i], in, out, err);
+        if (in != -1)
+            close(in);
+        if (i < job->ncmds-1) {
+            close(fd[1]);
+            in = fd[0];
+        }
+    }
+    job->nrunning = job->ncmds;
+}
+
+void replay_output(FILE *from, FILE *to)
+{
+    int n;
+    char buf[BUFSIZ];
+
+    rewind(from);
+    while ((n=fread(buf, 1, sizeof(buf), from)) > 0)
+        fwrite(buf, 1, n, to);
+    fclose(from);
+}
+
+/* run the jobs; return the number of jobs that failed */
+int run_jobs(Job *jobs, int njobs)
+{
+    int i, j, next, running, nreplayed, nfailed;
+
+    fflush(stdout);
+    next = running = nreplayed = nfailed = 0;
+    while (next<njobs || running>0) {
+        int status;
+        pid_t pid;
+        Job *job;
+
+        /* start as many jobs as allowed */
+        for (; next<njobs && running<max_jobs; next++) {
+            job = &jobs[next];
+            if (max_jobs > 1) {
+                if ((job->out=tmpfile())==NULL || (job->err=tmpfile())==NULL)
+                    TERMINATE("%s: error: cannot create temporary file", prog_name);
+            }
+            if (job->ncmds == 0)
+                continue;
+            job_start(job);
+            ++running;
+        }
+
+        /* wait for some command to finish */
+        if (running > 0) {
+            if ((pid=waitpid(-1, &status, 0)) == -1)
+                TERMINATE("%s: error: waitpid() failed", prog_name);
+            job = NULL;
+            for (i = 0; i<next && job==NULL; i++)
+                for (j = 0; j < jobs[i].ncmds; j++)
+                    if (jobs[i].pids[j] == pid)
+                        job = &jobs[i];
+            if (job == NULL)
+                continue; /* not one of ours */
+            for (j = 0; job->pids[j] != pid; j++)
+                ;
+            job->pids[j] = 0;
+            if (WIFSIGNALED(status) && WTERMSIG(status)==SIGPIPE && j<job->ncmds-1) {
+                job->failed = TRUE; /* the reader went away; it reports the error itself */
+            } else if (!WIFEXITED(status)) {
+                fprintf((job->err!=NULL)?job->err:stderr, "%s: error: `%s' terminated abnormally\n",
+                prog_name, job->cmds[j]);
+                job->failed = TRUE;
+                if (j < job->ncmds-1)
+                    job->upstream_failed = TRUE;
+            } else if (WEXITSTATUS(status) != 0) {
+                job->failed = TRUE;
+                if (j < job->ncmds-1)
+                    job->upstream_failed = TRUE;
+            }
+            if (--job->nrunning == 0) {
+                if (job->down_err != NULL) {
+                    if (job->upstream_failed)
+                        fclose(job->down_err);
+                    else
+                        replay_output(job->down_err, (job->err!=NULL)?job->err:stderr);
+                    job->down_err = NULL;
+                }
+                if (job->failed && job->output!=NULL)
+                    unlink(job->output);
+                else if (!job->failed && job->cache_entry!=NULL)
+                    cache_store(job->output, job->cache_entry);
+                --running;
+            }
+        }
+
+        /* replay the output of the jobs that are done, in order */
+        for (; nreplayed<next && jobs[nreplayed].nrunning==0; nreplayed++) {
+            job = &jobs[nreplayed];
+            if (job->out != NULL) {
+                replay_output(job->out, stdout);
+                replay_output(job->err, stderr);
+                fflush(stdout);
+            }
+            if (job->failed)
+                ++nfailed;
+            for (i = 0; i < job->ncmds; i++)
+                free(job->cmds[i]);
+            free(job->output);
+            free(job->cache_entry);
+        }
+    }
+    return nfailed;
+}
+
 int is_in_path(char *exe)
 {
     char cmd[64];
@@ -229,11 +730,13 @@ int main(int argc, char *argv[])
 {
     int i, exst;
     unsigned driver_flags;
-    char *outpath, *alt_asm_tmp, *p;
+    char *outpath, *p;
     String *cc_cmd, *as_cmd, *ld_cmd;
-    PathList *c_files, *asm_files, *other_files;
-    char asm_tmp[] = "/tmp/luxXXXXXX.s";
-    char obj_tmp[] = "/tmp/luxXXXXXX.o";
+    PathList *c_files, *asm_files, *other_files, *obj_files, *fi;
+    Job *jobs;
+    int njobs, ntmp;
+    char **tmps;
+    unsigned cpos, apos;
 
     prog_name = argv[0];
     if (argc == 1) {
@@ -243,8 +746,11 @@ int main(int argc, char *argv[])
 
     driver_flags = 0;
     driver_flags |= DVR_X86_TARGET;
-    outpath = alt_asm_tmp = NULL;
-    c_files = asm_files = other_files = NULL;
+    outpath = NULL;
+    c_files = asm_files = other_files = obj_files = NULL;
+    jobs = NULL;
+    tmps = NULL;
+    ntmp = 0;
     cc_cmd = string_new(32); string_printf(cc_cmd, "");
     as_cmd = string_new(32); string_printf(as_cmd, "");
     ld_cmd = string_new(32); string_printf(ld_cmd, "");
@@ -277,6 +783,7 @@ int main(int argc, char *argv[])
                 dump-cfg    -> G
                 dump-cg     -> C
                 dump-ic     -> N
+                pch-dir     -> H
              The rest of the options are equal to both.
             */
             case 'a':
@@ -285,25 +792,45 @@ int main(int argc, char *argv[])
                     driver_flags |= DVR_ANALYZE_ONLY;
                 } else if (strncmp(argv[i], "-alt-asm-tmp", 12) == 0) {
                     /*
-                     * This option is only used when self-compiling in x86/x64.
-                     * It is necessary because otherwise the temporary asm file
-                     * name that will be embedded into the object files will be
-                     * different from one invocation to the other and the comparison
-                     * of binaries will fail.
+                     * Obsolete. The assembly is now piped into the assembler, so
+                     * there is no temporary asm file whose name could end up
+                     * embedded into the object files. Accepted (and ignored)
+                     * for compatibility.
                      */
                     if (argv[i][12] == '\0') {
                         if (argv[i+1] == NULL)
                             missing_arg(argv[i]);
-                        alt_asm_tmp = argv[++i];
-                    } else {
-                        alt_asm_tmp = argv[i]+12;
+                        ++i;
                     }
                 } else {
                     unknown_opt(argv[i]);
                 }
                 break;
             case 'c':
-                driver_flags |= DVR_NOLINK;
+                if (argv[i][2] == '\0') {
+                    driver_flags |= DVR_NOLINK;
+                } else if (strncmp(argv[i], "-cache-dir", 10) == 0) {
+                    if (argv[i][10] == '\0') {
+                        if (argv[i+1] == NULL)
+                            missing_arg(argv[i]);
+                        cache_dir = argv[++i];
+                    } else {
+                        cache_dir = argv[i]+10;
+                    }
+                } else if (strncmp(argv[i], "-cache-size", 11) == 0) {
+                    if (argv[i][11] == '\0') {
+                        if (argv[i+1] == NULL)
+                            missing_arg(argv[i]);
+                        p = argv[++i];
+                    } else {
+                        p = argv[i]+11;
+                    }
+                    cache_max_size = strtoul(p, NULL, 10)*1024*1024;
+                } else if (equal(argv[i], "-cache-stats")) {
+                    cache_show_stats = TRUE;
+                } else {
+                    unknown_opt(argv[i]);
+                }
                 break;
             case 'd':
                 if (equal(argv[i], "-dump-tokens")) {
@@ -361,9 +888,29 @@ int main(int argc, char *argv[])
                     break;
                 }
                 break;
+            case 'g':
+                if (equal(argv[i], "-gc-sections")) {
+                    /* one section per function/object, so the linker can drop the unused ones */
+                    string_printf(cc_cmd, " -ffunction-sections -fdata-sections");
+                    string_printf(ld_cmd, " --gc-sections");
+                } else {
+                    unknown_opt(argv[i]);
+                }
+                break;
             case 'h':
                 driver_flags |= DVR_HELP;
                 break;
+            case 'j':
+                if (argv[i][2] == '\0') {
+                    if (argv[i+1] == NULL)
+                        missing_arg(argv[i]);
+                    max_jobs = atoi(argv[++i]);
+                } else {
+                    max_jobs = atoi(argv[i]+2);
+                }
+                if (max_jobs < 1)
+                    TERMINATE("%s: invalid number of jobs `%s'", prog_name, argv[i]);
+                break;
             case 'I':
             case 'i':
                 string_printf(cc_cmd, " %s", argv[i]);
@@ -373,6 +920,23 @@ int main(int argc, char *argv[])
                     string_printf(cc_cmd, " %s", argv[++i]);
                 }
                 break;
+            case 'M':
+                if (equal(argv[i], "-MD")) {
+                    driver_flags |= DVR_WRITE_DEPS;
+                    string_printf(cc_cmd, " -MD");
+                } else if (argv[i][2]=='F' || argv[i][2]=='T') {
+                    if (argv[i][2] == 'T')
+                        driver_flags |= DVR_DEP_TARGET;
+                    string_printf(cc_cmd, " %s", argv[i]);
+                    if (argv[i][3] == '\0') {
+                        if (argv[i+1] == NULL)
+                            missing_arg(argv[i]);
+                        string_printf(cc_cmd, " %s", argv[++i]);
+                    }
+                } else {
+                    unknown_opt(argv[i]);
+                }
+                break;
             case 'm': {
                 char *m;
 
@@ -405,6 +969,20 @@ int main(int argc, char *argv[])
                 if (outpath == NULL)
                     missing_arg("-o");
                 break;
+            case 'p':
+                if (strncmp(argv[i], "-pch-dir", 8) == 0) {
+                    string_printf(cc_cmd, " -H");
+                    if (argv[i][8] == '\0') {
+                        if (argv[i+1] == NULL)
+                            missing_arg(argv[i]);
+                        string_printf(cc_cmd, " %s", argv[++i]);
+                    } else {
+                        string_printf(cc_cmd, " %s", argv[i]+8);
+                    }
+                } else {
+                    unknown_opt(argv[i]);
+                }
+                break;
             case 'q':
                 string_printf(cc_cmd, " %s", argv[i]);
                 break;
@@ -447,6 +1025,10 @@ err_1:
         goto done;
     }
 ok_1:
+    /* with -c, the dependency target is the object file and not the assembly luxcc writes */
+    if ((driver_flags & DVR_WRITE_DEPS) && outpath!=NULL && (driver_flags & DVR_NOLINK)
+    && !(driver_flags & (DVR_DEP_TARGET|DVR_PREP_ONLY|DVR_COMP_ONLY)))
+        string_printf(cc_cmd, " -MT %s", outpath);
     exst = 0;
     if (driver_flags & DVR_HELP) {
         usage(FALSE);
@@ -501,137 +1083,155 @@ ok_1:
         exst = 1;
         goto done;
     }
+    njobs = 0;
+    for (fi = c_files; fi != NULL; fi = fi->next)
+        ++njobs;
+    for (fi = asm_files; fi != NULL; fi = fi->next)
+        ++njobs;
+    jobs = calloc(njobs+1, sizeof(Job));
+    tmps = calloc(njobs+1, sizeof(char *));
+    njobs = ntmp = 0;
+    cpos = string_get_pos(cc_cmd);
+    apos = string_get_pos(as_cmd);
     if (driver_flags & DVR_ANALYZE_ONLY) {
-        PathList *fi;
-        unsigned pos;
-
         if (c_files == NULL)
             goto done;
-        pos = string_get_pos(cc_cmd);
         for (fi = c_files; fi != NULL; fi = fi->next) {
             string_printf(cc_cmd, " %s", fi->path);
-            if (exec_cmd(cc_cmd))
-                exst = 1;
-            string_set_pos(cc_cmd, pos);
+            job_add_cmd(&jobs[njobs++], cc_cmd);
+            string_set_pos(cc_cmd, cpos);
         }
+        exst = !!run_jobs(jobs, njobs);
     } else if (driver_flags & (DVR_PREP_ONLY|DVR_COMP_ONLY)) {
         if (c_files == NULL)
             goto done;
         if (outpath != NULL) { /* there is a single C input file */
             string_printf(cc_cmd, " %s -o %s", c_files->path, outpath);
-            exst = !!exec_cmd(cc_cmd);
+            job_add_cmd(&jobs[njobs++], cc_cmd);
         } else {
-            PathList *fi;
-            unsigned pos;
-
-            pos = string_get_pos(cc_cmd);
             for (fi = c_files; fi != NULL; fi = fi->next) {
                 string_printf(cc_cmd, " %s", fi->path);
-                if (exec_cmd(cc_cmd))
-                    exst = 1;
-                string_set_pos(cc_cmd, pos);
+                job_add_cmd(&jobs[njobs++], cc_cmd);
+                string_set_pos(cc_cmd, cpos);
             }
         }
-    } else if (driver_flags & DVR_NOLINK) {
-        if (c_files==NULL && asm_files==NULL)
+        exst = !!run_jobs(jobs, njobs);
+    } else {
+        char *s;
+        int link;
+        Job *preps;
+        unsigned long long tools_key;
+
+        preps = NULL;
+        tools_key = 0;
+        link = !(driver_flags & DVR_NOLINK);
+        if (c_files==NULL && asm_files==NULL && !link)
             goto done;
-        if (c_files != NULL)
-            mkstemps(asm_tmp, 2);
-        if (outpath != NULL) { /* there is a single C/ASM input file */
-            if (c_files != NULL) {
-                string_printf(cc_cmd, " %s -o %s", c_files->path, asm_tmp);
-                if (exec_cmd(cc_cmd) == 0) {
-                    string_printf(as_cmd, " %s -o %s", asm_tmp, outpath);
-                    exst = !!exec_cmd(as_cmd);
-                } else {
-                    exst = 1;
-                }
-            } else {
-                string_printf(as_cmd, " %s -o %s", asm_files->path, outpath);
-                exst = !!exec_cmd(as_cmd);
+
+        /* C files: preprocess them to compute their object cache keys */
+        if (cache_dir!=NULL && (!hash_cmd(&tools_key, cc_cmd) || !hash_cmd(&tools_key, as_cmd))) {
+            fprintf(stderr, "%s: warning: cannot locate the compiler or the assembler; object cache disabled\n", prog_name);
+            cache_dir = NULL;
+        }
+        if (cache_dir != NULL) {
+            mkdir(cache_dir, 0777);
+            for (fi = c_files, i = 0; fi != NULL; fi = fi->next)
+                ++i;
+            preps = calloc(i+1, sizeof(Job));
+            for (fi = c_files, i = 0; fi != NULL; fi = fi->next, i++) {
+                string_printf(cc_cmd, " -p -q %s", fi->path);
+                job_add_cmd(&preps[i], cc_cmd);
+                if ((preps[i].result=tmpfile()) == NULL)
+                    TERMINATE("%s: error: cannot create temporary file", prog_name);
+                string_set_pos(cc_cmd, cpos);
             }
-        } else {
-            char *s;
-            PathList *fi;
-            unsigned cpos, apos;
+            exst = !!run_jobs(preps, i);
+        }
 
-            cpos = string_get_pos(cc_cmd);
-            apos = string_get_pos(as_cmd);
-            for (fi = c_files; fi != NULL; fi = fi->next) {
-                string_printf(cc_cmd, " %s -o %s", fi->path, asm_tmp);
-                if (exec_cmd(cc_cmd) == 0) {
-                    s = replace_extension(fi->path, ".o");
-                    string_printf(as_cmd, " %s -o %s", asm_tmp, s);
-                    free(s);
-                    if (exec_cmd(as_cmd))
-                        exst = 1;
-                    string_set_pos(as_cmd, apos);
-                } else {
+        /* C files: reuse a cached object, or compile and pipe the generated assembly into the assembler */
+        for (fi = c_files, i = 0; fi != NULL; fi = fi->next, i++) {
+            char *entry;
+
+            entry = NULL;
+            if (preps != NULL) {
+                if (!preps[i].failed)
+                    entry = cache_entry(hash_stream(tools_key, preps[i].result));
+                fclose(preps[i].result);
+                if (entry == NULL)
+                    continue; /* the preprocessor already reported the errors */
+            }
+            if (link) {
+                if ((s=new_obj_tmp()) == NULL) {
+                    fprintf(stderr, "%s: error: cannot create temporary file\n", prog_name);
+                    free(entry);
+                    free(preps);
                     exst = 1;
+                    goto done;
                 }
-                string_set_pos(cc_cmd, cpos);
-            }
-            for (fi = asm_files; fi != NULL; fi = fi->next) {
+                tmps[ntmp++] = s;
+            } else if (outpath != NULL) { /* there is a single C/ASM input file */
+                s = outpath;
+            } else {
                 s = replace_extension(fi->path, ".o");
-                string_printf(as_cmd, " %s -o %s", fi->path, s);
-                free(s);
-                if (exec_cmd(as_cmd))
-                    exst = 1;
-                string_set_pos(as_cmd, apos);
             }
-        }
-        if (c_files != NULL)
-            unlink(asm_tmp);
-    } else {
-        int ntmp;
-        char *obj_tmps[64];
-        unsigned cpos, apos;
-        char *asm_tmp_p;
-        PathList *fi;
-
-        if (c_files != NULL) {
-            if (alt_asm_tmp != NULL) {
-                asm_tmp_p = alt_asm_tmp;
+            if (entry!=NULL && cache_lookup(entry, s)) {
+                ++cache_hits;
+                free(entry);
             } else {
-                asm_tmp_p = asm_tmp;
-                mkstemps(asm_tmp_p, 2);
+                if (entry != NULL)
+                    ++cache_misses;
+                string_printf(cc_cmd, " %s", fi->path);
+                job_add_cmd(&jobs[njobs], cc_cmd);
+                string_printf(as_cmd, " - -o %s", s);
+                job_add_cmd(&jobs[njobs], as_cmd);
+                jobs[njobs].cache_entry = entry;
+                jobs[njobs++].output = strdup(s);
+                string_set_pos(cc_cmd, cpos);
+                string_set_pos(as_cmd, apos);
             }
+            if (link)
+                obj_files = add_path(obj_files, s);
+            else if (s != outpath)
+                free(s);
         }
-        ntmp = 0;
-        cpos = string_get_pos(cc_cmd);
-        apos = string_get_pos(as_cmd);
-        for (fi = c_files; fi != NULL; fi = fi->next) {
-            string_printf(cc_cmd, " %s -o %s", fi->path, asm_tmp_p);
-            if (exec_cmd(cc_cmd) == 0) {
-                sprintf(obj_tmp, "/tmp/luxXXXXXX.o");
-                mkstemps(obj_tmp, 2);
-                obj_tmps[ntmp++] = strdup(obj_tmp);
-                string_printf(as_cmd, " %s -o %s", asm_tmp_p, obj_tmp);
-                if (exec_cmd(as_cmd))
+        free(preps);
+
+        /* ASM files: assemble */
+        for (fi = asm_files; fi != NULL; fi = fi->next) {
+            if (link) {
+                if ((s=new_obj_tmp()) == NULL) {
+                    fprintf(stderr, "%s: error: cannot create temporary file\n", prog_name);
                     exst = 1;
-                string_set_pos(as_cmd, apos);
+                    goto done;
+                }
+                tmps[ntmp++] = s;
+            } else if (outpath != NULL) {
+                s = outpath;
             } else {
-                exst = 1;
+                s = replace_extension(fi->path, ".o");
             }
-            string_set_pos(cc_cmd, cpos);
-        }
-        for (fi = asm_files; fi != NULL; fi = fi->next) {
-            sprintf(obj_tmp, "/tmp/luxXXXXXX.o");
-            mkstemps(obj_tmp, 2);
-            obj_tmps[ntmp++] = strdup(obj_tmp);
-            string_printf(as_cmd, " %s -o %s", fi->path, obj_tmps);
-            if (exec_cmd(as_cmd))
-                exst = 1;
+            string_printf(as_cmd, " %s -o %s", fi->path, s);
+            job_add_cmd(&jobs[njobs], as_cmd);
+            jobs[njobs++].output = strdup(s);
+            if (link)
+                obj_files = add_path(obj_files, s);
+            else if (s != outpath)
+                free(s);
             string_set_pos(as_cmd, apos);
         }
-        if (exst == 0) {
-            PathList *fp;
 
+        if (run_jobs(jobs, njobs))
+            exst = 1;
+        if (cache_dir != NULL) {
+            cache_evict();
+            cache_update_stats();
+        }
+        if (exst==0 && link) {
             /* TOFIX: the order of the files should remain the same */
-            for (i = 0; i < ntmp; i++)
-                string_printf(ld_cmd, " %s", obj_tmps[i]);
-            for (fp = other_files; fp != NULL; fp = fp->next)
-                string_printf(ld_cmd, " %s", fp->path);
+            for (fi = obj_files; fi != NULL; fi = fi->next)
+                string_printf(ld_cmd, " %s", fi->path);
+            for (fi = other_files; fi != NULL; fi = fi->next)
+                string_printf(ld_cmd, " %s", fi->path);
             if (outpath != NULL)
                 string_printf(ld_cmd, " -o %s", outpath);
             if (driver_flags & (DVR_X86_TARGET+DVR_X64_TARGET)) {
@@ -643,14 +1243,19 @@ ok_1:
             }
             exst = !!exec_cmd(ld_cmd);
         }
-        if (alt_asm_tmp==NULL && c_files!=NULL)
-            unlink(asm_tmp_p);
-        for (i = 0; i < ntmp; i++) {
-            unlink(obj_tmps[i]);
-            free(obj_tmps[i]);
-        }
     }
 done:
+    for (i = 0; i < ntmp; i++) {
+        unlink(tmps[i]);
+        free(tmps[i]);
+    }
+    free(tmps);
+    free(jobs);
+    while (obj_files != NULL) {
+        fi = obj_files;
+        obj_files = obj_files->next;
+        free(fi);
+    }
     if (c_files != NULL) {
         PathList *tmp;
         do {
@@ -27,6 +27,12 @@
 #include <ar.h>
 #include <assert.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include "../util.h"
 #include "../arena.h"
 #include "../luxas/ELF_util.h"
@@ -37,8 +43,9 @@
 #define MAX_SEC_PER_SEG     32
 #define PAGE_SIZE           0x1000
 #define PAGE_MASK           (PAGE_SIZE-1)
-#define HASH_SIZE           1009
-#define HASH(s)             (hash(s)%HASH_SIZE)
+#ifndef IOV_MAX
+#define IOV_MAX             1024
+#endif
 
 typedef unsigned char bool;
 typedef struct Symbol Symbol;
@@ -57,6 +64,9 @@ struct ObjFile { /* simple relocatable object file */
     int nsym;           /* # of symbol table entries */
     char *shstrtab;     /* Section name string table */
     char *strtab;       /* String table */
+    Symbol **syms;      /* global symbol of each symtab entry (NULL for locals) */
+    bool *live;         /* sections reachable from the roots (--gc-sections) */
+    Elf32_Half *relsec; /* relocation section of each section (--gc-sections) */
     ObjFile *next;
 } *object_files;
 
@@ -110,7 +120,12 @@ struct Symbol {
     bool in_dynsym;
     Elf32_Half shndx;   /* index into input file's section header table */
     char *shname;
+    Elf32_Sym *dynent;  /* definition in a shared object (undefined symbols only) */
+    ObjFile *obj;       /* object file that defines the symbol */
+    bool discarded;     /* defined in a section removed by --gc-sections */
+    unsigned h;         /* hash value of name */
     Symbol *next;
+    Symbol *link;       /* next global symbol in order of definition */
 };
 
 Symbol *lookup_global_symbol(char *name);
@@ -118,6 +133,7 @@ char *entry_symbol = "_start";
 char *interp = "/lib/ld-linux.so.2";
 char *prog_name;
 char *fbuf[MAX_INPUT_FILES];
+unsigned fbuf_size[MAX_INPUT_FILES];
 int nfbuf;
 int nundef; /* # of undefined ('extern') symbols currently in the symtab */
 int nglobal;
@@ -132,10 +148,17 @@ CmpndSec *interp_sec;
 CmpndSec *reldyn_sec, *bss_sec;
 int nreldyn;
 Arena *mem_arena;
+bool gc_sections;
 Elf32_Half shndx = 4; /* [0]=UND, [1]=.shstrtab, [2]=.symtab, [3]=.strtab */
 
-/* Symbols that will go into the output file's symtab. */
-Symbol *global_symbols[HASH_SIZE];
+/*
+ * Symbols that will go into the output file's symtab.
+ * The global symbols hash table doubles its size when the number
+ * of symbols exceeds the number of buckets.
+ */
+Symbol **global_symbols;
+unsigned global_symtab_size;
+Symbol *first_global, **last_global = &first_global;
 Symbol *local_symbols; /* with type other than SECTION or FILE */
 
 const char plt0_asm_template[] =
@@ -167,24 +190,96 @@ void err_undef(char *sym)
     err("undefined reference to `%s'", sym);
 }
 
-char *read_file(char *path)
+/*
+ * Map the file at `path' into memory. The mapping is private, so the pages
+ * modified during the link (relocated sections, section headers, symbol
+ * tables) are copied on the first write and the rest is never copied.
+ */
+char *map_file(char *path, unsigned *size)
 {
-    FILE *fp;
+    int fd;
     char *buf;
-    unsigned len;
+    struct stat st;
 
-    if ((fp=fopen(path, "rb")) == NULL)
+    if ((fd=open(path, O_RDONLY)) == -1)
         return NULL;
-    fseek(fp, 0, SEEK_END);
-    len = ftell(fp);
-    rewind(fp);
-    buf = malloc(len+1);
-    len = fread(buf, 1, len, fp);
-    buf[len] = '\0';
-    fclose(fp);
+    if (fstat(fd, &st)==-1 || st.st_size==0) {
+        close(fd);
+        return NULL;
+    }
+    buf = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (buf == MAP_FAILED)
+        return NULL;
+    *size = st.st_size;
     return buf;
 }
 
+/*
+ * The output file is built as a list of memory chunks (the contents of the
+ * input sections are not copied) and written with writev() once complete.
+ */
+struct iovec *out_iov;
+int out_niov, out_max_iov;
+
+/* `p' must remain valid until the output is flushed */
+void out_write(void *p, unsigned n)
+{
+    if (n == 0)
+        return;
+    if (out_niov>0 && (char *)out_iov[out_niov-1].iov_base+out_iov[out_niov-1].iov_len==(char *)p) {
+        out_iov[out_niov-1].iov_len += n; /* contiguous with the previous chunk */
+        return;
+    }
+    if (out_niov >= out_max_iov) {
+        out_max_iov = out_max_iov ? out_max_iov*2 : 256;
+        out_iov = realloc(out_iov, out_max_iov*sizeof(struct iovec));
+    }
+    out_iov[out_niov].iov_base = p;
+    out_iov[out_niov].iov_len = n;
+    ++out_niov;
+}
+
+void out_copy(void *p, unsigned n)
+{
+    void *q;
+
+    q = arena_alloc(mem_arena, n);
+    memcpy(q, p, n);
+    out_write(q, n);
+}
+
+unsigned out_strtab(StrTab *tab)
+{
+    char *buf;
+    unsigned n;
+
+    n = strtab_get_size(tab);
+    buf = arena_alloc(mem_arena, n);
+    strtab_copy(tab, buf);
+    out_write(buf, n);
+    return n;
+}
+
+void out_flush(int fd)
+{
+    int i, n;
+    ssize_t nb, len;
+
+    for (i = 0; i < out_niov; i += n) {
+        int j;
+
+        n = (out_niov-i > IOV_MAX) ? IOV_MAX : out_niov-i;
+        for (j=i, len=0; j < i+n; j++)
+            len += out_iov[j].iov_len;
+        if ((nb=writev(fd, out_iov+i, n)) != len)
+            err("cannot write output file: %s", (nb == -1) ? strerror(errno) : "short write");
+    }
+    free(out_iov);
+    out_iov = NULL;
+    out_niov = out_max_iov = 0;
+}
+
 int be_atoi(char *s)
 {
     unsigned char *us = (unsigned char *)s;
@@ -262,6 +357,26 @@ SmplSec *new_smpl_sec(ObjFile *obj, Elf32_Shdr *hdr, char *data, SmplSec *next)
     return n;
 }
 
+/*
+ * Return the name of the output section that collects
+ * the input section `name' (e.g. ".text.foo" => ".text").
+ */
+char *output_section_name(char *name)
+{
+    static char *sys_secs[] = {
+        ".text", ".data", ".rodata", ".bss",
+        ".rel.text", ".rel.data", ".rel.rodata"
+    };
+    unsigned i, n;
+
+    for (i = 0; i < NELEMS(sys_secs); i++) {
+        n = strlen(sys_secs[i]);
+        if (strncmp(name, sys_secs[i], n)==0 && name[n]=='.')
+            return sys_secs[i];
+    }
+    return name;
+}
+
 void add_section(ObjFile *obj, char *name, Elf32_Shdr *hdr)
 {
     CmpndSec *sec;
@@ -473,6 +588,124 @@ void init_dynlink_sections(void)
     sections = sec;
 }
 
+/*
+ * Garbage collection of sections (--gc-sections).
+ * The roots are the section that defines the entry point, the sections
+ * that define symbols referenced by shared objects, the sections that
+ * are always kept (.init, .fini, ...), and the non-allocatable sections.
+ * Everything reachable from them through relocations is kept, the rest
+ * is left out of the output by init_sections().
+ */
+struct {
+    ObjFile *obj;
+    Elf32_Half shndx;
+} *gc_stack;
+int gc_top, gc_max;
+
+void gc_mark(ObjFile *obj, Elf32_Half shndx)
+{
+    if (shndx==SHN_UNDEF || shndx>=SHN_LORESERVE || obj->live[shndx])
+        return;
+    obj->live[shndx] = TRUE;
+    if (gc_top >= gc_max) {
+        gc_max = gc_max ? gc_max*2 : 256;
+        gc_stack = realloc(gc_stack, gc_max*sizeof(gc_stack[0]));
+    }
+    gc_stack[gc_top].obj = obj;
+    gc_stack[gc_top].shndx = shndx;
+    ++gc_top;
+}
+
+bool is_kept_section(char *name)
+{
+    static char *kept_secs[] = {
+        ".init", ".fini", ".ctors", ".dtors",
+        ".init_array", ".fini_array", ".preinit_array", ".jcr"
+    };
+    unsigned i, n;
+
+    for (i = 0; i < NELEMS(kept_secs); i++) {
+        n = strlen(kept_secs[i]);
+        if (strncmp(name, kept_secs[i], n)==0 && (name[n]=='\0' || name[n]=='.'))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+void gc_unused_sections(void)
+{
+    int i;
+    Symbol *sym;
+    ObjFile *obj;
+    ShrdObjFile *so;
+
+    for (obj = object_files; obj != NULL; obj = obj->next) {
+        Elf32_Shdr *shdr;
+
+        obj->live = calloc(obj->ehdr->e_shnum, sizeof(bool));
+        obj->relsec = calloc(obj->ehdr->e_shnum, sizeof(Elf32_Half));
+        shdr = obj->shtab+1;
+        for (i = 1; i < obj->ehdr->e_shnum; i++, shdr++)
+            if (shdr->sh_type == SHT_REL)
+                obj->relsec[shdr->sh_info] = i;
+    }
+
+    /* roots */
+    for (obj = object_files; obj != NULL; obj = obj->next) {
+        Elf32_Shdr *shdr;
+
+        shdr = obj->shtab+1;
+        for (i = 1; i < obj->ehdr->e_shnum; i++, shdr++) {
+            if (shdr->sh_type == SHT_REL)
+                continue;
+            if (!(shdr->sh_flags&SHF_ALLOC) || is_kept_section(obj->shstrtab+shdr->sh_name))
+                gc_mark(obj, i);
+        }
+    }
+    if ((sym=lookup_global_symbol(entry_symbol))!=NULL && sym->obj!=NULL)
+        gc_mark(sym->obj, sym->shndx);
+    for (so = shared_object_files; so != NULL; so = so->next) {
+        for (i = 1; i < so->nsym; i++) {
+            if (so->dynsym[i].st_shndx != SHN_UNDEF)
+                continue;
+            if ((sym=lookup_global_symbol(&so->dynstr[so->dynsym[i].st_name]))!=NULL && sym->obj!=NULL)
+                gc_mark(sym->obj, sym->shndx);
+        }
+    }
+
+    /* follow the relocations of the reachable sections */
+    while (gc_top > 0) {
+        int nrel;
+        Elf32_Rel *rel;
+        Elf32_Half r;
+
+        --gc_top;
+        obj = gc_stack[gc_top].obj;
+        if ((r=obj->relsec[gc_stack[gc_top].shndx]) == 0)
+            continue;
+        obj->live[r] = TRUE;
+        rel = (Elf32_Rel *)(obj->buf+obj->shtab[r].sh_offset);
+        nrel = obj->shtab[r].sh_size/sizeof(Elf32_Rel);
+        for (i = 0; i < nrel; i++, rel++) {
+            if ((sym=obj->syms[ELF32_R_SYM(rel->r_info)]) != NULL) {
+                if (sym->obj != NULL)
+                    gc_mark(sym->obj, sym->shndx);
+            } else {
+                gc_mark(obj, obj->symtab[ELF32_R_SYM(rel->r_info)].st_shndx);
+            }
+        }
+    }
+    free(gc_stack);
+
+    /* symbols defined in discarded sections don't go into the output */
+    for (sym = first_global; sym != NULL; sym = sym->link) {
+        if (sym->obj!=NULL && sym->shndx<SHN_LORESERVE && !sym->obj->live[sym->shndx]) {
+            sym->discarded = TRUE;
+            --nglobal;
+        }
+    }
+}
+
 void init_sections(void)
 {
     ObjFile *obj;
@@ -483,7 +716,8 @@ void init_sections(void)
 
         shdr = obj->shtab+1; /* skip SHN_UNDEF */
         for (i = 1; i < obj->ehdr->e_shnum; i++, shdr++)
-            add_section(obj, obj->shstrtab+shdr->sh_name, shdr);
+            if (!gc_sections || obj->live[i])
+                add_section(obj, output_section_name(obj->shstrtab+shdr->sh_name), shdr);
     }
     if (shared_object_files != NULL)
         init_dynlink_sections();
@@ -726,13 +960,36 @@ void init_segments(void)
     }
 }
 
-void define_global_symbol(char *name, Elf32_Addr value, unsigned char info, Elf32_Half shndx, char *shname)
+void grow_global_symtab(void)
+{
+    unsigned i, new_size;
+    Symbol **new_tab;
+
+    new_size = global_symtab_size ? global_symtab_size*2 : 1024;
+    new_tab = calloc(new_size, sizeof(Symbol *));
+    for (i = 0; i < global_symtab_size; i++) {
+        Symbol *np, *next;
+
+        for (np = global_symbols[i]; np != NULL; np = next) {
+            next = np->next;
+            np->next = new_tab[np->h&(new_size-1)];
+            new_tab[np->h&(new_size-1)] = np;
+        }
+    }
+    free(global_symbols);
+    global_symbols = new_tab;
+    global_symtab_size = new_size;
+}
+
+Symbol *define_global_symbol(ObjFile *obj, char *name, Elf32_Addr value, unsigned char info, Elf32_Half shndx, char *shname)
 {
     unsigned h;
     Symbol *np;
 
-    h = HASH(name);
-    for (np = global_symbols[h]; np != NULL; np = np->next)
+    if (global_symbols == NULL)
+        grow_global_symtab();
+    h = hash(name);
+    for (np = global_symbols[h&(global_symtab_size-1)]; np != NULL; np = np->next)
         if (equal(np->name, name))
             break;
     if (np == NULL) {
@@ -745,29 +1002,41 @@ void define_global_symbol(char *name, Elf32_Addr value, unsigned char info, Elf3
         np->in_dynsym = FALSE;
         if ((np->shndx=shndx) == SHN_UNDEF)
             ++nundef;
-        ++nglobal;
         np->shname = shname;
-        np->next = global_symbols[h];
-        global_symbols[h] = np;
+        np->dynent = NULL;
+        np->obj = (shndx != SHN_UNDEF) ? obj : NULL;
+        np->discarded = FALSE;
+        np->h = h;
+        np->next = global_symbols[h&(global_symtab_size-1)];
+        global_symbols[h&(global_symtab_size-1)] = np;
+        np->link = NULL;
+        *last_global = np;
+        last_global = &np->link;
+        if (++nglobal > global_symtab_size)
+            grow_global_symtab();
     } else if (np->shndx == SHN_UNDEF) {
         if (shndx != SHN_UNDEF) {
             np->value = value;
             np->info = info;
             np->shndx = shndx;
             np->shname = shname;
+            np->obj = obj;
             --nundef;
             assert(nundef >= 0);
         }
     } else if (shndx != SHN_UNDEF) {
         err("multiple definition of `%s'", name);
     }
+    return np;
 }
 
 Symbol *lookup_global_symbol(char *name)
 {
     Symbol *np;
 
-    for (np = global_symbols[HASH(name)]; np != NULL; np = np->next)
+    if (global_symbols == NULL)
+        return NULL;
+    for (np = global_symbols[hash(name)&(global_symtab_size-1)]; np != NULL; np = np->next)
         if (equal(np->name, name))
             break;
     return np;
@@ -804,9 +1073,13 @@ Elf32_Half get_shndx(Symbol *sym)
 /*
  * Install local symbols and assign final run-time addresses
  * to global symbols (build .dynsym and .hash in the process).
+ * Every undefined symbol is also mapped to its definition in
+ * a shared object, so relocations don't need to look up symbols
+ * by name.
  */
 void init_symtab(void)
 {
+    Symbol *sym;
     SmplSec *ssec;
     CmpndSec *csec;
     Elf32_Sym *sp;
@@ -822,6 +1095,9 @@ void init_symtab(void)
         return;
 
     if (shared_object_files != NULL) {
+        for (sym = first_global; sym != NULL; sym = sym->link)
+            if (sym->shndx == SHN_UNDEF)
+                sym->dynent = lookup_in_shared_object(sym->name);
         symndx = 1;
         sp = (Elf32_Sym *)dynsym_sec->sslist->data+1;
         nbucket = *(Elf32_Word *)hash_sec->sslist->data;
@@ -830,11 +1106,13 @@ void init_symtab(void)
     }
     for (ssec = csec->sslist; ssec != NULL; ssec = ssec->next) {
         int i, nsym;
+        Symbol **syms;
         Elf32_Sym *symtab;
         Elf32_Shdr *shtab;
         char *strtab, *shstrtab;
 
         nsym = ssec->shdr->sh_size/sizeof(Elf32_Sym);
+        syms = ssec->obj->syms;
         symtab = ssec->obj->symtab;
         shtab = ssec->obj->shtab;
         strtab = ssec->obj->strtab;
@@ -854,21 +1132,19 @@ void init_symtab(void)
                         define_local_symbol(&strtab[symtab[i].st_name], symtab[i].st_value,
                                             symtab[i].st_info, symtab[i].st_shndx,
                                             NULL);
-                    } else {
+                    } else if (!gc_sections || ssec->obj->live[symtab[i].st_shndx]) {
                         symtab[i].st_value += shtab[symtab[i].st_shndx].sh_addr;
                         define_local_symbol(&strtab[symtab[i].st_name], symtab[i].st_value,
                                             symtab[i].st_info, symtab[i].st_shndx,
-                                            &shstrtab[shtab[symtab[i].st_shndx].sh_name]);
+                                            output_section_name(&shstrtab[shtab[symtab[i].st_shndx].sh_name]));
                     }
                     break;
                 }
                 break;
 
-            case STB_GLOBAL: {
-                Symbol *sym;
-
-                sym = lookup_global_symbol(&strtab[symtab[i].st_name]);
-                assert(sym != NULL);
+            case STB_GLOBAL:
+                if ((sym=syms[i])->discarded)
+                    break;
                 if (symtab[i].st_shndx != SHN_UNDEF)
                     sym->value = shtab[symtab[i].st_shndx].sh_addr+symtab[i].st_value;
                 if (shared_object_files!=NULL && !sym->in_dynsym) {
@@ -884,7 +1160,6 @@ void init_symtab(void)
                     ++sp, ++symndx;
                     sym->in_dynsym = TRUE;
                 }
-            }
                 break;
 
             case STB_WEAK:
@@ -895,22 +1170,6 @@ void init_symtab(void)
     }
 }
 
-Elf32_Addr get_symval(char *name, Elf32_Sym *st_ent, bool *found)
-{
-    Symbol *sym;
-
-    *found = TRUE;
-    if (ELF32_ST_BIND(st_ent->st_info) == STB_LOCAL)
-        return st_ent->st_value;
-    sym = lookup_global_symbol(name);
-    assert(sym != NULL);
-    if (sym->shndx == SHN_UNDEF)
-        *found = FALSE;
-    else
-        return sym->value;
-    return 0;
-}
-
 void apply_relocs(void)
 {
     SmplSec *ssec;
@@ -921,29 +1180,34 @@ void apply_relocs(void)
             continue;
         for (ssec = csec->sslist; ssec != NULL; ssec = ssec->next) {
             int i, nrel;
+            Symbol **syms;
             Elf32_Sym *symtab;
             Elf32_Shdr *shtab;
             Elf32_Rel *rel;
-            char *strtab;
             char *buf;
 
             rel = (Elf32_Rel *)ssec->data;
             nrel = ssec->shdr->sh_size/sizeof(Elf32_Rel);
+            syms = ssec->obj->syms;
             symtab = ssec->obj->symtab;
             shtab = ssec->obj->shtab;
-            strtab = ssec->obj->strtab;
             buf = ssec->obj->buf;
 
             for (i = 0; i < nrel; i++, rel++) {
                 bool found;
                 void *dest;
-                char *symname;
+                Symbol *sym;
                 Elf32_Sym *syment;
                 Elf32_Word A, S, P;
 
                 dest = &buf[shtab[ssec->shdr->sh_info].sh_offset+rel->r_offset];
-                symname = &strtab[symtab[ELF32_R_SYM(rel->r_info)].st_name];
-                S = get_symval(symname, &symtab[ELF32_R_SYM(rel->r_info)], &found);
+                if ((sym=syms[ELF32_R_SYM(rel->r_info)]) == NULL) {
+                    S = symtab[ELF32_R_SYM(rel->r_info)].st_value;
+                    found = TRUE;
+                } else {
+                    S = sym->value;
+                    found = (sym->shndx != SHN_UNDEF);
+                }
 
                 switch (ELF32_R_TYPE(rel->r_info)) {
                 /* 386_X */
@@ -957,25 +1221,21 @@ void apply_relocs(void)
                     A = *(Elf32_Sword *)dest;
 r_386:              if (found) {
                         ;
-                    } else if ((syment=lookup_in_shared_object(symname)) != NULL) {
+                    } else if ((syment=sym->dynent) != NULL) {
                         if (ELF32_ST_TYPE(syment->st_info) == STT_FUNC) {
-                            Symbol *sym;
-
                             /* See 'Function Addresses' in the i386 psABI. */
-                            sym = lookup_global_symbol(symname);
-                            assert(sym != NULL);
                             if (sym->value == 0) {
-                                syment = &((Elf32_Sym *)dynsym_sec->sslist->data)[get_dynsym_ndx(symname)];
-                                syment->st_value = sym->value = get_plt_entry(symname);
+                                syment = &((Elf32_Sym *)dynsym_sec->sslist->data)[get_dynsym_ndx(sym->name)];
+                                syment->st_value = sym->value = get_plt_entry(sym->name);
                                 syment->st_info = sym->info = ELF32_ST_INFO(STB_GLOBAL, STT_FUNC);
                                 syment->st_shndx = sym->shndx = SHN_UNDEF;
                             }
                             S = sym->value;
                         } else {
-                            S = new_copy_reloc(symname, syment);
+                            S = new_copy_reloc(sym->name, syment);
                         }
                     } else {
-                        err_undef(symname);
+                        err_undef(sym->name);
                     }
                     switch (ELF32_R_TYPE(rel->r_info)) {
                     case R_386_8:
@@ -1002,13 +1262,13 @@ r_386:              if (found) {
 r_386_pc:           P = shtab[ssec->shdr->sh_info].sh_addr+rel->r_offset;
                     if (found) {
                         ;
-                    } else if ((syment=lookup_in_shared_object(symname)) != NULL) {
+                    } else if ((syment=sym->dynent) != NULL) {
                         if (ELF32_ST_TYPE(syment->st_info) == STT_FUNC)
-                            S = get_plt_entry(symname);
+                            S = get_plt_entry(sym->name);
                         else
-                            S = new_copy_reloc(symname, syment);
+                            S = new_copy_reloc(sym->name, syment);
                     } else {
-                        err_undef(symname);
+                        err_undef(sym->name);
                     }
                     switch (ELF32_R_TYPE(rel->r_info)) {
                     case R_386_PC8:
@@ -1038,7 +1298,7 @@ r_386_pc:           P = shtab[ssec->shdr->sh_info].sh_addr+rel->r_offset;
     }
 }
 
-void write_ELF_file(FILE *outf)
+void write_ELF_file(int fd)
 {
     int i;
     Symbol *sym;
@@ -1081,9 +1341,9 @@ void write_ELF_file(FILE *outf)
 
 #define ALIGN(n)\
     do {\
-        int nb = round_up(curr, n)-curr, i;\
-        for (i = 0; i < nb; i++)\
-            fputc(0, outf), ++curr;\
+        static char zeros[16];\
+        int nb = round_up(curr, n)-curr;\
+        out_write(zeros, nb), curr += nb;\
     } while (0)
 
     memset(&symtab_header, 0, sizeof(Elf32_Shdr));
@@ -1096,7 +1356,7 @@ void write_ELF_file(FILE *outf)
      * ================
      */
     memset(&ehdr, 0, sizeof(Elf32_Ehdr));
-    fwrite(&ehdr, sizeof(Elf32_Ehdr), 1, outf);
+    out_write(&ehdr, sizeof(Elf32_Ehdr));
     curr += sizeof(Elf32_Ehdr);
 
     /*
@@ -1113,17 +1373,17 @@ void write_ELF_file(FILE *outf)
         phdr.p_filesz = phdr.p_memsz = interp_sec->shdr.sh_size;
         phdr.p_flags = PF_R;
         phdr.p_align = 1;
-        fwrite(&phdr, sizeof(Elf32_Phdr), 1, outf);
+        out_copy(&phdr, sizeof(Elf32_Phdr));
         curr += sizeof(Elf32_Phdr);
         ++ehdr.e_phnum;
     }
     if (ROSeg.nsec) {
-        fwrite(&ROSeg.phdr, sizeof(Elf32_Phdr), 1, outf);
+        out_write(&ROSeg.phdr, sizeof(Elf32_Phdr));
         curr += sizeof(Elf32_Phdr);
         ++ehdr.e_phnum;
     }
     if (WRSeg.nsec) {
-        fwrite(&WRSeg.phdr, sizeof(Elf32_Phdr), 1, outf);
+        out_write(&WRSeg.phdr, sizeof(Elf32_Phdr));
         curr += sizeof(Elf32_Phdr);
         ++ehdr.e_phnum;
     }
@@ -1187,7 +1447,7 @@ void write_ELF_file(FILE *outf)
         phdr.p_filesz = phdr.p_memsz = dynamic_sec->shdr.sh_size;
         phdr.p_flags = PF_R|PF_W;
         phdr.p_align = 4;
-        fwrite(&phdr, sizeof(Elf32_Phdr), 1, outf);
+        out_copy(&phdr, sizeof(Elf32_Phdr));
         curr += sizeof(Elf32_Phdr);
         ++ehdr.e_phnum;
     }
@@ -1204,7 +1464,7 @@ void write_ELF_file(FILE *outf)
         SmplSec *ssec;
 
         for (ssec = ROSeg.secs[i]->sslist; ssec != NULL; ssec = ssec->next) {
-            fwrite(ssec->data, ssec->shdr->sh_size, 1, outf);
+            out_write(ssec->data, ssec->shdr->sh_size);
             curr += ssec->shdr->sh_size;
             ALIGN(4);
         }
@@ -1216,7 +1476,7 @@ void write_ELF_file(FILE *outf)
 
         if (WRSeg.secs[i]->shdr.sh_type != SHT_NOBITS) {
             for (ssec = WRSeg.secs[i]->sslist; ssec != NULL; ssec = ssec->next) {
-                fwrite(ssec->data, ssec->shdr->sh_size, 1, outf);
+                out_write(ssec->data, ssec->shdr->sh_size);
                 curr += ssec->shdr->sh_size;
                 ALIGN(4);
             }
@@ -1238,7 +1498,7 @@ void write_ELF_file(FILE *outf)
     symtab_header.sh_name = strtab_append(shstrtab, ".symtab");
     strtab_header.sh_name = strtab_append(shstrtab, ".strtab");
     shstrtab_header.sh_offset = curr;
-    shstrtab_header.sh_size = strtab_write(shstrtab, outf);
+    shstrtab_header.sh_size = out_strtab(shstrtab);
     curr += shstrtab_header.sh_size;
     ++ehdr.e_shnum;
 
@@ -1250,7 +1510,7 @@ void write_ELF_file(FILE *outf)
 
 #define WRITE_ST_ENT()\
     do {\
-        fwrite(&esym, sizeof(Elf32_Sym), 1, outf);\
+        out_copy(&esym, sizeof(Elf32_Sym));\
         curr += sizeof(Elf32_Sym);\
         symtab_header.sh_size += sizeof(Elf32_Sym);\
         ++symtab_header.sh_info;\
@@ -1303,22 +1563,18 @@ void write_ELF_file(FILE *outf)
 #undef WRITE_ST_ENT
 
     /* global symbols */
-    for (i = 0; i < HASH_SIZE; i++) {
-        Symbol *np;
-
-        if (global_symbols[i] == NULL)
+    for (sym = first_global; sym != NULL; sym = sym->link) {
+        if (sym->discarded)
             continue;
-        for (np = global_symbols[i]; np != NULL; np = np->next) {
-            memset(&esym, 0, sizeof(Elf32_Sym));
-            esym.st_name = strtab_append(strtab, np->name);
-            esym.st_value = np->value;
-            esym.st_size = np->size;
-            esym.st_info = np->info;
-            esym.st_shndx = get_shndx(np);
-            fwrite(&esym, sizeof(Elf32_Sym), 1, outf);
-            curr += sizeof(Elf32_Sym);
-            symtab_header.sh_size += sizeof(Elf32_Sym);
-        }
+        memset(&esym, 0, sizeof(Elf32_Sym));
+        esym.st_name = strtab_append(strtab, sym->name);
+        esym.st_value = sym->value;
+        esym.st_size = sym->size;
+        esym.st_info = sym->info;
+        esym.st_shndx = get_shndx(sym);
+        out_copy(&esym, sizeof(Elf32_Sym));
+        curr += sizeof(Elf32_Sym);
+        symtab_header.sh_size += sizeof(Elf32_Sym);
     }
     ++ehdr.e_shnum;
 
@@ -1326,7 +1582,7 @@ void write_ELF_file(FILE *outf)
      * .strtab
      */
     strtab_header.sh_offset = curr;
-    strtab_header.sh_size = strtab_write(strtab, outf);
+    strtab_header.sh_size = out_strtab(strtab);
     curr += strtab_header.sh_size;
     ++ehdr.e_shnum;;
 
@@ -1340,35 +1596,34 @@ void write_ELF_file(FILE *outf)
 
     /* first entry (SHN_UNDEF) */
     memset(&undef_header, 0, sizeof(Elf32_Shdr));
-    fwrite(&undef_header, sizeof(Elf32_Shdr), 1, outf);
+    out_write(&undef_header, sizeof(Elf32_Shdr));
 
     /* .shstrtab section header */
     shstrtab_header.sh_type = SHT_STRTAB;
     shstrtab_header.sh_addralign = 1;
-    fwrite(&shstrtab_header, sizeof(Elf32_Shdr), 1, outf);
+    out_write(&shstrtab_header, sizeof(Elf32_Shdr));
 
     /* .symtab section header */
     symtab_header.sh_type = SHT_SYMTAB;
     symtab_header.sh_link = 3; /* .strtab */
     symtab_header.sh_addralign = 4;
     symtab_header.sh_entsize = sizeof(Elf32_Sym);
-    fwrite(&symtab_header, sizeof(Elf32_Shdr), 1, outf);
+    out_write(&symtab_header, sizeof(Elf32_Shdr));
 
     /* .strtab section header */
     strtab_header.sh_type = SHT_STRTAB;
     strtab_header.sh_addralign = 1;
-    fwrite(&strtab_header, sizeof(Elf32_Shdr), 1, outf);
+    out_write(&strtab_header, sizeof(Elf32_Shdr));
 
     /* remaining section headers */
     for (i = 0; i < ROSeg.nsec; i++)
-        fwrite(&ROSeg.secs[i]->shdr, sizeof(Elf32_Shdr), 1, outf);
+        out_write(&ROSeg.secs[i]->shdr, sizeof(Elf32_Shdr));
     for (i = 0; i < WRSeg.nsec; i++)
-        fwrite(&WRSeg.secs[i]->shdr, sizeof(Elf32_Shdr), 1, outf);
+        out_write(&WRSeg.secs[i]->shdr, sizeof(Elf32_Shdr));
 
     /*
      * Correct dummy ELF header
      */
-    rewind(outf);
     ehdr.e_ident[EI_MAG0] = ELFMAG0;
     ehdr.e_ident[EI_MAG1] = ELFMAG1;
     ehdr.e_ident[EI_MAG2] = ELFMAG2;
@@ -1387,10 +1642,9 @@ void write_ELF_file(FILE *outf)
     ehdr.e_phentsize = sizeof(Elf32_Phdr);
     ehdr.e_shentsize = sizeof(Elf32_Shdr);
     ehdr.e_shstrndx = 1;
-    fwrite(&ehdr, sizeof(Elf32_Ehdr), 1, outf);
-    fseek(outf, 0, SEEK_END);
 
-    fclose(outf);
+    out_flush(fd);
+    close(fd);
     strtab_destroy(strtab), strtab_destroy(shstrtab);
 
 #undef ALIGN
@@ -1419,7 +1673,13 @@ void process_object_file(char *buf)
     obj->next = object_files;
     object_files = obj;
 
-    /* install any global symbol */
+    /*
+     * Install any global symbol. Map every symbol table entry to its
+     * Symbol, so relocations can be resolved without name lookups.
+     */
+    obj->syms = arena_alloc(mem_arena, sizeof(Symbol *)*obj->nsym);
+    for (i = 0; i < obj->nsym && i < first_gsym; i++)
+        obj->syms[i] = NULL;
     if (first_gsym < obj->nsym) {
         Elf32_Sym *symtab = obj->symtab;
         Elf32_Shdr *shtab = obj->shtab;
@@ -1428,8 +1688,9 @@ void process_object_file(char *buf)
 
         for (i = first_gsym; i < obj->nsym; i++) {
             char *shname = (symtab[i].st_shndx==SHN_UNDEF || symtab[i].st_shndx>=SHN_LORESERVE)
-                         ? NULL : &shstrtab[shtab[symtab[i].st_shndx].sh_name];
-            define_global_symbol(&strtab[symtab[i].st_name], 0, symtab[i].st_info, symtab[i].st_shndx, shname);
+                         ? NULL : output_section_name(&shstrtab[shtab[symtab[i].st_shndx].sh_name]);
+            obj->syms[i] = define_global_symbol(obj, &strtab[symtab[i].st_name], 0, symtab[i].st_info,
+                                                symtab[i].st_shndx, shname);
         }
     }
 }
@@ -1532,7 +1793,9 @@ done:
  */
 void process_file(char *path, char *needed_path)
 {
-    if ((fbuf[nfbuf]=read_file(path)) == NULL)
+    if (nfbuf >= MAX_INPUT_FILES)
+        err("too many input files");
+    if ((fbuf[nfbuf]=map_file(path, &fbuf_size[nfbuf])) == NULL)
         err("cannot read file `%s'", path);
     if (strncmp(fbuf[nfbuf], ARMAG, SARMAG) == 0) {
         process_archive(fbuf[nfbuf]);
@@ -1554,7 +1817,7 @@ void process_file(char *path, char *needed_path)
 
 int main(int argc, char *argv[])
 {
-    int i;
+    int i, fd;
     bool verbose = FALSE;
     char *out_name = "a.out";
     char *dirs[32];
@@ -1655,6 +1918,8 @@ search:
                        "    -l<name>    link against object file/library <name>\n"
                        "    -L<dir>     add <dir> to the list of directories searched for the -l options\n"
                        "    -I<interp>  set <interp> as the name of the dynamic linker\n"
+                       "    --gc-sections\n"
+                       "                remove the sections not reachable from the entry point\n"
                        "    -h          print this help\n", prog_name);
                 if (verbose)
                     printf("\ndefault output name: %s\n"
@@ -1668,28 +1933,41 @@ search:
         case 'v':
             verbose = TRUE;
             break;
+        case '-':
+            if (equal(argv[i], "--gc-sections"))
+                gc_sections = TRUE;
+            else
+                err("unknown option `%s'", argv[i]);
+            break;
         default:
             err("unknown option `%c'", argv[i][1]);
             break;
         }
     }
+    if (gc_sections)
+        gc_unused_sections();
     init_sections();
     init_segments();
     init_symtab();
     apply_relocs();
-    write_ELF_file(fopen(out_name, "wb"));
+    if ((fd=open(out_name, O_WRONLY|O_CREAT|O_TRUNC, 0666)) == -1)
+        err("cannot write file `%s': %s", out_name, strerror(errno));
+    write_ELF_file(fd);
     sprintf(chmod_cmd, "chmod u+x %s", out_name);
     system(chmod_cmd);
 
     /* free all */
     arena_destroy(mem_arena);
     strtab_destroy(dynstr);
+    free(global_symbols);
     for (i = 0; i < nfbuf; i++)
-        free(fbuf[i]);
+        munmap(fbuf[i], fbuf_size[i]);
     obj = object_files;
     while (obj != NULL) {
         ObjFile *tmp = obj;
         obj = obj->next;
+        free(tmp->live);
+        free(tmp->relsec);
         free(tmp);
     }
     so = shared_object_files;
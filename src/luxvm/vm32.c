@@ -138,6 +138,18 @@ void do_libcall(int32_t *sp, int32_t *bp, int32_t c)
     case 22:
         ((int64_t *)sp)[0] = (int64_t)strtoull((char *)bp[-3], (char **)bp[-4], bp[-5]);
         break;
+    case 23:
+        sp[0] = rename((char *)bp[-3], (char *)bp[-4]);
+        break;
+    case 24:
+        sp[0] = remove((char *)bp[-3]);
+        break;
+    case 25:
+        sp[0] = mkstemp((char *)bp[-3]);
+        break;
+    case 26:
+        sp[0] = close(bp[-3]);
+        break;
     default:
         fprintf(stderr, "libcall %d not implemented\n", c);
         break;
@@ -141,6 +141,18 @@ void do_libcall(int32_t *sp, int32_t *bp, int32_t c)
     case 22:
         ((int64_t *)sp)[0] = (int64_t)strtoull((char *)*(int64_t *)&bp[-6], (char **)*(int64_t *)&bp[-8], bp[-9]);
         break;
+    case 23:
+        sp[0] = rename((char *)*(int64_t *)&bp[-6], (char *)*(int64_t *)&bp[-8]);
+        break;
+    case 24:
+        sp[0] = remove((char *)*(int64_t *)&bp[-6]);
+        break;
+    case 25:
+        sp[0] = mkstemp((char *)*(int64_t *)&bp[-6]);
+        break;
+    case 26:
+        sp[0] = close(bp[-5]);
+        break;
     default:
         fprintf(stderr, "libcall %d not implemented\n", c);
         break;
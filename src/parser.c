@@ -14,7 +14,7 @@
 #include "luxcc.h"
 
 extern char *current_function_name;
-static TokenNode *curr_tok;
+static TokenIndex curr_tok;
 static Arena *parser_str_arena;
 /*static */Arena *parser_node_arena;
 
@@ -22,7 +22,7 @@ static Arena *parser_str_arena;
 static Declaration void_ty;
 static DeclList void_param;
 
-#define ERROR(...) emit_error(TRUE, curr_tok->src_file, curr_tok->src_line, curr_tok->src_column, __VA_ARGS__)
+#define ERROR(...) emit_error(TRUE, tok_src_file(curr_tok), tok_src_line(curr_tok), tok_src_column(curr_tok), __VA_ARGS__)
 
 TypeExp *new_type_exp_node(void)
 {
@@ -104,30 +104,30 @@ static ExecNode *new_pri_exp_node(ExpKind kind)
 
 static Token lookahead(int i)
 {
-    TokenNode *p;
+    TokenIndex p;
 
     p = curr_tok;
     while (--i /*&& p->token!=TOK_EOF*/)
-        p = p->next;
-    return p->token;
+        p = next_token(p);
+    return tok_kind(p);
 }
 
 static char *get_lexeme(int i)
 {
-    TokenNode *p;
+    TokenIndex p;
 
     p = curr_tok;
     while (--i /*&& p->token!=TOK_EOF*/)
-        p = p->next;
-    return p->lexeme;
+        p = next_token(p);
+    return tok_lexeme(p);
 }
 
 static void match(Token token)
 {
-    if (curr_tok->token == token)
-        curr_tok = curr_tok->next;
+    if (tok_kind(curr_tok) == token)
+        curr_tok = next_token(curr_tok);
     else
-        ERROR("expecting `%s'; found `%s'", tok2lex(token), curr_tok->lexeme);
+        ERROR("expecting `%s'; found `%s'", tok2lex(token), tok_lexeme(curr_tok));
 }
 
 /*                                  */
@@ -1151,7 +1151,7 @@ static void static_assert_statement(void)
     char *ep;
     ExecNode *e;
     Declaration *ty;
-    TokenNode *assert_tok;
+    TokenIndex assert_tok;
     int is_modif_lvalue(ExecNode *e);
 
     assert_tok = curr_tok;
@@ -1210,7 +1210,7 @@ static ExecNode *asm_statement(void)
 static ExecNode *va_buitin_start_statement(void)
 {
     ExecNode *n;
-    TokenNode *va_start_tok;
+    TokenIndex va_start_tok;
 
     va_start_tok = curr_tok;
     match(TOK_BUILTIN_VA_START);
@@ -1783,7 +1783,7 @@ ExecNode *cast_expression(void)
     ExecNode *n;
 
     if (lookahead(1) == TOK_LPAREN) {
-        TokenNode *temp;
+        TokenIndex temp;
 
         temp = curr_tok; /* save */
         match(TOK_LPAREN);
@@ -1835,7 +1835,7 @@ ExecNode *unary_expression(void)
         n = new_op_node(TOK_SIZEOF);
         match(TOK_SIZEOF);
         if (lookahead(1) == TOK_LPAREN) {
-            TokenNode *temp;
+            TokenIndex temp;
 
             temp = curr_tok; /* save */
             match(TOK_LPAREN);
@@ -1978,7 +1978,7 @@ ExecNode *primary_expression(void)
     ExecNode *n;
 
     switch (lookahead(1)) {
-#define NON_FATAL_ERROR(...) emit_error(FALSE, curr_tok->src_file, curr_tok->src_line, curr_tok->src_column, __VA_ARGS__)
+#define NON_FATAL_ERROR(...) emit_error(FALSE, tok_src_file(curr_tok), tok_src_line(curr_tok), tok_src_column(curr_tok), __VA_ARGS__)
     case TOK_ID: {
         /*
          * 6.5.1.2:
@@ -2016,8 +2016,8 @@ ExecNode *primary_expression(void)
     case TOK_ICONST_OHU:    case TOK_ICONST_OHUL:   case TOK_ICONST_OHULL:
         n = new_pri_exp_node(IConstExp);
         n->attr.str = get_lexeme(1);
-        n->child[0] = (ExecNode *)curr_tok->token;
-        match(curr_tok->token);
+        n->child[0] = (ExecNode *)tok_kind(curr_tok);
+        match(tok_kind(curr_tok));
         break;
     case TOK_STRLIT:
         n = new_pri_exp_node(StrLitExp);
@@ -2065,7 +2065,7 @@ static FILE *dotfile;
 /*
  * Main function of the parser.
  */
-ExternDecl *parse(TokenNode *tokens, char *ast_outpath)
+ExternDecl *parse(TokenIndex tokens, char *ast_outpath)
 {
     ExternDecl *n;
 
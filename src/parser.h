@@ -22,7 +22,9 @@ struct TypeExp {
         TypeExp *el;  /* enumerator list or pointer qualifiers */
     } attr;
     TypeExp *child, *sibling;
-    TokenNode *info;
+    TokenIndex info;
+    Token cat;        /* declaration specifiers: cached type category (0 if not yet known) */
+    unsigned align;   /* declaration specifiers: cached alignment (0 if not yet known) */
 };
 
 struct DeclList {
@@ -96,10 +98,10 @@ struct ExecNode {
     } attr;
     Declaration type;
     int nreg; /* number of registers needed to evaluate the expression represented by this node */
-    TokenNode *info;
+    TokenIndex info;
 };
 
-ExternDecl *parse(TokenNode *tokens, char *ast_outpath);
+ExternDecl *parse(TokenIndex tokens, char *ast_outpath);
 
 TypeExp *new_type_exp_node(void);
 ExecNode *new_exec_node(void);
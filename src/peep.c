@@ -0,0 +1,576 @@
+/*
+ * Peephole optimizer for the x86 and x64 code generators.
+ *
+ * The assembly text of a function body is split into a list of lines and
+ * a table of rules is applied over the list until no rule fires anymore.
+ * Each rule looks at a small window of consecutive lines starting at a given
+ * line. The optimized list is then written back into the function body.
+ *
+ * Note:
+ *  The code generators never leave a live value in a register at the end of
+ *  a basic block (the return value travels to the epilogue with an uncondi-
+ *  tional jump). The setcc/branch rule depends on this.
+ */
+#include "peep.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <assert.h>
+#include "util.h"
+
+#define MAX_PASSES 8
+
+typedef enum {
+    LineLab,    /* .L<n>: */
+    LineInstr,
+    LineOther,  /* directives, jump tables, etc. */
+} LineKind;
+
+typedef struct {
+    LineKind kind;
+    int deleted;
+    int lab;                /* label number (LineLab) or target of a direct jump (LineInstr); -1 otherwise */
+    char *mnem, *op1, *op2; /* LineInstr */
+    char *text;             /* LineOther */
+} Line;
+
+static Line *lines;
+static int nlines, max_lines;
+static int *lab_refs, *lab_pos, lab_tab_siz, max_lab;
+static char *text_buf;
+static unsigned text_buf_siz;
+static int x64_target;
+
+/*
+ * Registers.
+ */
+enum {
+    W64,
+    W32,
+    W16,
+    W8,
+};
+static char *reg_names[][4] = {
+    { "rax", "eax",  "ax",   "al"   },
+    { "rbx", "ebx",  "bx",   "bl"   },
+    { "rcx", "ecx",  "cx",   "cl"   },
+    { "rdx", "edx",  "dx",   "dl"   },
+    { "rsi", "esi",  "si",   "sil"  },
+    { "rdi", "edi",  "di",   "dil"  },
+    { "rbp", "ebp",  "bp",   "bpl"  },
+    { "rsp", "esp",  "sp",   "spl"  },
+    { "r8",  "r8d",  "r8w",  "r8b"  },
+    { "r9",  "r9d",  "r9w",  "r9b"  },
+    { "r10", "r10d", "r10w", "r10b" },
+    { "r11", "r11d", "r11w", "r11b" },
+    { "r12", "r12d", "r12w", "r12b" },
+    { "r13", "r13d", "r13w", "r13b" },
+    { "r14", "r14d", "r14w", "r14b" },
+    { "r15", "r15d", "r15w", "r15b" },
+};
+
+/* return the register family of s (or -1 if s is not a register) */
+static int reg_lookup(char *s, int *width)
+{
+    int i, j;
+
+    for (i = 0; i < NELEMS(reg_names); i++) {
+        for (j = 0; j < 4; j++) {
+            if (equal(s, reg_names[i][j])) {
+                if (width != NULL)
+                    *width = j;
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+/* does the memory operand m use a register of the family f? */
+static int mentions_reg(char *m, int f)
+{
+    char id[8];
+
+    while (*m != '\0') {
+        int n;
+
+        if (!isalnum(*m)) {
+            ++m;
+            continue;
+        }
+        for (n = 0; isalnum(*m); m++)
+            if (n < sizeof(id)-1)
+                id[n++] = *m;
+        id[n] = '\0';
+        if (reg_lookup(id, NULL) == f)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+ * Condition codes.
+ */
+static char *jcc_pairs[][2] = {
+    { "je",  "jne" },
+    { "jl",  "jge" },
+    { "jle", "jg"  },
+    { "jb",  "jae" },
+    { "jbe", "ja"  },
+};
+static char *setcc_jcc[][2] = {
+    { "sete",  "je"  }, { "setne", "jne" },
+    { "setl",  "jl"  }, { "setge", "jge" },
+    { "setle", "jle" }, { "setg",  "jg"  },
+    { "setb",  "jb"  }, { "setae", "jae" },
+    { "setbe", "jbe" }, { "seta",  "ja"  },
+};
+
+static char *negate_jcc(char *jcc)
+{
+    int i;
+
+    for (i = 0; i < NELEMS(jcc_pairs); i++) {
+        if (equal(jcc, jcc_pairs[i][0]))
+            return jcc_pairs[i][1];
+        else if (equal(jcc, jcc_pairs[i][1]))
+            return jcc_pairs[i][0];
+    }
+    return NULL;
+}
+
+static char *setcc_to_jcc(char *setcc)
+{
+    int i;
+
+    for (i = 0; i < NELEMS(setcc_jcc); i++)
+        if (equal(setcc, setcc_jcc[i][0]))
+            return setcc_jcc[i][1];
+    return NULL;
+}
+
+/*
+ * Line list helpers.
+ */
+#define is_instr(i, m)      (lines[i].kind==LineInstr && equal(lines[i].mnem, (m)))
+#define is_jump(i)          (lines[i].kind==LineInstr && lines[i].mnem[0]=='j')
+#define is_direct_jump(i)   (is_jump(i) && lines[i].lab!=-1)
+#define is_cond_jump(i)     (is_jump(i) && not_equal(lines[i].mnem, "jmp"))
+
+static int next_line(int i)
+{
+    for (++i; i<nlines && lines[i].deleted; i++)
+        ;
+    return (i < nlines) ? i : -1;
+}
+
+static int prev_line(int i)
+{
+    for (--i; i>=0 && lines[i].deleted; i--)
+        ;
+    return i;
+}
+
+static void delete_line(int i)
+{
+    if (is_direct_jump(i))
+        --lab_refs[lines[i].lab];
+    lines[i].deleted = TRUE;
+}
+
+static void retarget_jump(int i, int lab)
+{
+    --lab_refs[lines[i].lab];
+    ++lab_refs[lab];
+    lines[i].lab = lab;
+}
+
+/*
+ * Rules.
+ */
+
+/* mov r, r */
+static int self_move(int i)
+{
+    int f, w, j;
+
+    if (!is_instr(i, "mov") || lines[i].op2==NULL || not_equal(lines[i].op1, lines[i].op2))
+        return FALSE;
+    if ((f=reg_lookup(lines[i].op1, &w)) == -1)
+        return FALSE;
+    if (x64_target && w==W32) {
+        /*
+         * This zero-extends the register (see x64_llzx()). It is only
+         * redundant if the previous instruction already wrote the register
+         * in its 32-bit form.
+         */
+        static char *zext_instr[] = {
+            "mov", "movzx", "movsx", "add", "sub", "and", "or", "xor",
+            "imul", "neg", "not", "sal", "shr", "sar", "lea",
+        };
+
+        if ((j=prev_line(i))==-1 || lines[j].kind!=LineInstr || lines[j].op1==NULL
+        || not_equal(lines[j].op1, lines[i].op1))
+            return FALSE;
+        for (f = 0; f < NELEMS(zext_instr); f++)
+            if (equal(lines[j].mnem, zext_instr[f]))
+                break;
+        if (f == NELEMS(zext_instr))
+            return FALSE;
+    }
+    delete_line(i);
+    return TRUE;
+}
+
+/* mov a, b + mov b, a => mov a, b */
+static int store_reload(int i)
+{
+    int j, f, w;
+
+    if ((j=next_line(i)) == -1)
+        return FALSE;
+    if (!is_instr(i, "mov") || !is_instr(j, "mov") || lines[i].op2==NULL || lines[j].op2==NULL)
+        return FALSE;
+    if (not_equal(lines[i].op1, lines[j].op2) || not_equal(lines[i].op2, lines[j].op1))
+        return FALSE;
+
+    if ((f=reg_lookup(lines[j].op1, &w)) != -1) {
+        /* the second mov writes a register; on x64 a 32-bit write would clear the H.O. dword */
+        if (x64_target && w==W32)
+            return FALSE;
+    } else {
+        /* the second mov writes memory; the register loaded by the first mov cannot be part of the address */
+        if ((f=reg_lookup(lines[j].op2, NULL))==-1 || mentions_reg(lines[j].op1, f))
+            return FALSE;
+    }
+    delete_line(j);
+    return TRUE;
+}
+
+/* cmp r, 0 => test r, r */
+static int cmp_zero(int i)
+{
+    if (!is_instr(i, "cmp") || lines[i].op2==NULL || not_equal(lines[i].op2, "0"))
+        return FALSE;
+    if (reg_lookup(lines[i].op1, NULL) == -1)
+        return FALSE;
+    lines[i].mnem = "test";
+    lines[i].op2 = lines[i].op1;
+    return TRUE;
+}
+
+/* setcc r8 + movzx r32, r8 + test r, r + je/jne L => jcc L */
+static int setcc_branch(int i)
+{
+    int j, k, l, f;
+    char *jcc;
+
+    if (lines[i].kind!=LineInstr || (jcc=setcc_to_jcc(lines[i].mnem))==NULL)
+        return FALSE;
+    f = reg_lookup(lines[i].op1, NULL);
+
+    if ((j=next_line(i))==-1 || !is_instr(j, "movzx") || not_equal(lines[j].op2, lines[i].op1))
+        return FALSE;
+    if (reg_lookup(lines[j].op1, NULL) != f)
+        return FALSE;
+
+    if ((k=next_line(j)) == -1)
+        return FALSE;
+    if (is_instr(k, "test")) {
+        if (not_equal(lines[k].op1, lines[k].op2))
+            return FALSE;
+    } else if (is_instr(k, "cmp")) {
+        if (not_equal(lines[k].op2, "0"))
+            return FALSE;
+    } else {
+        return FALSE;
+    }
+    if (reg_lookup(lines[k].op1, NULL) != f)
+        return FALSE;
+
+    if ((l=next_line(k))==-1 || !is_direct_jump(l))
+        return FALSE;
+    if (equal(lines[l].mnem, "je"))
+        lines[l].mnem = negate_jcc(jcc);
+    else if (equal(lines[l].mnem, "jne"))
+        lines[l].mnem = jcc;
+    else
+        return FALSE;
+    delete_line(i);
+    delete_line(j);
+    delete_line(k);
+    return TRUE;
+}
+
+/* jmp L1 + ... + L1: jmp L2 => jmp L2 */
+static int jump_thread(int i)
+{
+    int j;
+
+    if (!is_direct_jump(i) || (j=lab_pos[lines[i].lab])==-1)
+        return FALSE;
+    while ((j=next_line(j))!=-1 && lines[j].kind==LineLab)
+        ;
+    if (j==-1 || !is_instr(j, "jmp") || lines[j].lab==-1 || lines[j].lab==lines[i].lab)
+        return FALSE;
+    retarget_jump(i, lines[j].lab);
+    return TRUE;
+}
+
+/* jmp L + L: => L: */
+static int jump_to_next(int i)
+{
+    int j;
+
+    if (!is_direct_jump(i))
+        return FALSE;
+    for (j = next_line(i); j!=-1 && lines[j].kind==LineLab; j = next_line(j)) {
+        if (lines[j].lab == lines[i].lab) {
+            delete_line(i);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* jcc L1 + jmp L2 + L1: => jncc L2 + L1: */
+static int jcc_over_jmp(int i)
+{
+    int j, k;
+    char *njcc;
+
+    if (!is_cond_jump(i) || !is_direct_jump(i) || (njcc=negate_jcc(lines[i].mnem))==NULL)
+        return FALSE;
+    if ((j=next_line(i))==-1 || !is_instr(j, "jmp") || lines[j].lab==-1)
+        return FALSE;
+    if ((k=next_line(j))==-1 || lines[k].kind!=LineLab || lines[k].lab!=lines[i].lab)
+        return FALSE;
+    lines[i].mnem = njcc;
+    retarget_jump(i, lines[j].lab);
+    delete_line(j);
+    return TRUE;
+}
+
+/* remove instructions that follow an unconditional jump */
+static int unreachable(int i)
+{
+    int j;
+
+    if (!is_instr(i, "jmp") || (j=next_line(i))==-1 || lines[j].kind!=LineInstr)
+        return FALSE;
+    delete_line(j);
+    return TRUE;
+}
+
+/* remove labels nobody jumps to */
+static int dead_label(int i)
+{
+    if (lines[i].kind!=LineLab || lab_refs[lines[i].lab]!=0)
+        return FALSE;
+    delete_line(i);
+    return TRUE;
+}
+
+static struct {
+    char *name;
+    int (*apply)(int i);
+    unsigned hits;
+} rules[] = {
+    { "cmp-zero",       cmp_zero },
+    { "self-move",      self_move },
+    { "store-reload",   store_reload },
+    { "setcc-branch",   setcc_branch },
+    { "jump-thread",    jump_thread },
+    { "jump-to-next",   jump_to_next },
+    { "jcc-over-jmp",   jcc_over_jmp },
+    { "unreachable",    unreachable },
+    { "dead-label",     dead_label },
+};
+
+/*
+ * Build the line list.
+ */
+static int is_lab_def(char *s)
+{
+    if (s[0]!='.' || s[1]!='L' || !isdigit(s[2]))
+        return FALSE;
+    for (s += 2; isdigit(*s); s++)
+        ;
+    return s[0]==':' && s[1]=='\0';
+}
+
+static void count_lab_refs(char *s)
+{
+    while ((s=strstr(s, ".L")) != NULL) {
+        int n;
+
+        s += 2;
+        if (!isdigit(*s))
+            continue;
+        n = atoi(s);
+        if (n <= max_lab)
+            ++lab_refs[n];
+    }
+}
+
+static void new_line(char *s, int in_text)
+{
+    Line *ln;
+    char *p;
+
+    if (nlines >= max_lines) {
+        max_lines = max_lines ? max_lines*2 : 1024;
+        if ((lines=realloc(lines, max_lines*sizeof(Line))) == NULL)
+            TERMINATE("Out of memory while running peephole optimizer");
+    }
+    ln = &lines[nlines++];
+    ln->deleted = FALSE;
+    ln->lab = -1;
+    ln->mnem = ln->op1 = ln->op2 = NULL;
+    ln->text = s;
+
+    if (!in_text || s[0]=='\0' || s[0]==';' || strncmp(s, "segment ", 8)==0) {
+        ln->kind = LineOther;
+    } else if (is_lab_def(s)) {
+        ln->kind = LineLab;
+        ln->lab = atoi(s+2);
+        if (ln->lab > max_lab)
+            max_lab = ln->lab;
+    } else {
+        ln->kind = LineInstr;
+        ln->mnem = s;
+        if ((p=strchr(s, ' ')) != NULL) {
+            *p++ = '\0';
+            ln->op1 = p;
+            if ((p=strstr(p, ", ")) != NULL) {
+                *p = '\0';
+                ln->op2 = p+2;
+            }
+        }
+        if (ln->mnem[0]=='j' && ln->op1!=NULL && ln->op1[0]=='.' && ln->op1[1]=='L' && isdigit(ln->op1[2]))
+            ln->lab = atoi(ln->op1+2);
+    }
+}
+
+static void build_line_list(String *func_body)
+{
+    int i, in_text;
+    char *s, *p;
+    unsigned len;
+
+    len = string_get_pos(func_body);
+    if (len+1 > text_buf_siz) {
+        text_buf_siz = len+1;
+        if ((text_buf=realloc(text_buf, text_buf_siz)) == NULL)
+            TERMINATE("Out of memory while running peephole optimizer");
+    }
+    memcpy(text_buf, string_buf(func_body), len);
+    text_buf[len] = '\0';
+
+    nlines = 0;
+    max_lab = -1;
+    in_text = TRUE;
+    for (s = text_buf; *s != '\0'; s = p) {
+        char *e;
+
+        if ((p=strchr(s, '\n')) != NULL)
+            *p++ = '\0';
+        else
+            p = s+strlen(s);
+        for (e = s+strlen(s); e>s && e[-1]==' '; e--) /* call fixes leave trailing spaces */
+            ;
+        *e = '\0';
+        if (strncmp(s, "segment ", 8) == 0)
+            in_text = equal(s+8, ".text");
+        new_line(s, in_text);
+    }
+
+    if (max_lab+1 > lab_tab_siz) {
+        lab_tab_siz = max_lab+1;
+        lab_refs = realloc(lab_refs, lab_tab_siz*sizeof(int));
+        lab_pos = realloc(lab_pos, lab_tab_siz*sizeof(int));
+        if (lab_refs==NULL || lab_pos==NULL)
+            TERMINATE("Out of memory while running peephole optimizer");
+    }
+    for (i = 0; i <= max_lab; i++) {
+        lab_refs[i] = 0;
+        lab_pos[i] = -1;
+    }
+    for (i = 0; i < nlines; i++) {
+        switch (lines[i].kind) {
+        case LineLab:
+            lab_pos[lines[i].lab] = i;
+            break;
+        case LineInstr:
+            if (lines[i].lab > max_lab)
+                lines[i].lab = -1; /* not defined in this function; leave it alone */
+            if (lines[i].lab != -1) {
+                ++lab_refs[lines[i].lab];
+            } else {
+                if (lines[i].op1 != NULL) count_lab_refs(lines[i].op1);
+                if (lines[i].op2 != NULL) count_lab_refs(lines[i].op2);
+            }
+            break;
+        case LineOther:
+            count_lab_refs(lines[i].text);
+            break;
+        }
+    }
+}
+
+void peep_optimize(String *func_body, int x64)
+{
+    int i, k, pass, changed;
+
+    x64_target = x64;
+    build_line_list(func_body);
+
+    for (pass = 0; pass < MAX_PASSES; pass++) {
+        changed = FALSE;
+        for (i = 0; i < nlines; i++) {
+            for (k = 0; k<NELEMS(rules) && !lines[i].deleted; k++) {
+                if (rules[k].apply(i)) {
+                    ++rules[k].hits;
+                    changed = TRUE;
+                }
+            }
+        }
+        if (!changed)
+            break;
+    }
+
+    string_clear(func_body);
+    for (i = 0; i < nlines; i++) {
+        Line *ln;
+
+        if ((ln=&lines[i])->deleted)
+            continue;
+        switch (ln->kind) {
+        case LineLab:
+            string_printf(func_body, ".L%d:\n", ln->lab);
+            break;
+        case LineInstr:
+            string_printf(func_body, "%s", ln->mnem);
+            if (ln->lab != -1)
+                string_printf(func_body, " .L%d", ln->lab);
+            else if (ln->op1 != NULL)
+                string_printf(func_body, " %s", ln->op1);
+            if (ln->op2 != NULL)
+                string_printf(func_body, ", %s", ln->op2);
+            string_printf(func_body, "\n");
+            break;
+        case LineOther:
+            string_printf(func_body, "%s\n", ln->text);
+            break;
+        }
+    }
+}
+
+void peep_print_stats(FILE *fp)
+{
+    int i;
+
+    for (i = 0; i < NELEMS(rules); i++)
+        fprintf(fp, "=> '%u' peephole hits for rule `%s'\n", rules[i].hits, rules[i].name);
+}
@@ -0,0 +1,9 @@
+#ifndef PEEP_H_
+#define PEEP_H_
+
+#include "str.h"
+
+void peep_optimize(String *func_body, int x64);
+void peep_print_stats(FILE *fp);
+
+#endif
@@ -4,18 +4,21 @@
 #include <string.h>
 #include <ctype.h>
 #include <assert.h>
+#include <unistd.h>
 #include "util.h"
 #include "imp_lim.h"
 #include "error.h"
 #include "arena.h"
 #include "luxcc.h"
+#include "intern.h"
 
 #define SRC_FILE            curr_source_file
 #define SRC_LINE            curr_line
 #define SRC_COLUMN          src_column
 #define ERROR(...)          emit_error(TRUE, SRC_FILE, SRC_LINE, SRC_COLUMN, __VA_ARGS__)
 #define MACRO_TABLE_SIZE    4093
-#define HASH_VAL(s)         (hash(s)%MACRO_TABLE_SIZE)
+#define HASH_VAL(s)         (istr_hash(s)%MACRO_TABLE_SIZE)
+#define FILE_TABLE_SIZE     257
 
 /* get_token()'s possible states */
 typedef enum {
@@ -55,9 +58,38 @@ static struct Macro {
     Macro *next;
 } *macro_table[MACRO_TABLE_SIZE];
 
+/*
+ * Files that have been included. A file whose whole content
+ * is wrapped in #ifndef X/#endif (guard = X) or that contains
+ * #pragma once is not read again if included a second time.
+ */
+static struct IncFile {
+    char *path; /* canonical path */
+    char *guard;
+    int once;
+    unsigned ntokens;           /* preprocessing tokens read from the file */
+    struct IncFile *next;
+    struct IncFile *next_dep;   /* next header in included_files */
+} *file_table[FILE_TABLE_SIZE];
+
+/* headers included so far, in order of first inclusion (for pre_write_deps()) */
+static struct IncFile *included_files, **last_included_file = &included_files;
+
+/*
+ * Precompiled headers. The leading #include/#define lines of the
+ * main file (the "header prefix") are preprocessed once and the
+ * resulting tokens and macro definitions saved into pch_dir.
+ */
+static char *pch_dir;
+static int pch_recording;
+static char **pch_deps; /* files read while preprocessing the header prefix */
+static int npch_deps, max_pch_deps;
+
 static char *buf, *curr, *curr_source_file;
 static char token_string[MAX_LOG_LINE_LEN+1];
 static PreTokenNode *curr_tok;
+static int pre_done; /* the whole source file was preprocessed */
+static char *file_macro_name, *line_macro_name; /* interned "__FILE__" and "__LINE__" */
 static int curr_line, src_column;
 static PreTokenNode *penultimate_node; /* used by #include's code */
 static Arena *pre_str_arena;
@@ -76,13 +108,30 @@ static char *dup_lexeme(const char *s)
     return t;
 }
 
+/*
+ * Nodes already converted into C tokens are handed back by the lexer
+ * through pre_release() and reused, so the number of live nodes does
+ * not grow with the size of the translation unit.
+ */
+static PreTokenNode *free_nodes;
+
+void pre_release(PreTokenNode *p)
+{
+    p->next = free_nodes;
+    free_nodes = p;
+}
+
 static PreTokenNode *new_node(PreToken token, char *lexeme)
 {
     PreTokenNode *temp;
 
-    temp = arena_alloc(pre_node_arena, sizeof(PreTokenNode));
+    if ((temp=free_nodes) != NULL)
+        free_nodes = temp->next;
+    else
+        temp = arena_alloc(pre_node_arena, sizeof(PreTokenNode));
     temp->token = token;
-    temp->lexeme = dup_lexeme(lexeme);
+    /* identifiers are interned and can be shared */
+    temp->lexeme = (token==PRE_TOK_ID || token==PRE_TOK_MACRO_REENABLER) ? lexeme : dup_lexeme(lexeme);
     temp->next = NULL;
     temp->deleted = FALSE;
     temp->src_line = curr_line;
@@ -139,6 +188,14 @@ static void init(char *file_path)
 
     curr = buf;
     fclose(fp);
+    if (pch_recording) {
+        if (npch_deps >= max_pch_deps) {
+            max_pch_deps = max_pch_deps ? max_pch_deps*2 : 32;
+            if ((pch_deps=realloc(pch_deps, max_pch_deps*sizeof(char *))) == NULL)
+                TERMINATE("Out of memory");
+        }
+        pch_deps[npch_deps++] = strdup(file_path);
+    }
     /*
      * Set the current file global var. Each token has attached
      * the name of the file from where it was obtained. This is
@@ -254,6 +311,111 @@ static char *search_quote(char *inc_arg)
     return search_angle(inc_arg);
 }
 
+/*
+ * Return a malloc'd copy of path with "." and "dir/.." components
+ * and repeated slashes removed. The result is used to identify files
+ * included through different paths.
+ */
+static char *canon_path(char *path)
+{
+    char *res, *s, *d;
+    int is_abs;
+
+    res = malloc(strlen(path)+2);
+    is_abs = (*path == '/');
+    d = res;
+    if (is_abs)
+        *d++ = '/';
+    s = path;
+    for (;;) {
+        char *c;
+        int n;
+
+        while (*s == '/')
+            ++s;
+        if (*s == '\0')
+            break;
+        for (c = s; *s!='\0' && *s!='/'; s++)
+            ;
+        n = (int)(s-c);
+        if (n==1 && c[0]=='.')
+            continue;
+        if (n==2 && c[0]=='.' && c[1]=='.') {
+            char *q;
+
+            /* remove the previous component unless it is also ".." */
+            *d = '\0';
+            q = strrchr(res+is_abs, '/');
+            q = (q == NULL) ? res+is_abs : q+1;
+            if (d>q && !(d-q==2 && q[0]=='.' && q[1]=='.')) {
+                d = (q > res+is_abs) ? q-1 : q;
+                continue;
+            }
+            if (is_abs && d==res+1)
+                continue; /* "/.." is "/" */
+        }
+        if (d > res+is_abs)
+            *d++ = '/';
+        memcpy(d, c, n);
+        d += n;
+    }
+    if (d == res)
+        *d++ = '.';
+    *d = '\0';
+    return res;
+}
+
+static struct IncFile *lookup_file(char *path)
+{
+    unsigned h;
+    char *cp;
+    struct IncFile *np;
+
+    cp = canon_path(path);
+    h = hash(cp)%FILE_TABLE_SIZE;
+    for (np = file_table[h]; np != NULL; np = np->next) {
+        if (equal(np->path, cp)) {
+            free(cp);
+            return np;
+        }
+    }
+    np = malloc(sizeof(struct IncFile));
+    np->path = cp;
+    np->guard = NULL;
+    np->once = FALSE;
+    np->ntokens = 0;
+    np->next_dep = NULL;
+    np->next = file_table[h];
+    file_table[h] = np;
+    return np;
+}
+
+static void add_dep(struct IncFile *f)
+{
+    if (f->next_dep!=NULL || last_included_file==&f->next_dep)
+        return; /* already listed */
+    *last_included_file = f;
+    last_included_file = &f->next_dep;
+}
+
+/*
+ * Write a make rule stating that `target' depends on `source_file'
+ * and on every header included while preprocessing it. Each header
+ * is followed by a comment with the number of preprocessing tokens
+ * read from it (0 if it came from a precompiled header).
+ */
+void pre_write_deps(FILE *fp, char *target, char *source_file)
+{
+    struct IncFile *f;
+
+    fprintf(fp, "%s: %s", target, source_file);
+    for (f = included_files; f != NULL; f = f->next_dep)
+        fprintf(fp, " \\\n %s", f->path);
+    fprintf(fp, "\n");
+    for (f = included_files; f != NULL; f = f->next_dep)
+        fprintf(fp, "# %s: %u tokens\n", f->path, f->ntokens);
+}
+
 static PreToken lookahead(int i)
 {
     PreTokenNode *p;
@@ -572,12 +734,12 @@ static PreTokenNode *tokenize(void)
 
     curr_line = 1; /* initialize line counter */
     tok = get_token();
-    n = p = penultimate_node = new_node(tok, token_string);
+    n = p = penultimate_node = new_node(tok, (tok == PRE_TOK_ID) ? str_intern(token_string) : token_string);
     p->next_char = *curr;
 
     while (tok != PRE_TOK_EOF) {
         tok = get_token();
-        p->next = new_node(tok, token_string);
+        p->next = new_node(tok, (tok == PRE_TOK_ID) ? str_intern(token_string) : token_string);
         p->next->next_char = *curr;
         penultimate_node = p;
         p = p->next;
@@ -589,6 +751,78 @@ static PreTokenNode *tokenize(void)
     return n;
 }
 
+/*
+ * If the whole content of the tokenized file `p' is
+ * wrapped in an include guard, that is
+ *      #ifndef X           (or #if !defined X)
+ *      ...
+ *      #endif
+ * return X, otherwise return NULL.
+ */
+static char *find_guard(PreTokenNode *p)
+{
+    char *guard;
+    int depth, paren;
+
+    paren = FALSE;
+    while (p->token == PRE_TOK_NL)
+        p = p->next;
+    if (not_equal(p->lexeme, "#"))
+        return NULL;
+    p = p->next;
+    if (equal(p->lexeme, "ifndef")) {
+        p = p->next;
+    } else if (equal(p->lexeme, "if")
+    && equal(p->next->lexeme, "!") && equal(p->next->next->lexeme, "defined")) {
+        p = p->next->next->next;
+        if (equal(p->lexeme, "(")) {
+            p = p->next;
+            paren = TRUE;
+        }
+    } else {
+        return NULL;
+    }
+    if (p->token != PRE_TOK_ID)
+        return NULL;
+    guard = p->lexeme;
+    p = p->next;
+    if (paren) {
+        if (not_equal(p->lexeme, ")"))
+            return NULL;
+        p = p->next;
+    }
+    if (p->token != PRE_TOK_NL)
+        return NULL;
+
+    /* find the matching #endif */
+    depth = 1;
+    p = p->next;
+    while (depth > 0) {
+        if (p->token == PRE_TOK_EOF)
+            return NULL;
+        if (equal(p->lexeme, "#")) {
+            char *d;
+
+            d = p->next->lexeme;
+            if (equal(d, "if") || equal(d, "ifdef") || equal(d, "ifndef"))
+                ++depth;
+            else if (equal(d, "endif"))
+                --depth;
+            else if (depth==1 && (equal(d, "else") || equal(d, "elif")))
+                return NULL;
+        }
+        while (p->token!=PRE_TOK_NL && p->token!=PRE_TOK_EOF)
+            p = p->next;
+        if (p->token == PRE_TOK_NL)
+            p = p->next;
+    }
+
+    /* nothing but new-lines can follow the #endif */
+    while (p->token == PRE_TOK_NL)
+        p = p->next;
+    return (p->token == PRE_TOK_EOF) ? guard : NULL;
+}
+
 #undef SRC_FILE
 #undef SRC_LINE
 #undef SRC_COLUMN
@@ -603,7 +837,7 @@ void install_macro(MacroKind kind, char *name, PreTokenNode *rep, PreTokenNode *
 
     h = HASH_VAL(name);
 	for(np = macro_table[h]; np != NULL; np = np->next)
-		if(np->enabled && equal(name, np->name))
+		if(np->enabled && name==np->name)
 			break;
 
     if (np == NULL) { /* not found */
@@ -627,7 +861,7 @@ static void uninstall_macro(char *name)
 
     h = HASH_VAL(name);
 	for(np=macro_table[h], prev=NULL;
-        np!=NULL && not_equal(name, np->name);
+        np!=NULL && name!=np->name;
         prev=np, np=np->next);
 
 	if (np == NULL)
@@ -644,7 +878,7 @@ static Macro *lookup_macro(char *name)
 	Macro *np;
 
 	for(np = macro_table[HASH_VAL(name)]; np != NULL; np = np->next)
-		if(np->enabled && equal(name, np->name))
+		if(np->enabled && name==np->name)
 			return np;
 	return NULL;
 }
@@ -654,7 +888,7 @@ static void reenable_macro(char *name)
     Macro *m;
 
     for(m = macro_table[HASH_VAL(name)]; m != NULL; m = m->next) {
-        if(equal(name, m->name)) {
+        if(name == m->name) {
             m->enabled = TRUE;
             break;
         }
@@ -804,11 +1038,11 @@ int if_group(int skip)
         cond_res = pre_eval_expr();
     } else if (equal(get_lexeme(1), "ifdef")) {
         match2(PRE_TOK_ID);
-        cond_res = (lookup_macro(get_lexeme(1)) != NULL);
+        cond_res = (lookahead(1)==PRE_TOK_ID && lookup_macro(get_lexeme(1))!=NULL);
         match2(PRE_TOK_ID);
     } else { /* ifndef */
         match2(PRE_TOK_ID);
-        cond_res = (lookup_macro(get_lexeme(1)) == NULL);
+        cond_res = (lookahead(1)!=PRE_TOK_ID || lookup_macro(get_lexeme(1))==NULL);
         match2(PRE_TOK_ID);
     }
     match2(PRE_TOK_NL);
@@ -917,6 +1151,8 @@ void control_line(int skip)
      */
     if (equal(get_lexeme(1), "include")) {
         char inc_arg[256], *path;
+        unsigned ntokens;
+        struct IncFile *f;
         PreTokenNode *tokenized_file;
 
         match2(PRE_TOK_ID);
@@ -931,8 +1167,6 @@ void control_line(int skip)
             inc_arg[strlen(inc_arg)-1] = '\0';
             if ((path=search_quote(inc_arg)) == NULL)
                 ERROR("include: cannot find file `%s'", inc_arg);
-            init(path);
-            free(path);
             match2(lookahead(1)); /* filename */
         } else if (equal(get_lexeme(1), "<")) {
             match2(PRE_TOK_PUNCTUATOR);
@@ -947,19 +1181,34 @@ void control_line(int skip)
             } while (not_equal(get_lexeme(1), ">"));
             if ((path=search_angle(inc_arg)) == NULL)
                 ERROR("include: cannot find file `%s'", inc_arg);
-            init(path);
-            free(path);
             match2(PRE_TOK_PUNCTUATOR); /* > */
         } else {
             ERROR("include: \"file.h\" or <file.h> expected");
         }
         /* now at new-line... */
 
+        /*
+         * Don't bother reading the file again if it has
+         * #pragma once or its include guard is defined.
+         */
+        f = lookup_file(path);
+        add_dep(f);
+        if (f->once || f->guard!=NULL && lookup_macro(f->guard)!=NULL) {
+            ++stat_number_of_skipped_includes;
+            free(path);
+            goto bottom;
+        }
+        init(path);
+        free(path);
+
         /*
          * Tokenize the file's content and insert the
          * result right after the #include directive.
          */
+        ntokens = stat_number_of_pre_tokens;
         tokenized_file = tokenize();
+        f->ntokens += stat_number_of_pre_tokens-ntokens;
+        f->guard = find_guard(tokenized_file);
         /* skip included file's EOF token */
         penultimate_node->next = curr_tok->next;
         curr_tok->next = tokenized_file;
@@ -979,6 +1228,11 @@ void control_line(int skip)
             uninstall_macro(get_lexeme(1));
         else
             ERROR("undef: name expected");
+    } else if (equal(get_lexeme(1), "pragma")) {
+        match2(PRE_TOK_ID);
+        if (equal(get_lexeme(1), "once"))
+            lookup_file(curr_tok->src_file)->once = TRUE;
+        /* other pragmas are ignored */
     } else if (equal(get_lexeme(1), "\n")) {
         ; /* NULL directive */
     /* --> add the remaining directives here <-- */
@@ -1066,7 +1320,7 @@ void preprocessing_token(int skip)
     if (lookahead(1) == PRE_TOK_ID) {
         Macro *m;
 
-        if (equal(curr_tok->lexeme, "__FILE__")) {
+        if (curr_tok->lexeme == file_macro_name) {
             /*
              * Note: __FILE__ depends on the compiler's working directory.
              * Example invocations and __FILE__'s value:
@@ -1084,7 +1338,7 @@ void preprocessing_token(int skip)
             curr_tok->lexeme[n+2] = '\0';
             curr_tok->token = PRE_TOK_STRLIT;
             match(lookahead(1));
-        } else if (equal(curr_tok->lexeme, "__LINE__")) {
+        } else if (curr_tok->lexeme == line_macro_name) {
             char n[11];
 
             sprintf(n, "%d", curr_tok->src_line);
@@ -1208,6 +1462,49 @@ static PreTokenNode *copy_arg2(PreTokenNode *a, PreTokenNode **last)
     return copy;
 }
 
+/*
+ * Fully macro-expand the argument `a' (a list created with copy_arg())
+ * before it is substituted into the replacement list. The macro being
+ * invoked is still enabled here, so a nested invocation such as F(F(x))
+ * is expanded. An EOF node keeps the expansion from reaching past the
+ * end of the argument.
+ */
+static PreTokenNode *expand_arg(PreTokenNode *a)
+{
+    PreTokenNode *p, *end, *save, *res, *last;
+
+    for (p = a; ; p = p->next) {
+        if (p->token==PRE_TOK_ID && lookup_macro(p->lexeme)!=NULL)
+            break;
+        if (p->next == NULL)
+            return a; /* nothing to expand */
+    }
+    for (; p->next != NULL; p = p->next)
+        ;
+    p->next = end = new_node(PRE_TOK_EOF, "");
+
+    save = curr_tok;
+    curr_tok = a;
+    while (curr_tok != end)
+        preprocessing_token(FALSE);
+    curr_tok = save;
+
+    /* keep the tokens that survived */
+    res = last = NULL;
+    for (p = a; p != end; p = p->next) {
+        if (p->deleted)
+            continue;
+        if (last == NULL)
+            res = p;
+        else
+            last->next = p;
+        last = p;
+    }
+    if (last != NULL)
+        last->next = NULL;
+    return res;
+}
+
 void expand_parameterized_macro(Macro *m)
 {
     PreTokenNode *r, *p, *prev, *param, *arg;
@@ -1240,7 +1537,7 @@ void expand_parameterized_macro(Macro *m)
      */
     while (not_equal(param->lexeme, ")") && not_equal(arg->lexeme, ")")) {
         if (equal(param->lexeme, "...")) {
-            par_arg_tab[tab_size][0] = new_node(PRE_TOK_ID, "__VA_ARGS__");
+            par_arg_tab[tab_size][0] = new_node(PRE_TOK_ID, str_intern("__VA_ARGS__"));
             par_arg_tab[tab_size][1] = copy_arg(&arg, VAR_LIST); /* arg is left pointing to ")" */
             ++tab_size;
             param = param->next; /* advance to ")" */
@@ -1274,12 +1571,16 @@ void expand_parameterized_macro(Macro *m)
         if (not_equal(param->lexeme, "...")) { /* or '...' must not have matching arguments */
             ERROR("argument number mismatch in macro call");
         } else {
-            par_arg_tab[tab_size][0] = new_node(PRE_TOK_ID, "__VA_ARGS__");
+            par_arg_tab[tab_size][0] = new_node(PRE_TOK_ID, str_intern("__VA_ARGS__"));
             par_arg_tab[tab_size][1] = NULL;
             ++tab_size;
         }
     }
 
+    for (i = 0; i < tab_size; i++)
+        if (par_arg_tab[i][1] != NULL)
+            par_arg_tab[i][1] = expand_arg(par_arg_tab[i][1]);
+
     /*int i = 0;
     while (i < tab_size) {
         PreTokenNode *p;
@@ -1394,10 +1695,547 @@ void expand_parameterized_macro(Macro *m)
     match2(lookahead(1)); /* ) */
 }
 
+void set_pch_dir(char *dir)
+{
+    pch_dir = dupdir(dir);
+}
+
+#define PCH_MAGIC   0x4850584CU /* "LXPH" */
+#define PCH_VERSION 1
+
+static unsigned long long fnv_str(unsigned long long h, char *s)
+{
+    do {
+        h ^= (unsigned char)*s;
+        h *= 0x100000001B3ULL;
+    } while (*s++ != '\0');
+    return h;
+}
+
+/* FNV-1a hash of the file's content; 0 if the file cannot be read */
+static unsigned long long pch_hash_file(char *path)
+{
+    FILE *fp;
+    unsigned long long h;
+    unsigned char b[4096];
+    size_t i, n;
+
+    if ((fp=fopen(path, "rb")) == NULL)
+        return 0;
+    h = 0xCBF29CE484222325ULL;
+    while ((n=fread(b, 1, sizeof(b), fp)) > 0) {
+        for (i = 0; i < n; i++) {
+            h ^= b[i];
+            h *= 0x100000001B3ULL;
+        }
+    }
+    fclose(fp);
+    return h;
+}
+
+/*
+ * Return the first token that follows the header prefix (the leading
+ * empty, #include, #define and #undef lines of the file, with at least
+ * one #include) and set *last_nl to the new-line
+ * token that ends the prefix. Return NULL if there is no such prefix.
+ */
+static PreTokenNode *pch_prefix_end(PreTokenNode *p, PreTokenNode **last_nl)
+{
+    int ninc;
+
+    ninc = 0;
+    *last_nl = NULL;
+    for (;;) {
+        if (p->token == PRE_TOK_NL) {
+            *last_nl = p;
+            p = p->next;
+        } else if (equal(p->lexeme, "#") && (equal(p->next->lexeme, "include")
+        || equal(p->next->lexeme, "define") || equal(p->next->lexeme, "undef"))) {
+            if (equal(p->next->lexeme, "include"))
+                ++ninc;
+            while (p->token != PRE_TOK_NL) {
+                if (p->token == PRE_TOK_EOF)
+                    return NULL;
+                p = p->next;
+            }
+        } else {
+            break;
+        }
+    }
+    return (ninc > 0) ? p : NULL;
+}
+
 /*
- * Preprocess the source file and any file
- * included through #include, and return a
- * sequence of preprocessing tokens.
+ * The key covers everything the preprocessing of the
+ * prefix depends on except the content of the headers.
+ */
+static unsigned long long pch_key(char *source_file, PreTokenNode *p, PreTokenNode *end)
+{
+    int i;
+    char *s;
+    unsigned long long h;
+
+    h = 0xCBF29CE484222325ULL;
+    h = fnv_str(h, "luxpch");
+    s = strrchr(source_file, '/'); /* #include "..." is relative to the file's directory */
+    for (i = 0; source_file+i != s && s != NULL; i++) {
+        h ^= (unsigned char)source_file[i];
+        h *= 0x100000001B3ULL;
+    }
+    for (i = 0; i < nangle_dirs; i++)
+        h = fnv_str(h, angle_dirs[i]);
+    h = fnv_str(h, "");
+    for (i = 0; i < nquote_dirs; i++)
+        h = fnv_str(h, quote_dirs[i]);
+    h = fnv_str(h, "");
+    for (i = 0; i < MACRO_TABLE_SIZE; i++) {
+        Macro *m;
+        PreTokenNode *q;
+
+        for (m = macro_table[i]; m != NULL; m = m->next) {
+            h = fnv_str(h, m->name);
+            if (m->kind == PARAMETERIZED_MACRO) {
+                for (q = m->params; not_equal(q->lexeme, ")"); q = q->next)
+                    h = fnv_str(h, q->lexeme);
+                h = fnv_str(h, ")");
+            }
+            for (q = m->rep; q->token != PRE_TOK_NL; q = q->next)
+                h = fnv_str(h, q->lexeme);
+            h = fnv_str(h, "\n");
+        }
+    }
+    for (; p != end; p = p->next)
+        h = fnv_str(h, p->lexeme);
+    return h;
+}
+
+static char *pch_file_name(unsigned long long key)
+{
+    int i;
+    char *fname, *p;
+
+    fname = malloc(strlen(pch_dir)+16+4+1);
+    strcpy(fname, pch_dir);
+    p = fname+strlen(fname);
+    for (i = 15; i >= 0; i--)
+        *p++ = "0123456789abcdef"[(key>>(i*4)) & 0xF];
+    strcpy(p, ".pch");
+    return fname;
+}
+
+/*
+ * PCH file writing.
+ */
+static char **pch_files; /* src_file strings referenced by saved tokens */
+static int npch_files;
+
+static void pch_put_u32(FILE *fp, unsigned v)
+{
+    fputc(v & 0xFF, fp);
+    fputc((v>>8) & 0xFF, fp);
+    fputc((v>>16) & 0xFF, fp);
+    fputc((v>>24) & 0xFF, fp);
+}
+
+static void pch_put_u64(FILE *fp, unsigned long long v)
+{
+    pch_put_u32(fp, (unsigned)v);
+    pch_put_u32(fp, (unsigned)(v>>32));
+}
+
+static void pch_put_str(FILE *fp, char *s)
+{
+    unsigned n;
+
+    n = (unsigned)strlen(s);
+    pch_put_u32(fp, n);
+    fwrite(s, 1, n+1, fp);
+}
+
+static unsigned pch_file_index(char *src_file)
+{
+    int i;
+
+    for (i = 0; i < npch_files; i++)
+        if (pch_files[i] == src_file)
+            return i;
+    pch_files = realloc(pch_files, (npch_files+1)*sizeof(char *));
+    pch_files[npch_files] = src_file;
+    return npch_files++;
+}
+
+static int pch_saved(PreTokenNode *p)
+{
+    return (!p->deleted || p->token==PRE_TOK_NL);
+}
+
+static void pch_put_tokens(FILE *fp, PreTokenNode *p, PreTokenNode *end, char *term)
+{
+    unsigned n;
+    PreTokenNode *q;
+
+    /* term != NULL: tokens up to and including the one with lexeme term */
+    for (n = 0, q = p; q != end; q = q->next) {
+        if (term != NULL) {
+            ++n;
+            if (equal(q->lexeme, term))
+                break;
+        } else if (pch_saved(q)) {
+            ++n;
+        }
+    }
+    pch_put_u32(fp, n);
+    for (; n > 0; p = p->next) {
+        if (term==NULL && !pch_saved(p))
+            continue;
+        fputc(p->token, fp);
+        fputc(p->deleted, fp);
+        fputc(p->next_char, fp);
+        pch_put_u32(fp, pch_file_index(p->src_file));
+        pch_put_u32(fp, p->src_line);
+        pch_put_u32(fp, p->src_column);
+        pch_put_str(fp, p->lexeme);
+        --n;
+    }
+}
+
+/*
+ * The file is written under a temporary name and then renamed, so a
+ * concurrent compilation (luxdvr -j) never sees it half written.
+ */
+static void pch_save(char *fname, unsigned long long key, PreTokenNode *list, PreTokenNode *end)
+{
+    int i, fd;
+    FILE *fp;
+    char *tmp;
+    unsigned nmacros;
+    long files_pos;
+
+    /* failures are not errors, the cache is optional */
+    tmp = malloc(strlen(pch_dir)+16);
+    sprintf(tmp, "%stmpXXXXXX", pch_dir);
+    if ((fd=mkstemp(tmp)) == -1) {
+        free(tmp);
+        return;
+    }
+    close(fd);
+    if ((fp=fopen(tmp, "wb")) == NULL) {
+        remove(tmp);
+        free(tmp);
+        return;
+    }
+    npch_files = 0;
+    pch_put_u32(fp, PCH_MAGIC);
+    pch_put_u32(fp, PCH_VERSION);
+    pch_put_u64(fp, key);
+
+    /* headers the result depends on */
+    pch_put_u32(fp, npch_deps);
+    for (i = 0; i < npch_deps; i++) {
+        pch_put_str(fp, pch_deps[i]);
+        pch_put_u64(fp, pch_hash_file(pch_deps[i]));
+    }
+
+    /* tokens */
+    pch_put_tokens(fp, list, end, NULL);
+
+    /* macro table */
+    for (nmacros = 0, i = 0; i < MACRO_TABLE_SIZE; i++) {
+        Macro *m;
+
+        for (m = macro_table[i]; m != NULL; m = m->next)
+            ++nmacros;
+    }
+    pch_put_u32(fp, nmacros);
+    for (i = 0; i < MACRO_TABLE_SIZE; i++) {
+        Macro *m;
+
+        for (m = macro_table[i]; m != NULL; m = m->next) {
+            pch_put_str(fp, m->name);
+            fputc(m->kind, fp);
+            if (m->kind == PARAMETERIZED_MACRO)
+                pch_put_tokens(fp, m->params, NULL, ")");
+            pch_put_tokens(fp, m->rep, NULL, "\n");
+        }
+    }
+
+    /* include guards & #pragma once */
+    for (nmacros = 0, i = 0; i < FILE_TABLE_SIZE; i++) {
+        struct IncFile *f;
+
+        for (f = file_table[i]; f != NULL; f = f->next)
+            ++nmacros;
+    }
+    pch_put_u32(fp, nmacros);
+    for (i = 0; i < FILE_TABLE_SIZE; i++) {
+        struct IncFile *f;
+
+        for (f = file_table[i]; f != NULL; f = f->next) {
+            pch_put_str(fp, f->path);
+            pch_put_str(fp, (f->guard != NULL) ? f->guard : "");
+            fputc(f->once, fp);
+        }
+    }
+
+    /* file names referenced by the tokens */
+    files_pos = ftell(fp);
+    pch_put_u32(fp, npch_files);
+    for (i = 0; i < npch_files; i++)
+        pch_put_str(fp, pch_files[i]);
+
+    /* trailer (an incomplete file is just a cache miss) */
+    pch_put_u32(fp, (unsigned)files_pos);
+    pch_put_u32(fp, PCH_MAGIC);
+    i = ferror(fp);
+    if (fclose(fp)!=0 || i || rename(tmp, fname)!=0)
+        remove(tmp);
+    free(tmp);
+}
+
+/*
+ * PCH file reading. The whole file is read into memory and
+ * lexemes and file names are used in place. (It is not mapped:
+ * luxcc must also run on its own C library and the VM, which
+ * have no mmap.)
+ */
+static unsigned char *pch_buf, *pch_ptr, *pch_end;
+static int pch_bad;
+
+static unsigned pch_get_u32(void)
+{
+    unsigned v;
+
+    if (pch_end-pch_ptr < 4) {
+        pch_bad = TRUE;
+        return 0;
+    }
+    v = pch_ptr[0] | pch_ptr[1]<<8 | pch_ptr[2]<<16 | (unsigned)pch_ptr[3]<<24;
+    pch_ptr += 4;
+    return v;
+}
+
+static unsigned long long pch_get_u64(void)
+{
+    unsigned long long v;
+
+    v = pch_get_u32();
+    return v | (unsigned long long)pch_get_u32()<<32;
+}
+
+static int pch_get_byte(void)
+{
+    if (pch_ptr >= pch_end) {
+        pch_bad = TRUE;
+        return 0;
+    }
+    return *pch_ptr++;
+}
+
+static char *pch_get_str(void)
+{
+    unsigned n;
+    char *s;
+
+    n = pch_get_u32();
+    if (pch_bad || (unsigned)(pch_end-pch_ptr) < n+1) {
+        pch_bad = TRUE;
+        return "";
+    }
+    s = (char *)pch_ptr;
+    pch_ptr += n+1;
+    return s;
+}
+
+static PreTokenNode *pch_get_tokens(char **files, unsigned nfiles, PreTokenNode **last)
+{
+    unsigned n, f;
+    PreTokenNode *first, *p;
+
+    first = p = NULL;
+    for (n = pch_get_u32(); n>0 && !pch_bad; n--) {
+        PreTokenNode *q;
+
+        q = arena_alloc(pre_node_arena, sizeof(PreTokenNode));
+        q->token = (PreToken)pch_get_byte();
+        q->deleted = (char)pch_get_byte();
+        q->next_char = (char)pch_get_byte();
+        if ((f=pch_get_u32()) >= nfiles)
+            pch_bad = TRUE;
+        else
+            q->src_file = files[f];
+        q->src_line = (int)pch_get_u32();
+        q->src_column = (int)pch_get_u32();
+        q->lexeme = pch_get_str();
+        if (!pch_bad && (q->token==PRE_TOK_ID || q->token==PRE_TOK_MACRO_REENABLER))
+            q->lexeme = str_intern(q->lexeme);
+        q->next = NULL;
+        if (first == NULL)
+            first = q;
+        else
+            p->next = q;
+        p = q;
+        ++stat_number_of_pre_tokens;
+    }
+    if (last != NULL)
+        *last = p;
+    return first;
+}
+
+/*
+ * Load the PCH file fname. Return the token list for the
+ * prefix and set *last to its last node, or return NULL if
+ * the file does not exist or is stale.
+ */
+static PreTokenNode *pch_load(char *fname, unsigned long long key, PreTokenNode **last)
+{
+    FILE *fp;
+    long size;
+    unsigned i, n, nfiles;
+    unsigned char *toks;
+    char **files;
+    PreTokenNode *list;
+
+    if ((fp=fopen(fname, "rb")) == NULL)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+    if (size < 24) {
+        fclose(fp);
+        return NULL;
+    }
+    pch_buf = malloc(size);
+    if (fread(pch_buf, 1, size, fp) != (size_t)size) {
+        fclose(fp);
+        goto bad;
+    }
+    fclose(fp);
+    pch_bad = FALSE;
+
+    /* check trailer & header */
+    pch_ptr = pch_buf+size-8, pch_end = pch_buf+size;
+    n = pch_get_u32();
+    if (pch_get_u32()!=PCH_MAGIC || n>=(unsigned)size-8)
+        goto bad;
+    pch_ptr = pch_buf, pch_end = pch_buf+size-8;
+    if (pch_get_u32()!=PCH_MAGIC || pch_get_u32()!=PCH_VERSION || pch_get_u64()!=key)
+        goto bad;
+
+    /* all the headers must be unchanged */
+    for (i = pch_get_u32(); i>0 && !pch_bad; i--) {
+        char *path;
+        unsigned long long h;
+
+        path = pch_get_str();
+        h = pch_get_u64();
+        if (pch_bad || pch_hash_file(path)!=h)
+            goto bad;
+        add_dep(lookup_file(path));
+    }
+    toks = pch_ptr;
+
+    /* the file names are needed to build the tokens */
+    pch_ptr = pch_buf+n;
+    nfiles = pch_get_u32();
+    files = malloc((nfiles+1)*sizeof(char *));
+    for (i = 0; i < nfiles; i++)
+        files[i] = pch_get_str();
+    if (pch_bad)
+        goto bad;
+    pch_end = pch_buf+n;
+    pch_ptr = toks;
+
+    list = pch_get_tokens(files, nfiles, last);
+    if (pch_bad || list==NULL)
+        goto bad;
+
+    /* replace the current macro table */
+    for (i = 0; i < MACRO_TABLE_SIZE; i++) {
+        Macro *m, *next;
+
+        for (m = macro_table[i]; m != NULL; m = next) {
+            next = m->next;
+            free(m);
+        }
+        macro_table[i] = NULL;
+    }
+    for (i = pch_get_u32(); i>0 && !pch_bad; i--) {
+        char *name;
+        MacroKind kind;
+        PreTokenNode *params, *rep;
+
+        name = pch_get_str();
+        kind = (MacroKind)pch_get_byte();
+        params = (kind == PARAMETERIZED_MACRO) ? pch_get_tokens(files, nfiles, NULL) : NULL;
+        rep = pch_get_tokens(files, nfiles, NULL);
+        if (!pch_bad)
+            install_macro(kind, str_intern(name), rep, params);
+    }
+
+    /* include guards & #pragma once */
+    for (i = pch_get_u32(); i>0 && !pch_bad; i--) {
+        struct IncFile *f;
+        char *guard;
+
+        f = lookup_file(pch_get_str());
+        guard = pch_get_str();
+        f->guard = (*guard != '\0') ? str_intern(guard) : NULL;
+        f->once = pch_get_byte();
+    }
+    if (pch_bad) /* the macro table is in an unknown state */
+        TERMINATE("Corrupted precompiled header `%s'", fname);
+    free(files);
+    return list;
+bad:
+    free(pch_buf);
+    return NULL;
+}
+
+/*
+ * Preprocess the header prefix of the token list *list, or
+ * replace it by the content of a previously saved PCH file.
+ * Leave curr_tok at the first token following the prefix.
+ */
+static void pch_preprocess_prefix(char *source_file, PreTokenNode **list)
+{
+    unsigned long long key;
+    char *fname;
+    PreTokenNode *end, *last_nl, *last, *eof, *p;
+
+    if ((end=pch_prefix_end(*list, &last_nl)) == NULL)
+        return;
+    key = pch_key(source_file, *list, end);
+    fname = pch_file_name(key);
+
+    if ((p=pch_load(fname, key, &last)) != NULL) {
+        last->next = end;
+        *list = p;
+        curr_tok = end;
+        ++stat_number_of_pch_hits;
+        free(fname);
+        return;
+    }
+
+    /* preprocess the prefix on its own */
+    eof = new_node(PRE_TOK_EOF, "");
+    last_nl->next = eof;
+    npch_deps = 0;
+    pch_recording = TRUE;
+    preprocessing_file();
+    pch_recording = FALSE;
+    for (p = *list; p->next != eof; p = p->next)
+        ;
+    p->next = end;
+    pch_save(fname, key, *list, end);
+    curr_tok = end;
+    free(fname);
+}
+
+/*
+ * Set up the preprocessing of the source file and
+ * return the first preprocessing token. The actual
+ * preprocessing is driven by pre_get() as the
+ * tokens are requested.
  */
 PreTokenNode *preprocess(char *source_file)
 {
@@ -1405,12 +2243,35 @@ PreTokenNode *preprocess(char *source_file)
 
     pre_node_arena = arena_new(sizeof(PreTokenNode)*128, FALSE);
     pre_str_arena = arena_new(1024, FALSE);
+    file_macro_name = str_intern("__FILE__");
+    line_macro_name = str_intern("__LINE__");
     init(source_file);
     token_list = curr_tok = tokenize();
-    preprocessing_file();
+    pre_done = FALSE;
+    if (pch_dir != NULL)
+        pch_preprocess_prefix(source_file, &token_list);
     return token_list;
 }
 
+/*
+ * Return `p' after making sure it has already been through
+ * preprocessing. Lines are preprocessed one group part at a
+ * time, and only when a consumer asks for a token that has
+ * not been preprocessed yet.
+ */
+PreTokenNode *pre_get(PreTokenNode *p)
+{
+    while (p==curr_tok && !pre_done) {
+        if (lookahead(1) == PRE_TOK_EOF)
+            pre_done = TRUE;
+        else if (is_group_part())
+            group_part(FALSE);
+        else
+            match(PRE_TOK_EOF); /* stray #elif, #else, or #endif */
+    }
+    return p;
+}
+
 /*                                 */
 /* Expression evaluation functions */
 /*                                 */
@@ -1,6 +1,8 @@
 #ifndef PRE_H_
 #define PRE_H_
 
+#include <stdio.h>
+
 typedef enum {
     PRE_TOK_EOF,
     PRE_TOK_PUNCTUATOR,
@@ -29,8 +31,12 @@ typedef enum {
 } MacroKind;
 
 PreTokenNode *preprocess(char *source_file);
+PreTokenNode *pre_get(PreTokenNode *p);
+void pre_release(PreTokenNode *p);
 void install_macro(MacroKind kind, char *name, PreTokenNode *rep, PreTokenNode *params);
 void add_angle_dir(char *dir);
 void add_quote_dir(char *dir);
+void set_pch_dir(char *dir);
+void pre_write_deps(FILE *fp, char *target, char *source_file);
 
 #endif
@@ -10,18 +10,18 @@
 #include "expr.h"
 #include "error.h"
 #include "arena.h"
+#include "intern.h"
 #include "imp_lim.h"
 
-#define ERROR(tok, ...) emit_error(FALSE, (tok)->info->src_file, (tok)->info->src_line, (tok)->info->src_column, __VA_ARGS__)
+#define ERROR(tok, ...) emit_error(FALSE, tok_src_file((tok)->info), tok_src_line((tok)->info), tok_src_column((tok)->info), __VA_ARGS__)
 #define ERROR_R(tok, ...)\
     do {\
         ERROR(tok, __VA_ARGS__);\
         return;\
     } while (0)
-#define WARNING(tok, ...) emit_warning((tok)->info->src_file, (tok)->info->src_line, (tok)->info->src_column, __VA_ARGS__)
+#define WARNING(tok, ...) emit_warning(tok_src_file((tok)->info), tok_src_line((tok)->info), tok_src_column((tok)->info), __VA_ARGS__)
 
 #define HASH_SIZE     4093
-#define HASH_VAL(s)   (hash(s)%HASH_SIZE)
 #define HASH_VAL2(x)  (hash2(x)%HASH_SIZE)
 
 typedef struct UnresolvedGoto UnresolvedGoto;
@@ -131,8 +131,8 @@ LabelName *lookup_label_name(char *name)
 {
     LabelName *np;
 
-    for (np = label_names[HASH_VAL(name)]; np != NULL; np = np->next)
-        if (equal(name, np->name))
+    for (np = label_names[istr_hash(name)%HASH_SIZE]; np != NULL; np = np->next)
+        if (name == np->name)
             return np;
     return NULL; /* not found */
 }
@@ -142,9 +142,9 @@ int install_label_name(char *name)
     unsigned h;
     LabelName *np;
 
-    h = HASH_VAL(name);
+    h = istr_hash(name)%HASH_SIZE; /* label names are interned */
     for (np = label_names[h]; np != NULL; np = np->next)
-        if (equal(name, np->name))
+        if (name == np->name)
             break;
 
     if (np == NULL) {
@@ -63,6 +63,11 @@ char *string_curr(String *s)
     return s->buf+s->buf_next;
 }
 
+char *string_buf(String *s)
+{
+    return s->buf;
+}
+
 unsigned string_get_pos(String *s)
 {
     return s->buf_next;
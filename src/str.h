@@ -15,6 +15,7 @@ int string_printf(String *s, char *fmt, ...);
 void string_write(String *s, FILE *fp);
 void string_clear(String *s);
 char *string_curr(String *s);
+char *string_buf(String *s);
 unsigned string_get_pos(String *s);
 void string_set_pos(String *s, unsigned n);
 
@@ -0,0 +1,38 @@
+#include <stdio.h>
+
+int fs, cs;
+
+void f(int x)
+{
+    printf("f(%d)\n", x);
+}
+
+void h(void)
+{
+    if (cs != 1) {
+        if (1==0 && fs)
+            f(1);
+        else
+            f(2);
+        cs = 1;
+    }
+}
+
+void g(void)
+{
+    if (2 != 2 || fs)
+        f(3);
+    else if (3 == 3)
+        f(4);
+}
+
+int main(void)
+{
+    h();
+    h();
+    g();
+    fs = 1;
+    g();
+    printf("cs=%d\n", cs);
+    return 0;
+}
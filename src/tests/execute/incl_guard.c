@@ -0,0 +1,12 @@
+#include <stdio.h>
+#include "incl_guard.h"
+#include "incl_guard.h"
+#include "./incl_guard.h"
+#include "incl_once.h"
+#include "../execute/incl_once.h"
+
+int main(void)
+{
+    printf("%d %d\n", guarded, once);
+    return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef INCL_GUARD_H
+#define INCL_GUARD_H
+
+static int guarded = 1;
+
+#endif
@@ -0,0 +1,3 @@
+#pragma once
+
+static int once = 2;
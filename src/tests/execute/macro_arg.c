@@ -0,0 +1,31 @@
+#include <stdio.h>
+
+/* macro arguments are fully expanded before substitution */
+
+#define F(x)        (x+1)
+#define G(x, y)     x*y
+#define E
+#define ID(x)       x
+#define APPLY(f)    f(2)
+#define LCHILD(n)   ((n)->child[0])
+
+struct node {
+    int val;
+    struct node *child[2];
+};
+
+int main(void)
+{
+    struct node a, b, c;
+
+    a.val = 1, a.child[0] = &b;
+    b.val = 2, b.child[0] = &c;
+    c.val = 3, c.child[0] = NULL;
+
+    printf("%d\n", F(F(F(1))));
+    printf("%d\n", G(F(1), F(2)));
+    printf("%d\n", ID(ID(5)) E);
+    printf("%d\n", APPLY(F));
+    printf("%d\n", LCHILD(LCHILD(&a))->val);
+    return 0;
+}
@@ -0,0 +1,11 @@
+#include <stdio.h>
+
+int label_diff_add(void);
+int label_diff_sub(void);
+
+int main(void)
+{
+    printf("%d\n", label_diff_add());
+    printf("%d\n", label_diff_sub());
+    return 0;
+}
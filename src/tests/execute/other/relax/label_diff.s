@@ -0,0 +1,25 @@
+; The immediates below are label differences that grow when the
+; `jmp L4' is relaxed to its long form (from 126 to 129).
+
+segment .text
+
+global label_diff_add
+label_diff_add:
+    mov ecx, 0
+    jmp L3
+L1: jmp L4
+    times 124 nop
+L2:
+L3: add ecx, L2-L1
+    mov eax, ecx
+L4: ret
+
+global label_diff_sub
+label_diff_sub:
+    mov eax, 1000
+    jmp M3
+M1: jmp M4
+    times 124 nop
+M2:
+M3: sub eax, M2-M1
+M4: ret
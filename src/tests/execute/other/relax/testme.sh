@@ -0,0 +1,31 @@
+#!/bin/bash
+CC=src/luxdvr/luxdvr
+CFLAGS="-m$1 -q"
+TESTDIR=`dirname $0`
+
+fail_counter=0
+
+for file in $TESTDIR/*.s ; do
+	if ! $CC $CFLAGS ${file%.*}.c $file -o $TESTDIR/out1 &>/dev/null ; then
+		echo "Failed to compile $file"
+		let fail_counter=fail_counter+1
+		continue
+	fi
+
+	$TESTDIR/out1 >"${file%.*}.output"
+
+	if ! cmp -s "${file%.*}.output" "${file%.*}.expect" ; then
+		echo "Relaxation failed with $file"
+		let fail_counter=fail_counter+1
+	fi
+	rm -f "${file%.*}.output"
+done
+rm -f $TESTDIR/out1
+
+if [ "$fail_counter" = "0" ] ; then
+	echo "Relaxation succeeded!"
+	exit 0
+else
+	echo "Relaxation failed!"
+	exit 1
+fi
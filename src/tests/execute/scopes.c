@@ -0,0 +1,56 @@
+#include <stdio.h>
+
+struct S { int a; };
+int x = 1;
+
+int f(int f)
+{
+    return f+1;
+}
+
+int main(void)
+{
+    int x = 2;
+    struct S s;
+
+    s.a = x;
+    {
+        int x = 3;
+        struct S { char b[32]; } t;
+
+        printf("%d %d\n", x, (int)sizeof(t));
+        { int y0 = x;
+        { int y1 = y0+1;
+        { int y2 = y1+1;
+        { int y3 = y2+1;
+        { int y4 = y3+1;
+        { int y5 = y4+1;
+        { int y6 = y5+1;
+        { int y7 = y6+1;
+        { int y8 = y7+1;
+        { int y9 = y8+1;
+        { int y10 = y9+1;
+        { int y11 = y10+1;
+        { int y12 = y11+1;
+        { int y13 = y12+1;
+        { int y14 = y13+1;
+        { int y15 = y14+1;
+        { int y16 = y15+1;
+        { int y17 = y16+1;
+        { int y18 = y17+1;
+        { int y19 = y18+1;
+        { int y20 = y19+1;
+        { int y21 = y20+1;
+        { int y22 = y21+1;
+        { int y23 = y22+1;
+            printf("%d\n", y23);
+        }}}}}}}}}}}}}}}}}}}}}}}}
+    }
+    printf("%d %d %d %d\n", x, s.a, (int)sizeof(s), f(x));
+    {
+        extern int x;
+
+        printf("%d\n", x);
+    }
+    return 0;
+}
@@ -0,0 +1,40 @@
+#include <stdio.h>
+
+static int g;
+static int h;
+
+long long f(long long a, long long b)
+{
+    g = g + 3;
+    return a / b + g;
+}
+
+long long m(long long a, long long b)
+{
+    g = g * 2;
+    h = g + 1;
+    return a % b + a * b + g + h;
+}
+
+void bump(void)
+{
+    h += 10;
+}
+
+int k(void)
+{
+    g = g + 1;
+    h = h + 1;
+    bump();
+    return g + h;
+}
+
+int main(void)
+{
+    printf("%lld\n", f(100, 7));
+    printf("%lld\n", f(-100, 7));
+    printf("%lld\n", m(1000, 33));
+    printf("%d\n", k());
+    printf("%d %d\n", g, h);
+    return 0;
+}
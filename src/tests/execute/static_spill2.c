@@ -0,0 +1,33 @@
+#include <stdio.h>
+
+static int a = 1, b = 2;
+static int *p = &a;
+static int *q = &a;
+
+int get(void)
+{
+    return *p;
+}
+
+void put(int v)
+{
+    *q = v;
+}
+
+int main(void)
+{
+    int n;
+
+    p = &b;
+    n = p != 0;
+    n += get();
+    n += p == &b;
+    printf("%d\n", n);
+
+    q = &b;
+    n = q != 0;
+    put(7);
+    n += q == &b;
+    printf("%d %d %d\n", n, a, b);
+    return 0;
+}
@@ -30,6 +30,7 @@
 #include "../dflow.h"
 #include "../str.h"
 #include "../luxcc.h"
+#include "../peep.h"
 
 typedef enum {
     X64_RAX,
@@ -46,6 +47,7 @@ typedef enum {
     X64_R13,
     X64_R14,
     X64_R15,
+    X64_RBP, /* only allocated when the frame pointer is omitted */
     X64_NREG,
 } X64_Reg;
 
@@ -68,6 +70,7 @@ static char *x64_reg_str[] = {
     "r13",
     "r14",
     "r15",
+    "rbp",
 };
 static char *x64_ldreg_str[] = {
     "eax",
@@ -84,6 +87,7 @@ static char *x64_ldreg_str[] = {
     "r13d",
     "r14d",
     "r15d",
+    "ebp",
 };
 static char *x64_lwreg_str[] = {
     "ax",
@@ -100,6 +104,7 @@ static char *x64_lwreg_str[] = {
     "r13w",
     "r14w",
     "r15w",
+    "bp",
 };
 static char *x64_lbreg_str[] = {
     "al",
@@ -116,6 +121,7 @@ static char *x64_lbreg_str[] = {
     "r13b",
     "r14b",
     "r15b",
+    "bpl",
 };
 static X64_Reg x64_arg_reg[] = {
     X64_RDI,
@@ -126,10 +132,21 @@ static X64_Reg x64_arg_reg[] = {
     X64_R9,
 };
 
+/*
+ * Block copies/fills of up to INLINE_UNROLL_MAX bytes are expanded into
+ * moves, those of up to INLINE_REP_MAX bytes use 'rep movsb/stosb', and
+ * memcpy/memset calls of more bytes than that are left alone.
+ */
+#define INLINE_UNROLL_MAX   64
+#define INLINE_REP_MAX      1024
+
 static int size_of_local_area;
 static char *curr_func, *enclosing_function;
+static unsigned curr_cg_node;
 static unsigned temp_struct_size;
 static int big_return;
+static int omit_fp;
+#define X64_RED_ZONE_SIZE 128
 static int arg_stack[64], arg_stack_top;
 static int arg_reg_avail = 6;
 static unsigned calls_to_fix[64];
@@ -158,13 +175,6 @@ static char *str_segment[] = {
     ".bss",
     ".rodata"
 };
-#define SET_SEGMENT(seg, f)\
-    do {\
-        if (curr_segment != seg) {\
-            f("segment %s", str_segment[seg]);\
-            curr_segment = seg;\
-        }\
-    } while(0)
 
 static int new_string_literal(unsigned a);
 static void emit_raw_string(String *q, char *s);
@@ -180,6 +190,18 @@ static String *func_body, *func_prolog, *func_epilog, *asm_decls, *str_lits;
 #define emit_str(...)       (string_printf(str_lits, __VA_ARGS__))
 #define emit_strln(...)     (string_printf(str_lits, __VA_ARGS__), string_printf(str_lits, "\n"))
 
+/* with -ffunction-sections each function goes into its own .text.<name> section */
+static void set_segment(String *s, int seg)
+{
+    if (curr_segment == seg)
+        return;
+    if (seg == TEXT_SEG && function_sections)
+        string_printf(s, "segment .text.%s\n", curr_func);
+    else
+        string_printf(s, "segment %s\n", str_segment[seg]);
+    curr_segment = seg;
+}
+
 static X64_Reg *addr_descr_tab;
 static unsigned reg_descr_tab[X64_NREG];
 #define addr_reg(a)     (addr_descr_tab[address_nid(a)])
@@ -188,8 +210,9 @@ static void dump_addr_descr_tab(void);
 static void dump_reg_descr_tab(void);
 
 static void spill_reg(X64_Reg r);
-static void spill_all(void);
-static void spill_aliased_objects(void);
+static void spill_aliased_objects(int i);
+static void spill_objects(BSet *s);
+static void spill_for_call(unsigned effects, BSet *mso);
 static X64_Reg get_reg(int intr);
 static X64_Reg get_reg0(void);
 
@@ -198,6 +221,7 @@ static void x64_load_addr(X64_Reg r, unsigned a);
 static char *x64_get_operand32(unsigned a);
 static char *x64_get_operand64(unsigned a);
 static void x64_store(X64_Reg r, unsigned a);
+static void x64_copy_block(unsigned siz);
 static void x64_compare_against_constant(unsigned a, int c);
 static void x64_function_definition(TypeExp *decl_specs, TypeExp *header);
 
@@ -271,31 +295,109 @@ void spill_reg(X64_Reg r)
     reg_descr_tab[r] = 0;
 }
 
-void spill_all(void)
+/*
+ * Spill the objects the pointer operand of quad i may point to.
+ * => Possible improvement: use type information to narrow down the set
+ * of objects to spill (see 6.5#7).
+ */
+void spill_aliased_objects(int i)
 {
-    int i;
+    spill_objects(ind_pointees(i));
+}
 
-    for (i = 0; i < X64_NREG; i++)
-        spill_reg((X64_Reg)i);
+/*
+ * Spill the objects of set s currently held in registers.
+ */
+void spill_objects(BSet *s)
+{
+    int r;
+
+    for (r = 0; r < X64_NREG; r++) {
+        unsigned a;
+
+        if (reg_isempty(r))
+            continue;
+        a = reg_descr_tab[r];
+        if (address(a).kind==IdKind && bset_member(s, address_nid(a)))
+            spill_reg(r);
+    }
+}
+
+static int x64_is_callee_saved(X64_Reg r)
+{
+    return (r==X64_RBX || r>=X64_R12);
 }
 
 /*
- * Currently all address-taken variables are considered to be aliased.
- * => Possible improvement: use type information to narrow down the set
- * of objects to spill (see 6.5#7).
+ * Prepare the register file for a call to a function whose side effects
+ * are summarized by 'effects' and 'mso' (the static objects it may modify).
+ * Values the callee cannot see survive the call, moved into a callee-saved
+ * register if necessary. Values the callee may modify are spilled and values
+ * it may read are written back.
  */
-void spill_aliased_objects(void)
+void spill_for_call(unsigned effects, BSet *mso)
 {
     int i;
+    int moved[X64_NREG] = { 0 };
 
     for (i = 0; i < X64_NREG; i++) {
         unsigned a;
+        int is_static, is_aliased, must_spill, must_store;
 
-        if (reg_isempty(i))
+        if (reg_isempty(i) || moved[i])
             continue;
         a = reg_descr_tab[i];
-        if (address(a).kind==IdKind && bset_member(address_taken_variables, address_nid(a)))
-            spill_reg(i);
+        is_static = is_aliased = FALSE;
+        if (address(a).kind == IdKind) {
+            Token cat;
+            ExecNode *e;
+
+            e = address(a).cont.var.e;
+            /*
+             * Structs are copied on spill and char/short values are only
+             * narrowed when stored, so these always go back to memory.
+             */
+            switch (cat = get_type_category(&e->type)) {
+            case TOK_STRUCT: case TOK_UNION:
+            case TOK_CHAR: case TOK_SIGNED_CHAR: case TOK_UNSIGNED_CHAR:
+            case TOK_SHORT: case TOK_UNSIGNED_SHORT:
+                spill_reg((X64_Reg)i);
+                continue;
+            }
+            is_static = (e->attr.var.duration == DURATION_STATIC);
+            is_aliased = bset_member(cg_node(curr_cg_node).aliased_objects, address_nid(a));
+        }
+        must_spill = must_store = FALSE;
+        if (is_static) {
+            must_spill = (effects&SE_UNKNOWN) || (mso!=NULL && bset_member(mso, address_nid(a)))
+                      || ((effects&SE_WRITES_PTR) && is_aliased);
+            must_store = (effects&SE_READS_STATIC) || ((effects&SE_READS_PTR) && is_aliased);
+        } else if (is_aliased) {
+            must_spill = (effects&(SE_UNKNOWN|SE_WRITES_PTR)) != 0;
+            must_store = (effects&SE_READS_PTR) != 0;
+        }
+        if (must_spill) {
+            spill_reg((X64_Reg)i);
+            continue;
+        }
+        if (must_store)
+            x64_store((X64_Reg)i, a);
+        if (!x64_is_callee_saved((X64_Reg)i)) {
+            int c;
+
+            for (c = X64_RBX; c < X64_NREG; c++)
+                if (x64_is_callee_saved((X64_Reg)c) && !pinned[c] && reg_isempty(c))
+                    break;
+            if (c == X64_NREG) {
+                spill_reg((X64_Reg)i);
+                continue;
+            }
+            modified[c] = moved[c] = TRUE;
+            emitln("mov %s, %s", x64_reg_str[c], x64_reg_str[i]);
+            reg_descr_tab[c] = a;
+            addr_reg(a) = c;
+            reg_descr_tab[i] = 0;
+        }
     }
 }
 
@@ -653,6 +755,38 @@ void x64_load_addr(X64_Reg r, unsigned a)
     }
 }
 
+/*
+ * Copy siz bytes from [rsi] to [rdi]. rcx is used as scratch register.
+ */
+void x64_copy_block(unsigned siz)
+{
+    unsigned n;
+
+    if (siz > INLINE_UNROLL_MAX) {
+        emitln("mov ecx, %u", siz);
+        emitln("rep movsb");
+        return;
+    }
+    for (n = 0; siz-n >= 8; n += 8) {
+        emitln("mov rcx, qword [rsi+%u]", n);
+        emitln("mov qword [rdi+%u], rcx", n);
+    }
+    if (siz-n >= 4) {
+        emitln("mov ecx, dword [rsi+%u]", n);
+        emitln("mov dword [rdi+%u], ecx", n);
+        n += 4;
+    }
+    if (siz-n >= 2) {
+        emitln("mov cx, word [rsi+%u]", n);
+        emitln("mov word [rdi+%u], cx", n);
+        n += 2;
+    }
+    if (siz-n >= 1) {
+        emitln("mov cl, byte [rsi+%u]", n);
+        emitln("mov byte [rdi+%u], cl", n);
+    }
+}
+
 void x64_store(X64_Reg r, unsigned a)
 {
     if (address(a).kind == IdKind) {
@@ -684,8 +818,7 @@ void x64_store(X64_Reg r, unsigned a)
                 cluttered |= 4;
                 emitln("push rcx");
             }
-            emitln("mov ecx, %u", get_sizeof(&e->type));
-            emitln("rep movsb");
+            x64_copy_block(get_sizeof(&e->type));
             /* restore all */
             if (cluttered & 4)
                 emitln("pop rcx");
@@ -1432,7 +1565,7 @@ static void x64_ind(int i, unsigned tar, unsigned arg1, unsigned arg2)
     char *reg_str;
 
     /* spill any target currently in a register */
-    spill_aliased_objects();
+    spill_aliased_objects(i);
 
     res = get_reg(i);
     x64_load(res, arg1);
@@ -1481,10 +1614,20 @@ static int x64_pre_call(int i, unsigned arg2)
 {
     Token cat;
     int na, nb, offs;
-    int top;
+    int top, stk;
     unsigned siz;
 
-    spill_all();
+    if (instruction(i).op == OpCall) {
+        int fn;
+
+        fn = cg_node_lookup(address(instruction(i).arg1).cont.var.e->attr.str);
+        if (fn==-1 || cg_node_is_empty(fn))
+            spill_for_call(SE_UNKNOWN, NULL);
+        else
+            spill_for_call(cg_node(fn).side_effects, cg_node(fn).modified_static_objects_tr);
+    } else {
+        spill_for_call(SE_UNKNOWN, NULL);
+    }
 
     if ((cat=get_type_category(instruction(i).type))==TOK_STRUCT || cat==TOK_UNION) {
         siz = get_sizeof(instruction(i).type);
@@ -1498,14 +1641,14 @@ static int x64_pre_call(int i, unsigned arg2)
         }
     }
 
-    offs = 0;
+    offs = stk = 0;
     top = arg_stack_top;
 
     /* pass register arguments (left-to-right) */
     for (na = (int)address(arg2).cont.val; na != 0; na--) {
         siz = arg_stack[--top];
         if (siz>16 || siz>arg_reg_avail*8) {
-            ;
+            stk += siz;
         } else {
             X64_Reg r;
 
@@ -1525,6 +1668,19 @@ static int x64_pre_call(int i, unsigned arg2)
     arg_stack_top = top;
     nb = offs;
 
+    /*
+     * Keep rsp 16-byte aligned at the call. The frame is aligned by the
+     * prologue, so only count what is currently pushed (this call's arguments
+     * plus the arguments of any enclosing call still being evaluated).
+     */
+    for (na = 0; na < top; na++)
+        stk += arg_stack[na];
+    if ((nb+stk) % 16) {
+        emitln("sub rsp, 8");
+        offs += 8;
+        nb += 8;
+    }
+
     /* pass stack arguments (right-to-left) */
     for (na = (int)address(arg2).cont.val; na != 0; na--) {
         unsigned siz;
@@ -1545,6 +1701,10 @@ static int x64_pre_call(int i, unsigned arg2)
                 emitln("push qword [rsp+%d]", offs-siz+8);
                 break;
             default:
+                /* r12 and r13 are callee-saved and may hold values live across the call */
+                spill_reg(X64_R12);
+                spill_reg(X64_R13);
+                modified[X64_R12] = modified[X64_R13] = TRUE;
 				/* save */
 				emitln("mov r11, rdi");
 				emitln("mov r12, rsi");
@@ -1553,8 +1713,7 @@ static int x64_pre_call(int i, unsigned arg2)
                 emitln("sub rsp, %u", siz);
                 emitln("lea rsi, [rsp+%d]", offs);
                 emitln("mov rdi, rsp");
-                emitln("mov rcx, %u", siz);
-                emitln("rep movsb");
+                x64_copy_block(siz);
                 /* restore */
                 emitln("mov rdi, r11");
                 emitln("mov rsi, r12");
@@ -1610,10 +1769,88 @@ static void x64_indcall(int i, unsigned tar, unsigned arg1, unsigned arg2)
         update_tar_descriptors(X64_RAX, tar, tar_liveness(i), tar_next_use(i));
 }
 
+/*
+ * Expand inline a call to the library memcpy/memset (such as those
+ * emitted for struct and array initializers) when the number of bytes
+ * is a small constant. The arguments have already been pushed.
+ */
+static int x64_inline_memop(int i, unsigned tar, unsigned arg1, unsigned arg2)
+{
+    int j, na, fn, is_memset;
+    unsigned args[3], siz, n;
+    char *id;
+
+    id = address(arg1).cont.var.e->attr.str;
+    if (!(is_memset=equal(id, "memset")) && !equal(id, "memcpy"))
+        return FALSE;
+    if (address(arg2).cont.val!=3 || tar && tar_liveness(i))
+        return FALSE;
+    if ((fn=cg_node_lookup(id))!=-1 && !cg_node_is_empty(fn))
+        return FALSE; /* not the library function */
+    /* args[0] = dest, args[1] = src/value, args[2] = count */
+    for (j = i-1, na = 0; na < 3; j--) {
+        if (instruction(j).op==OpCall || instruction(j).op==OpIndCall)
+            return FALSE;
+        if (instruction(j).op == OpArg)
+            args[na++] = instruction(j).arg1;
+    }
+    if (address(args[2]).kind != IConstKind
+    || (siz=(unsigned)address(args[2]).cont.uval) > INLINE_REP_MAX)
+        return FALSE;
+    for (na = 1; na <= 3; na++)
+        if (arg_stack[arg_stack_top-na] != 8)
+            return FALSE;
+    arg_stack_top -= 3;
+
+    /* the destination/source may be any aliased object */
+    spill_objects(cg_node(curr_cg_node).aliased_objects);
+    spill_reg(X64_RDI);
+    spill_reg(X64_RCX);
+    emitln("pop rdi");
+    if (!is_memset) {
+        spill_reg(X64_RSI);
+        emitln("pop rsi");
+        emitln("add rsp, 8");
+        x64_copy_block(siz);
+        return TRUE;
+    }
+    spill_reg(X64_RAX);
+    if (address(args[1]).kind==IConstKind && siz<=INLINE_UNROLL_MAX) {
+        unsigned long long pat;
+
+        emitln("add rsp, 16");
+        pat = (address(args[1]).cont.uval&0xFF)*0x0101010101010101ULL;
+        if (pat == 0)
+            emitln("xor eax, eax");
+        else
+            emitln("mov rax, %lld", (long long)pat);
+        for (n = 0; siz-n >= 8; n += 8)
+            emitln("mov qword [rdi+%u], rax", n);
+        if (siz-n >= 4) {
+            emitln("mov dword [rdi+%u], eax", n);
+            n += 4;
+        }
+        if (siz-n >= 2) {
+            emitln("mov word [rdi+%u], ax", n);
+            n += 2;
+        }
+        if (siz-n >= 1)
+            emitln("mov byte [rdi+%u], al", n);
+    } else {
+        emitln("pop rax");
+        emitln("add rsp, 8");
+        emitln("mov ecx, %u", siz);
+        emitln("rep stosb");
+    }
+    return TRUE;
+}
+
 static void x64_call(int i, unsigned tar, unsigned arg1, unsigned arg2)
 {
     int nb;
 
+    if (x64_inline_memop(i, tar, arg1, arg2))
+        return;
     nb = x64_pre_call(i, arg2);
     emitln("call $%s", address(arg1).cont.var.e->attr.str);
     x64_post_call(i, nb);
@@ -1628,7 +1865,7 @@ static void x64_ind_asn(int i, unsigned tar, unsigned arg1, unsigned arg2)
     char *siz_str;
 
     /* force the reload of any target currently in a register */
-    spill_aliased_objects();
+    spill_aliased_objects(i);
 
     if ((cat=get_type_category(instruction(i).type))==TOK_STRUCT || cat==TOK_UNION) {
         int cluttered;
@@ -1652,8 +1889,7 @@ static void x64_ind_asn(int i, unsigned tar, unsigned arg1, unsigned arg2)
             cluttered |= 4;
             emitln("push rcx");
         }
-        emitln("mov ecx, %u", get_sizeof(instruction(i).type));
-        emitln("rep movsb");
+        x64_copy_block(get_sizeof(instruction(i).type));
         if (cluttered & 4)
             emitln("pop rcx");
         if (cluttered & 2)
@@ -1816,8 +2052,7 @@ static void x64_arg(int i, unsigned tar, unsigned arg1, unsigned arg2)
             cluttered |= 4;
             emitln("push rcx");
         }
-        emitln("mov ecx, %u", siz);
-        emitln("rep movsb");
+        x64_copy_block(siz);
         if (cluttered & 4)
             emitln("pop rcx");
         if (cluttered & 2)
@@ -1843,8 +2078,7 @@ static void x64_ret(int i, unsigned tar, unsigned arg1, unsigned arg2)
         emitln("mov rdi, qword [rbp+-8]");
         if (!reg_isempty(X64_RCX))
             spill_reg(X64_RCX);
-        emitln("mov ecx, %u", siz);
-        emitln("rep movsb");
+        x64_copy_block(siz);
     } else if (siz > 8) {
         x64_load(X64_RAX, arg1);
         switch (siz) {
@@ -1867,8 +2101,7 @@ static void x64_ret(int i, unsigned tar, unsigned arg1, unsigned arg2)
             emitln("sub rsp, 8");
             emitln("lea rsi, [rax+8]");
             emitln("mov rdi, rsp");
-            emitln("mov ecx, %u", siz-8);
-            emitln("rep movsb");
+            x64_copy_block(siz-8);
             emitln("pop rdx");
             break;
         }
@@ -1898,8 +2131,7 @@ static void x64_ret(int i, unsigned tar, unsigned arg1, unsigned arg2)
                 emitln("sub rsp, 8");
                 emitln("mov rsi, rax");
                 emitln("mov rdi, rsp");
-                emitln("mov ecx, %u", siz);
-                emitln("rep movsb");
+                x64_copy_block(siz);
                 emitln("pop rax");
                 break;
             }
@@ -2015,11 +2247,11 @@ jump_table:
         }
     }
     /* emit jump table */
-    SET_SEGMENT(ROD_SEG, emitln);
+    set_segment(func_body, ROD_SEG);
     emitln(".jt%d:", jump_tables_counter++);
     for (i = 0; i < interval_size; i++)
         emitln("dq %s", jmp_tab[i]);
-    SET_SEGMENT(TEXT_SEG, emitln);
+    set_segment(func_body, TEXT_SEG);
 
     free(jmp_tab);
     arena_destroy(lab_arena);
@@ -2126,17 +2358,117 @@ static void x64_spill_reg_args(DeclList *p, int offs)
     }
 }
 
+/*
+ * The frame pointer can be omitted in leaf functions that do not
+ * otherwise change rsp in their bodies (struct copies and returns
+ * push and pop registers around block copies). rbp then becomes a
+ * callee-saved general purpose register.
+ */
+static int x64_can_omit_frame_pointer(unsigned fn, DeclList *p)
+{
+    unsigned i, last_i;
+
+    if (!cg_node_is_leaf(fn))
+        return FALSE;
+    for (; p != NULL; p = p->next)
+        if (p->decl->idl!=NULL && p->decl->idl->op==TOK_ELLIPSIS)
+            return FALSE;
+
+    i = cfg_node(cg_node(fn).bb_i).leader;
+    last_i = cfg_node(cg_node(fn).bb_f).last;
+    for (; i <= last_i; i++) {
+        Token cat;
+
+        switch (instruction(i).op) {
+        case OpCall:
+        case OpIndCall:
+        case OpArg:
+            return FALSE;
+        case OpAsn:
+        case OpInd:
+        case OpIndAsn:
+        case OpRet:
+            if (instruction(i).type!=NULL
+            && ((cat=get_type_category(instruction(i).type))==TOK_STRUCT || cat==TOK_UNION))
+                return FALSE;
+            break;
+        default:
+            break;
+        }
+    }
+    return TRUE;
+}
+
+/* rewrite frame references [rbp+n] as [rsp+n+adj] */
+static void x64_rebase_frame(String *s, int adj)
+{
+    char *buf, *p, *q;
+
+    buf = strdup(string_buf(s));
+    string_clear(s);
+    for (p = buf; (q=strstr(p, "[rbp+")) != NULL; p = q) {
+        int n;
+
+        string_printf(s, "%.*s", (int)(q-p), p);
+        n = (int)strtol(q+5, &q, 10);
+        string_printf(s, "[rsp+%d", n+adj);
+    }
+    string_printf(s, "%s", p);
+    free(buf);
+}
+
+/*
+ * Prologue and epilogue for functions without frame pointer.
+ * The frame keeps the layout it would have with rbp pointing just below the
+ * return address. The callee-saved registers are saved below the locals. If
+ * the whole frame fits in the red zone, rsp is not adjusted at all.
+ */
+static void x64_leaf_prolog_and_epilog(TypeExp *header)
+{
+    int i, frame_size, offs, adj;
+
+    offs = size_of_local_area;
+    for (i = X64_RBX; i < X64_NREG; i++)
+        if (modified[i] && x64_is_callee_saved((X64_Reg)i))
+            offs -= 8;
+    frame_size = 8-offs; /* the virtual frame pointer is 8 bytes below rsp on entry */
+    if (frame_size <= X64_RED_ZONE_SIZE)
+        frame_size = 0;
+    else
+        frame_size = round_up(frame_size, 16);
+    adj = frame_size-8;
+
+    if (frame_size)
+        emit_prologln("sub rsp, %d", frame_size);
+    offs = size_of_local_area;
+    for (i = X64_RBX; i < X64_NREG; i++) {
+        if (modified[i] && x64_is_callee_saved((X64_Reg)i)) {
+            offs -= 8;
+            emit_prologln("mov [rbp+%d], %s", offs, x64_reg_str[i]);
+            emit_epilogln("mov %s, [rbp+%d]", x64_reg_str[i], offs);
+        }
+    }
+    x64_spill_reg_args(header->child->attr.dl, -8);
+    if (frame_size)
+        emit_epilogln("add rsp, %d", frame_size);
+    emit_epilogln("ret");
+
+    x64_rebase_frame(func_prolog, adj);
+    x64_rebase_frame(func_body, adj);
+    x64_rebase_frame(func_epilog, adj);
+}
+
 void x64_function_definition(TypeExp *decl_specs, TypeExp *header)
 {
     Token cat;
     TypeExp *scs;
-    int i, last_i;
+    int i, last_i, nsaved;
     Declaration ty;
     unsigned fn, pos_tmp;
     static int first_func = TRUE;
 
     curr_func = header->str;
-    fn = new_cg_node(curr_func);
+    curr_cg_node = fn = new_cg_node(curr_func);
     size_of_local_area = round_up(cg_node(fn).size_of_local_area, 8);
 
     ty.decl_specs = decl_specs;
@@ -2147,12 +2479,19 @@ void x64_function_definition(TypeExp *decl_specs, TypeExp *header)
     if (!first_func)
         emit_prolog("\n");
     emit_prologln("; ==== start of definition of function `%s' ====", curr_func);
-    SET_SEGMENT(TEXT_SEG, emit_prologln);
+    if (function_sections)
+        curr_segment = -1;
+    set_segment(func_prolog, TEXT_SEG);
     if ((scs=get_sto_class_spec(decl_specs))==NULL || scs->op!=TOK_STATIC)
         emit_prologln("global $%s", curr_func);
     emit_prologln("$%s:", curr_func);
-    emit_prologln("push rbp");
-    emit_prologln("mov rbp, rsp");
+    if (!big_return && x64_can_omit_frame_pointer(fn, header->child->attr.dl)) {
+        omit_fp = TRUE;
+    } else {
+        emit_prologln("push rbp");
+        emit_prologln("mov rbp, rsp");
+        pin_reg(X64_RBP);
+    }
 
     i = cfg_node(cg_node(fn).bb_i).leader;
     last_i = cfg_node(cg_node(fn).bb_f).last;
@@ -2220,6 +2559,15 @@ void x64_function_definition(TypeExp *decl_specs, TypeExp *header)
     }
     string_set_pos(func_body, pos_tmp);
 
+    if (omit_fp) {
+        x64_leaf_prolog_and_epilog(header);
+        goto done;
+    }
+
+    /* make rsp 16-byte aligned once the callee-saved registers are pushed */
+    nsaved = modified[X64_RBX]+modified[X64_R12]+modified[X64_R13]+modified[X64_R14]+modified[X64_R15];
+    if ((-size_of_local_area+nsaved*8) % 16)
+        size_of_local_area -= 8;
     if (size_of_local_area)
         emit_prologln("sub rsp, %d", -size_of_local_area);
     x64_spill_reg_args(header->child->attr.dl, big_return?-16:-8);
@@ -2243,6 +2591,9 @@ void x64_function_definition(TypeExp *decl_specs, TypeExp *header)
     emit_epilogln("pop rbp");
     emit_epilogln("ret");
 
+done:
+    peep_optimize(func_body, TRUE);
+
     string_write(func_prolog, x64_output_file);
     string_write(func_body, x64_output_file);
     string_write(func_epilog, x64_output_file);
@@ -2258,11 +2609,13 @@ void x64_function_definition(TypeExp *decl_specs, TypeExp *header)
     memset(modified, 0, sizeof(int)*X64_NREG);
     memset(pinned, 0, sizeof(int)*X64_NREG);
     free_all_temps();
+    dflow_free_pointees(curr_cg_node);
 #if 1
     memset(addr_descr_tab, -1, nid_counter*sizeof(int));
     memset(reg_descr_tab, 0, sizeof(unsigned)*X64_NREG);
 #endif
     big_return = FALSE;
+    omit_fp = FALSE;
 #if 0
     dump_addr_descr_tab();
     dump_reg_descr_tab();
@@ -2511,6 +2864,16 @@ scalar:
     }
 }
 
+/* with -fdata-sections each object goes into its own .data.<name>/.bss.<name> section */
+static void set_object_segment(int seg, ExternId *np)
+{
+    if (np->enclosing_function != NULL)
+        emit_declln("segment %s.%s@%s", str_segment[seg], np->enclosing_function, np->declarator->str);
+    else
+        emit_declln("segment %s.%s", str_segment[seg], np->declarator->str);
+    curr_segment = -1;
+}
+
 void x64_allocate_static_objects(void)
 {
     ExternId *np;
@@ -2526,11 +2889,17 @@ void x64_allocate_static_objects(void)
 
         al = get_alignment(&ty);
         if (initzr != NULL) {
-            SET_SEGMENT(DATA_SEG, emit_declln);
+            if (data_sections)
+                set_object_segment(DATA_SEG, np);
+            else
+                set_segment(asm_decls, DATA_SEG);
             if (al > 1)
                 emit_declln("align %u", al);
         } else {
-            SET_SEGMENT(BSS_SEG, emit_declln);
+            if (data_sections)
+                set_object_segment(BSS_SEG, np);
+            else
+                set_segment(asm_decls, BSS_SEG);
             if (al > 1)
                 emit_declln("alignb %u", al);
         }
@@ -2559,7 +2928,6 @@ void x64_cgen(FILE *outf)
 
     /* generate intermediate code and do some analysis */
     ic_main(&func_def_list, &ext_sym_list); //exit(0);
-    compute_liveness_and_next_use();
 
     /* generate assembly */
     asm_decls = string_new(512);
@@ -26,6 +26,7 @@
 #include "../dflow.h"
 #include "../str.h"
 #include "../luxcc.h"
+#include "../peep.h"
 
 typedef enum {
     X86_EAX,
@@ -72,8 +73,17 @@ static char *x86_lbreg_str[] = {
     "??",
 };
 
+/*
+ * Block copies/fills of up to INLINE_UNROLL_MAX bytes are expanded into
+ * moves, those of up to INLINE_REP_MAX bytes use 'rep movsb/stosb', and
+ * memcpy/memset calls of more bytes than that are left alone.
+ */
+#define INLINE_UNROLL_MAX   32
+#define INLINE_REP_MAX      1024
+
 static int size_of_local_area;
 static char *curr_func, *enclosing_function;
+static unsigned curr_cg_node;
 static unsigned temp_struct_size;
 static int big_return, qword_return;
 static int arg_stack[64], arg_stack_top;
@@ -98,13 +108,6 @@ static char *str_segment[] = {
     ".bss",
     ".rodata"
 };
-#define SET_SEGMENT(seg, f)\
-    do {\
-        if (curr_segment != seg) {\
-            f("segment %s", str_segment[seg]);\
-            curr_segment = seg;\
-        }\
-    } while(0)
 
 static int new_string_literal(unsigned a);
 static void emit_raw_string(String *q, char *s);
@@ -120,6 +123,18 @@ static String *func_body, *func_prolog, *func_epilog, *asm_decls, *str_lits;
 #define emit_str(...)       (string_printf(str_lits, __VA_ARGS__))
 #define emit_strln(...)     (string_printf(str_lits, __VA_ARGS__), string_printf(str_lits, "\n"))
 
+/* with -ffunction-sections each function goes into its own .text.<name> section */
+static void set_segment(String *s, int seg)
+{
+    if (curr_segment == seg)
+        return;
+    if (seg == TEXT_SEG && function_sections)
+        string_printf(s, "segment .text.%s\n", curr_func);
+    else
+        string_printf(s, "segment %s\n", str_segment[seg]);
+    curr_segment = seg;
+}
+
 static X86_Reg2 *addr_descr_tab;
 static unsigned reg_descr_tab[X86_NREG];
 #define addr_reg(a)     (addr_descr_tab[address_nid(a)])
@@ -130,8 +145,9 @@ static void dump_addr_descr_tab(void);
 static void dump_reg_descr_tab(void);
 
 static void spill_reg(X86_Reg r);
-static void spill_all(void);
-static void spill_aliased_objects(void);
+static void spill_aliased_objects(int i);
+static void spill_objects(BSet *s);
+static void spill_for_call(unsigned effects, BSet *mso);
 static X86_Reg get_reg(int intr);
 static X86_Reg get_reg0(void);
 
@@ -141,6 +157,7 @@ static void x86_load_addr(X86_Reg r, unsigned a);
 static char *x86_get_operand(unsigned a);
 static char **x86_get_operand2(unsigned a);
 static void x86_store(X86_Reg r, unsigned a);
+static void x86_copy_block(unsigned siz);
 static void x86_store2(X86_Reg2 r, unsigned a);
 static void x86_compare_against_constant(unsigned a, unsigned c);
 static void x86_function_definition(TypeExp *decl_specs, TypeExp *header);
@@ -229,31 +246,102 @@ void spill_reg(X86_Reg r)
     }
 }
 
-void spill_all(void)
+/*
+ * Spill the objects the pointer operand of quad i may point to.
+ * => Possible improvement: use type information to narrow down the set
+ * of objects to spill (see 6.5#7).
+ */
+void spill_aliased_objects(int i)
 {
-    int i;
+    spill_objects(ind_pointees(i));
+}
 
-    for (i = 0; i < X86_NREG; i++)
-        spill_reg((X86_Reg)i);
+/*
+ * Spill the objects of set s currently held in registers.
+ */
+void spill_objects(BSet *s)
+{
+    int r;
+
+    for (r = 0; r < X86_NREG; r++) {
+        unsigned a;
+
+        if (reg_isempty(r))
+            continue;
+        a = reg_descr_tab[r];
+        if (address(a).kind==IdKind && bset_member(s, address_nid(a)))
+            spill_reg(r);
+    }
+}
+
+static int x86_is_callee_saved(X86_Reg r)
+{
+    return (r==X86_EBX || r==X86_ESI || r==X86_EDI);
 }
 
 /*
- * Currently all address-taken variables are considered to be aliased.
- * => Possible improvement: use type information to narrow down the set
- * of objects to spill (see 6.5#7).
+ * Prepare the register file for a call to a function whose side effects
+ * are summarized by 'effects' and 'mso' (the static objects it may modify;
+ * NULL for runtime library helpers, which touch none).
+ * See the x64 back-end for the details. Here only EBX is used to keep values
+ * across the call (ESI and EDI have no byte forms).
  */
-void spill_aliased_objects(void)
+void spill_for_call(unsigned effects, BSet *mso)
 {
     int i;
 
     for (i = 0; i < X86_NREG; i++) {
         unsigned a;
+        int is_static, is_aliased, must_spill, must_store;
 
         if (reg_isempty(i))
             continue;
         a = reg_descr_tab[i];
-        if (address(a).kind==IdKind && bset_member(address_taken_variables, address_nid(a)))
-            spill_reg(i);
+        if (addr_reg2(a) != -1) {
+            spill_reg((X86_Reg)i);
+            continue;
+        }
+        is_static = is_aliased = FALSE;
+        if (address(a).kind == IdKind) {
+            ExecNode *e;
+
+            e = address(a).cont.var.e;
+            switch (get_type_category(&e->type)) {
+            case TOK_STRUCT: case TOK_UNION:
+            case TOK_CHAR: case TOK_SIGNED_CHAR: case TOK_UNSIGNED_CHAR:
+            case TOK_SHORT: case TOK_UNSIGNED_SHORT:
+                spill_reg((X86_Reg)i);
+                continue;
+            }
+            is_static = (e->attr.var.duration == DURATION_STATIC);
+            is_aliased = bset_member(cg_node(curr_cg_node).aliased_objects, address_nid(a));
+        }
+        must_spill = must_store = FALSE;
+        if (is_static) {
+            must_spill = (effects&SE_UNKNOWN) || (mso!=NULL && bset_member(mso, address_nid(a)))
+                      || ((effects&SE_WRITES_PTR) && is_aliased);
+            must_store = (effects&SE_READS_STATIC) || ((effects&SE_READS_PTR) && is_aliased);
+        } else if (is_aliased) {
+            must_spill = (effects&(SE_UNKNOWN|SE_WRITES_PTR)) != 0;
+            must_store = (effects&SE_READS_PTR) != 0;
+        }
+        if (must_spill) {
+            spill_reg((X86_Reg)i);
+            continue;
+        }
+        if (must_store)
+            x86_store((X86_Reg)i, a);
+        if (!x86_is_callee_saved((X86_Reg)i)) {
+            if (pinned[X86_EBX] || !reg_isempty(X86_EBX)) {
+                spill_reg((X86_Reg)i);
+                continue;
+            }
+            modified[X86_EBX] = TRUE;
+            emitln("mov ebx, %s", x86_reg_str[i]);
+            reg_descr_tab[X86_EBX] = a;
+            addr_reg1(a) = X86_EBX;
+            reg_descr_tab[i] = 0;
+        }
     }
 }
 
@@ -638,6 +726,33 @@ void x86_load_addr(X86_Reg r, unsigned a)
     }
 }
 
+/*
+ * Copy siz bytes from [esi] to [edi]. ecx is used as scratch register.
+ */
+void x86_copy_block(unsigned siz)
+{
+    unsigned n;
+
+    if (siz > INLINE_UNROLL_MAX) {
+        emitln("mov ecx, %u", siz);
+        emitln("rep movsb");
+        return;
+    }
+    for (n = 0; siz-n >= 4; n += 4) {
+        emitln("mov ecx, dword [esi+%u]", n);
+        emitln("mov dword [edi+%u], ecx", n);
+    }
+    if (siz-n >= 2) {
+        emitln("mov cx, word [esi+%u]", n);
+        emitln("mov word [edi+%u], cx", n);
+        n += 2;
+    }
+    if (siz-n >= 1) {
+        emitln("mov cl, byte [esi+%u]", n);
+        emitln("mov byte [edi+%u], cl", n);
+    }
+}
+
 void x86_store(X86_Reg r, unsigned a)
 {
     if (address(a).kind == IdKind) {
@@ -675,9 +790,7 @@ void x86_store(X86_Reg r, unsigned a)
                 cluttered |= 4;
                 emitln("push ecx");
             }
-            emitln("mov ecx, %u", get_sizeof(&e->type));
-            /*emitln("cld");*/
-            emitln("rep movsb");
+            x86_copy_block(get_sizeof(&e->type));
             /* restore all */
             if (cluttered & 4)
                 emitln("pop ecx");
@@ -971,7 +1084,7 @@ static void x86_do_libcall(int i, unsigned tar, unsigned arg1, unsigned arg2, in
         emitln("push %s", op[0]);
         nb += 8;
 
-        spill_all();
+        spill_for_call(0, NULL);
         emitln("call %s", libfuncs[func]);
         emitln("add esp, %d", nb);
         UPDATE_ADDRESSES2(res);
@@ -992,7 +1105,7 @@ static void x86_do_libcall(int i, unsigned tar, unsigned arg1, unsigned arg2, in
         emitln("push %s", op[0]);
         nb += 8;
 
-        spill_all();
+        spill_for_call(0, NULL);
         emitln("call %s", libfuncs[func]);
         emitln("add esp, %d", nb);
         UPDATE_ADDRESSES2(res);
@@ -1012,7 +1125,7 @@ static void x86_do_libcall(int i, unsigned tar, unsigned arg1, unsigned arg2, in
         emitln("push %s", op[0]);
         nb += 8;
 
-        spill_all();
+        spill_for_call(0, NULL);
         emitln("call __lux_ucmp64");
         emitln("add esp, %d", nb);
 
@@ -1046,7 +1159,7 @@ static void x86_do_libcall(int i, unsigned tar, unsigned arg1, unsigned arg2, in
         emitln("push %s", op[0]);
         nb += 8;
 
-        spill_all();
+        spill_for_call(0, NULL);
         emitln("call %s", libfuncs[func]);
         emitln("add esp, %d", nb);
 
@@ -1781,7 +1894,7 @@ static void x86_ind(int i, unsigned tar, unsigned arg1, unsigned arg2)
     Token cat;
 
     /* spill any target currently in a register */
-    spill_aliased_objects();
+    spill_aliased_objects(i);
 
     if (ISLL(instruction(i).type)) {
         X86_Reg2 res;
@@ -1846,7 +1959,17 @@ static void x86_pre_call(int i)
 {
     Token cat;
 
-    spill_all();
+    if (instruction(i).op == OpCall) {
+        int fn;
+
+        fn = cg_node_lookup(address(instruction(i).arg1).cont.var.e->attr.str);
+        if (fn==-1 || cg_node_is_empty(fn))
+            spill_for_call(SE_UNKNOWN, NULL);
+        else
+            spill_for_call(cg_node(fn).side_effects, cg_node(fn).modified_static_objects_tr);
+    } else {
+        spill_for_call(SE_UNKNOWN, NULL);
+    }
     if ((cat=get_type_category(instruction(i).type))==TOK_STRUCT || cat==TOK_UNION) {
         unsigned siz;
 
@@ -1892,8 +2015,84 @@ static void x86_indcall(int i, unsigned tar, unsigned arg1, unsigned arg2)
     }
 }
 
+/*
+ * Expand inline a call to the library memcpy/memset (such as those
+ * emitted for struct and array initializers) when the number of bytes
+ * is a small constant. The arguments have already been pushed.
+ */
+static int x86_inline_memop(int i, unsigned tar, unsigned arg1, unsigned arg2)
+{
+    int j, na, fn, is_memset;
+    unsigned args[3], siz, n;
+    char *id;
+
+    id = address(arg1).cont.var.e->attr.str;
+    if (!(is_memset=equal(id, "memset")) && !equal(id, "memcpy"))
+        return FALSE;
+    if (address(arg2).cont.val!=3 || tar && tar_liveness(i))
+        return FALSE;
+    if ((fn=cg_node_lookup(id))!=-1 && !cg_node_is_empty(fn))
+        return FALSE; /* not the library function */
+    /* args[0] = dest, args[1] = src/value, args[2] = count */
+    for (j = i-1, na = 0; na < 3; j--) {
+        if (instruction(j).op==OpCall || instruction(j).op==OpIndCall)
+            return FALSE;
+        if (instruction(j).op == OpArg)
+            args[na++] = instruction(j).arg1;
+    }
+    if (address(args[2]).kind != IConstKind
+    || (siz=(unsigned)address(args[2]).cont.uval) > INLINE_REP_MAX)
+        return FALSE;
+    for (na = 1; na <= 3; na++)
+        if (arg_stack[arg_stack_top-na] != 4)
+            return FALSE;
+    arg_stack_top -= 3;
+
+    /* the destination/source may be any aliased object */
+    spill_objects(cg_node(curr_cg_node).aliased_objects);
+    spill_reg(X86_EDI);
+    spill_reg(X86_ECX);
+    modified[X86_EDI] = TRUE;
+    emitln("pop edi");
+    if (!is_memset) {
+        spill_reg(X86_ESI);
+        modified[X86_ESI] = TRUE;
+        emitln("pop esi");
+        emitln("add esp, 4");
+        x86_copy_block(siz);
+        return TRUE;
+    }
+    spill_reg(X86_EAX);
+    if (address(args[1]).kind==IConstKind && siz<=INLINE_UNROLL_MAX) {
+        unsigned pat;
+
+        emitln("add esp, 8");
+        pat = ((unsigned)address(args[1]).cont.uval&0xFF)*0x01010101U;
+        if (pat == 0)
+            emitln("xor eax, eax");
+        else
+            emitln("mov eax, %u", pat);
+        for (n = 0; siz-n >= 4; n += 4)
+            emitln("mov dword [edi+%u], eax", n);
+        if (siz-n >= 2) {
+            emitln("mov word [edi+%u], ax", n);
+            n += 2;
+        }
+        if (siz-n >= 1)
+            emitln("mov byte [edi+%u], al", n);
+    } else {
+        emitln("pop eax");
+        emitln("add esp, 4");
+        emitln("mov ecx, %u", siz);
+        emitln("rep stosb");
+    }
+    return TRUE;
+}
+
 static void x86_call(int i, unsigned tar, unsigned arg1, unsigned arg2)
 {
+    if (x86_inline_memop(i, tar, arg1, arg2))
+        return;
     x86_pre_call(i);
     emitln("call $%s", address(arg1).cont.var.e->attr.str);
     x86_post_call(arg2);
@@ -1917,7 +2116,7 @@ static void x86_ind_asn(int i, unsigned tar, unsigned arg1, unsigned arg2)
     char *siz_str;
 
     /* force the reload of any target currently in a register */
-    spill_aliased_objects();
+    spill_aliased_objects(i);
 
     if (ISLL(instruction(i).type)) {
         if (addr_reg1(arg1) == -1) {
@@ -1982,9 +2181,7 @@ static void x86_ind_asn(int i, unsigned tar, unsigned arg1, unsigned arg2)
             cluttered |= 4;
             emitln("push ecx");
         }
-        emitln("mov ecx, %u", get_sizeof(instruction(i).type));
-        /*emitln("cld");*/
-        emitln("rep movsb");
+        x86_copy_block(get_sizeof(instruction(i).type));
         if (cluttered & 4)
             emitln("pop ecx");
         if (cluttered & 2)
@@ -2141,9 +2338,7 @@ static void x86_arg(int i, unsigned tar, unsigned arg1, unsigned arg2)
             cluttered |= 4;
             emitln("push ecx");
         }
-        emitln("mov ecx, %u", siz);
-        /*emitln("cld");*/
-        emitln("rep movsb");
+        x86_copy_block(siz);
         if (cluttered & 4)
             emitln("pop ecx");
         if (cluttered & 2)
@@ -2177,8 +2372,7 @@ static void x86_ret(int i, unsigned tar, unsigned arg1, unsigned arg2)
         modified[X86_EDI] = TRUE;
         if (!reg_isempty(X86_ECX))
             spill_reg(X86_ECX);
-        emitln("mov ecx, %u", siz);
-        emitln("rep movsb");
+        x86_copy_block(siz);
         /*if (!reg_isempty(X86_EAX))
             spill_reg(X86_EAX);
         emitln("mov eax, dword [ebp-4]");*/
@@ -2347,11 +2541,11 @@ jump_table:
         }
     }
     /* emit jump table */
-    SET_SEGMENT(ROD_SEG, emitln);
+    set_segment(func_body, ROD_SEG);
     emitln(".jt%d:", jump_tables_counter++);
     for (i = 0; i < interval_size; i++)
         emitln("dd %s", jmp_tab[i]);
-    SET_SEGMENT(TEXT_SEG, emitln);
+    set_segment(func_body, TEXT_SEG);
 
     free(jmp_tab);
     arena_destroy(lab_arena);
@@ -2394,6 +2588,118 @@ static void (*instruction_handlers[])(int, unsigned, unsigned, unsigned) = {
     x86_nop
 };
 
+/*
+ * Return TRUE if the function body does not call anything and does not change
+ * esp (liblux calls, struct copies and the byte-register workarounds for ESI/EDI
+ * all use the stack). Frame references can then be made relative to esp.
+ * EBP is not made allocatable because, like ESI and EDI, it has no byte form.
+ * The test on the intermediate code is the same as x64's; the generated code
+ * is then scanned once for the stack uses that have no IC counterpart.
+ */
+static int x86_can_omit_frame_pointer(unsigned fn, DeclList *dl)
+{
+    char *p, *q, *s;
+    unsigned i, last_i;
+
+    if (big_return || !cg_node_is_leaf(fn))
+        return FALSE;
+    for (; dl != NULL; dl = dl->next)
+        if (dl->decl->idl!=NULL && dl->decl->idl->op==TOK_ELLIPSIS)
+            return FALSE;
+
+    i = cfg_node(cg_node(fn).bb_i).leader;
+    last_i = cfg_node(cg_node(fn).bb_f).last;
+    for (; i <= last_i; i++) {
+        Token cat;
+
+        switch (instruction(i).op) {
+        case OpCall:
+        case OpIndCall:
+        case OpArg:
+            return FALSE;
+        case OpAsn:
+        case OpInd:
+        case OpIndAsn:
+        case OpRet:
+            if (instruction(i).type!=NULL
+            && ((cat=get_type_category(instruction(i).type))==TOK_STRUCT || cat==TOK_UNION))
+                return FALSE;
+            break;
+        default:
+            break;
+        }
+    }
+
+    for (p = string_buf(func_body); *p != '\0'; p = q) {
+        if (strncmp(p, "push ", 5)==0 || strncmp(p, "pop ", 4)==0 || strncmp(p, "call ", 5)==0)
+            return FALSE;
+        for (q = p; *q!='\0' && *q!='\n'; q++)
+            ;
+        for (s = p; s+3 <= q; s++)
+            if (s[0]=='e' && s[1]=='s' && s[2]=='p')
+                return FALSE;
+        if (*q != '\0')
+            ++q;
+    }
+    return TRUE;
+}
+
+/* rewrite frame references [ebp+n] as [esp+n+adj] */
+static void x86_rebase_frame(String *s, int adj)
+{
+    char *buf, *p, *q;
+
+    buf = strdup(string_buf(s));
+    string_clear(s);
+    for (p = buf; (q=strstr(p, "[ebp+")) != NULL; p = q) {
+        int n;
+
+        string_printf(s, "%.*s", (int)(q-p), p);
+        n = (int)strtol(q+5, &q, 10);
+        string_printf(s, "[esp+%d", n+adj);
+    }
+    string_printf(s, "%s", p);
+    free(buf);
+}
+
+/*
+ * Prologue and epilogue for functions without frame pointer.
+ * The frame keeps the layout it would have with ebp pointing just below the
+ * return address. The callee-saved registers are saved below the locals.
+ */
+static void x86_leaf_prolog_and_epilog(void)
+{
+    int frame_size, offs;
+
+    offs = size_of_local_area-4*(modified[X86_ESI]+modified[X86_EDI]+modified[X86_EBX]);
+    frame_size = offs ? 4-offs : 0; /* the virtual frame pointer is 4 bytes below esp on entry */
+    if (frame_size)
+        emit_prologln("sub esp, %d", frame_size);
+    offs = size_of_local_area;
+    if (modified[X86_ESI]) {
+        offs -= 4;
+        emit_prologln("mov [ebp+%d], esi", offs);
+        emit_epilogln("mov esi, [ebp+%d]", offs);
+    }
+    if (modified[X86_EDI]) {
+        offs -= 4;
+        emit_prologln("mov [ebp+%d], edi", offs);
+        emit_epilogln("mov edi, [ebp+%d]", offs);
+    }
+    if (modified[X86_EBX]) {
+        offs -= 4;
+        emit_prologln("mov [ebp+%d], ebx", offs);
+        emit_epilogln("mov ebx, [ebp+%d]", offs);
+    }
+    if (frame_size)
+        emit_epilogln("add esp, %d", frame_size);
+    emit_epilogln("ret");
+
+    x86_rebase_frame(func_prolog, frame_size-4);
+    x86_rebase_frame(func_body, frame_size-4);
+    x86_rebase_frame(func_epilog, frame_size-4);
+}
+
 void x86_function_definition(TypeExp *decl_specs, TypeExp *header)
 {
     /*
@@ -2432,7 +2738,7 @@ void x86_function_definition(TypeExp *decl_specs, TypeExp *header)
     static int first_func = TRUE;
 
     curr_func = header->str;
-    fn = new_cg_node(curr_func);
+    curr_cg_node = fn = new_cg_node(curr_func);
     size_of_local_area = round_up(cg_node(fn).size_of_local_area, 4);
 
     ty.decl_specs = decl_specs;
@@ -2445,7 +2751,9 @@ void x86_function_definition(TypeExp *decl_specs, TypeExp *header)
     if (!first_func)
         emit_prolog("\n");
     emit_prologln("; ==== start of definition of function `%s' ====", curr_func);
-    SET_SEGMENT(TEXT_SEG, emit_prologln);
+    if (function_sections)
+        curr_segment = -1;
+    set_segment(func_prolog, TEXT_SEG);
     if ((scs=get_sto_class_spec(decl_specs))==NULL || scs->op!=TOK_STATIC)
         emit_prologln("global $%s", curr_func);
     emit_prologln("$%s:", curr_func);
@@ -2453,8 +2761,6 @@ void x86_function_definition(TypeExp *decl_specs, TypeExp *header)
         emit_prologln("pop eax");
         emit_prologln("xchg [esp], eax");
     }
-    emit_prologln("push ebp");
-    emit_prologln("mov ebp, esp");
 
     i = cfg_node(cg_node(fn).bb_i).leader;
     last_i = cfg_node(cg_node(fn).bb_f).last;
@@ -2483,6 +2789,13 @@ void x86_function_definition(TypeExp *decl_specs, TypeExp *header)
     }
     string_set_pos(func_body, pos_tmp);
 
+    if (x86_can_omit_frame_pointer(fn, header->child->attr.dl)) {
+        x86_leaf_prolog_and_epilog();
+        goto done;
+    }
+
+    emit_prologln("push ebp");
+    emit_prologln("mov ebp, esp");
     if (size_of_local_area)
         emit_prologln("sub esp, %d", -size_of_local_area);
     if (modified[X86_ESI]) emit_prologln("push esi");
@@ -2501,6 +2814,9 @@ void x86_function_definition(TypeExp *decl_specs, TypeExp *header)
     emit_epilogln("pop ebp");
     emit_epilogln("ret");
 
+done:
+    peep_optimize(func_body, FALSE);
+
     string_write(func_prolog, x86_output_file);
     string_write(func_body, x86_output_file);
     string_write(func_epilog, x86_output_file);
@@ -2514,6 +2830,7 @@ void x86_function_definition(TypeExp *decl_specs, TypeExp *header)
     memset(modified, 0, sizeof(int)*X86_NREG);
     memset(pinned, 0, sizeof(int)*X86_NREG);
     free_all_temps();
+    dflow_free_pointees(curr_cg_node);
 #if 1
     memset(addr_descr_tab, -1, nid_counter*sizeof(int));
     memset(reg_descr_tab, 0, sizeof(unsigned)*X86_NREG);
@@ -2766,6 +3083,16 @@ scalar:
     }
 }
 
+/* with -fdata-sections each object goes into its own .data.<name>/.bss.<name> section */
+static void set_object_segment(int seg, ExternId *np)
+{
+    if (np->enclosing_function != NULL)
+        emit_declln("segment %s.%s@%s", str_segment[seg], np->enclosing_function, np->declarator->str);
+    else
+        emit_declln("segment %s.%s", str_segment[seg], np->declarator->str);
+    curr_segment = -1;
+}
+
 void x86_allocate_static_objects(void)
 {
     ExternId *np;
@@ -2781,11 +3108,17 @@ void x86_allocate_static_objects(void)
 
         al = get_alignment(&ty);
         if (initzr != NULL) {
-            SET_SEGMENT(DATA_SEG, emit_declln);
+            if (data_sections)
+                set_object_segment(DATA_SEG, np);
+            else
+                set_segment(asm_decls, DATA_SEG);
             if (al > 1)
                 emit_declln("align %u", al);
         } else {
-            SET_SEGMENT(BSS_SEG, emit_declln);
+            if (data_sections)
+                set_object_segment(BSS_SEG, np);
+            else
+                set_segment(asm_decls, BSS_SEG);
             if (al > 1)
                 emit_declln("alignb %u", al);
         }
@@ -2814,7 +3147,6 @@ void x86_cgen(FILE *outf)
 
     /* generate intermediate code and do some analysis */
     ic_main(&func_def_list, &ext_sym_list); //exit(0);
-    compute_liveness_and_next_use();
 
     /* generate assembly */
     asm_decls = string_new(512);